@@ -1,191 +1,1522 @@
+#pragma once
+#include "bufferPool.hpp"
 #include "endianHelpers.hpp"
-#include "fnv1a.hpp"
-#include "miniJson.hpp"
-#include "zstdCtxWrapper.hpp"
+#include "codec.hpp"
+#include "contentHash.hpp"
+#include "crc32c.hpp"
+#include "pipelineStats.hpp"
+#include "sparseFile.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <zstd.h>
 
 namespace fs = std::filesystem;
 
-// --- archive writer ---
-class ArchiveWriter
+// --- archive layout ---
+// Version 2, all integers little-endian. Every piece of the archive is a frame whose header ends in
+//   size crc(u32) head_crc(u32)
+// crc is the CRC-32C of the size payload bytes that follow the header, head_crc that of the header before it. Readers
+// check every header they use, and the crc of payloads that have no checksum of their own (stored records, blocks);
+// zstd and LZ4 frames are written with their content checksum, which the decoder verifies. Salvage walks the frames
+// front to back at sequential read speed, trusting a frame's size once its head_crc holds, and only steps byte by
+// byte across damage.
+//   records  tag digest(hi, lo) usize  size crc head_crc  payload
+//   solid    "SBLK" usize              size crc head_crc  payload
+//   blocks   tag                       size crc head_crc  payload
+// A record's tag names the payload's codec ("ZSTD", "LZ4F", or "RAW0" for data stored as is, size == usize; see
+// codec.hpp). Blocks are the manifest ("HDR0"), the index ("IDX2"), and the extra blocks found through the index's
+// section table. The archive ends with the manifest, the index and a fixed-size trailer, so opening it takes one
+// read of each:
+//   ... "HDR0" frame  "IDX2" frame  version(u32) header_offset header_size index_offset index_size crc(u32) "AIXT"
+//   index payload = count algo {digest offset usize csize}* [sections]
+//   sections      = count(u32) {tag[4] offset size}*, present when the archive has extra blocks (e.g. "DICT")
+// The trailer's offsets are those of the frames, its sizes those of their payloads, and its crc covers the bytes
+// before it. Index offsets are of the record frame; section offsets are of the block payload.
+//
+// Solid blocks hold many small blobs in one zstd frame. Two sections describe them:
+//   "BLKS" {payload_offset usize csize}*                   block table, by block id
+//   "SIDX" {digest block(u32) offset_in_block size}*       members, not listed in the index
+// A delta archive (pack --base) has a "BASE" block {base_size(u64) path}: blobs missing from its own index are read
+// from the base archive, which may itself be a delta. The path is relative to the delta's directory.
+// Records compressed against another blob's content as zstd prefix (pack --similar) are listed in a "REFS" section,
+// {digest reference_digest}*; the reference is decoded first, and may live anywhere along the base chain.
+// File metadata (mode, owner, times, xattrs) is a "META" block holding a MetaTable, see metadata.hpp.
+//
+// The stream layout (pack to stdout, or pack --streamable) is for readers that can't seek: unpack - restores it in
+// one forward pass (see streamUnpack.hpp). It starts with a "STRM" block {algo(u8)}, and the manifest entries come
+// ahead of the data they need, in "ENTS" blocks (see Manifest::entries()): every record and solid block follows the
+// entries of the files it holds content for. A solid block is preceded by an "SMEM" block {digest offset_in_block
+// size}* listing its members. The end is the same as above, so a seekable reader opens the archive like any other.
+// unpack - has no archive directory to resolve a relative "BASE" path against, and takes the current directory.
+//
+// Version 1 had no frames and no checksums: records were tag digest usize csize payload, solid blocks "SBLK" usize
+// csize payload, blocks tag len payload, and the "IDX1" index ran up to a trailer header_offset index_offset "AIX1".
+// Version 0 ("IDX0"/"AIX0") used a 64-bit FNV-1a hash in native byte order, both in the index and the records.
+// Archives written before the index existed end right after the header; those are indexed with one linear pass.
+inline constexpr uint32_t NO_BLOCK = UINT32_MAX;
+inline constexpr uint32_t NO_REF   = UINT32_MAX;
+
+struct IndexEntry
+{
+    uint64_t offset; // position of the record tag; for solid block members the offset inside the uncompressed block
+    uint64_t usize;
+    uint64_t csize;              // 0 for solid block members
+    uint32_t block   = NO_BLOCK; // solid block id, or NO_BLOCK for a record of its own
+    uint32_t archive = 0;        // reader only: 0 for this archive, n for the n-th base up the chain
+    uint32_t ref     = NO_REF;   // reader only: the prefix blob, by position in its archive's reference table
+};
+
+struct SolidMember
+{
+    Digest hash;
+    uint64_t offset; // inside the uncompressed block
+    uint64_t size;
+};
+
+inline constexpr uint32_t FORMAT_VERSION             = 2;
+inline constexpr char TRAILER_MAGIC[4]                = {'A', 'I', 'X', 'T'};
+inline constexpr std::streamoff TRAILER_SIZE          = 2 * sizeof(uint32_t) + 4 * sizeof(uint64_t) + 4;
+inline constexpr std::streamoff FRAME_TAIL_SIZE       = sizeof(uint64_t) + 2 * sizeof(uint32_t); // size, crc, head_crc
+inline constexpr std::streamoff RECORD_HEADER_SIZE    = 4 + 3 * sizeof(uint64_t) + FRAME_TAIL_SIZE; // tag, digest (2 words), usize
+inline constexpr std::streamoff SOLID_HEADER_SIZE     = 4 + sizeof(uint64_t) + FRAME_TAIL_SIZE;     // "SBLK", usize
+inline constexpr std::streamoff BLOCK_HEADER_SIZE     = 4 + FRAME_TAIL_SIZE;
+
+inline constexpr char INDEX_TRAILER_MAGIC[4]          = {'A', 'I', 'X', '1'};
+inline constexpr char INDEX_TRAILER_MAGIC_V0[4]       = {'A', 'I', 'X', '0'};
+inline constexpr std::streamoff INDEX_TRAILER_SIZE    = 2 * sizeof(uint64_t) + 4;
+inline constexpr std::streamoff RECORD_HEADER_SIZE_V1 = 4 + 4 * sizeof(uint64_t); // tag, digest (2 words), usize, csize
+inline constexpr std::streamoff RECORD_HEADER_SIZE_V0 = 4 + 3 * sizeof(uint64_t);
+
+// --- frames ---
+
+// A frame header: head (the tag and the frame's own fields) followed by size, the payload's CRC and the header's own.
+inline std::string frame_head(std::string head, uint64_t size, uint32_t crc)
+{
+    appendLE(head, size);
+    appendLE(head, crc);
+    appendLE(head, crc32c(head.data(), head.size()));
+    return head;
+}
+
+// Header size of a frame, from its tag.
+inline size_t frame_header_size(const char* tag)
+{
+    for (const char* t : {"ZSTD", "LZ4F", "RAW0"})
+        if (std::memcmp(tag, t, 4) == 0)
+            return RECORD_HEADER_SIZE;
+    return std::memcmp(tag, "SBLK", 4) == 0 ? SOLID_HEADER_SIZE : BLOCK_HEADER_SIZE;
+}
+
+// Payload size and CRC of the frame whose header of hsize bytes is at p, and whether that header is intact.
+inline uint64_t frame_size(const char* p, size_t hsize) { return loadLE<uint64_t>(p + hsize - FRAME_TAIL_SIZE); }
+inline uint32_t frame_crc(const char* p, size_t hsize) { return loadLE<uint32_t>(p + hsize - 8); }
+inline bool frame_head_intact(const char* p, size_t hsize) { return loadLE<uint32_t>(p + hsize - 4) == crc32c(p, hsize - 4); }
+
+[[noreturn]] inline void damaged_frame(uint64_t offset)
+{
+    throw std::runtime_error("checksum mismatch at archive offset " + std::to_string(offset) +
+                             ": the archive is damaged (salvage restores what is intact)");
+}
+
+// Blobs above this size are never held in memory whole: pack streams them into the record, unpack streams them out.
+inline constexpr uint64_t STREAM_THRESHOLD = 64ull << 20;
+
+inline constexpr uint64_t PREFETCH_MIN = 256ull << 10; // records at least this large are read ahead as a whole
+inline constexpr uint64_t MAP_WINDOW   = 8ull << 20;   // mapped bytes a streamed extraction holds at a time
+
+// --- archive output ---
+// Appends to a file descriptor through a buffer, counting the position itself rather than asking the descriptor, so
+// the archive can go to a pipe. seek() (to patch a header, or roll back) and truncate() need a file.
+class ArchiveOutput
 {
-    ZstdCtx zctx{ZstdCtx::Mode::Compress};
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    int fd        = -1;
+    bool owned    = false; // closed by close(); stdout is only flushed
+    bool seekable = false;
+    fs::path name;         // for error messages
+    std::string buf;
+    uint64_t at = 0; // file offset of buf[0]
+
+    void put(const char* p, size_t n)
+    {
+        for (size_t k = 0; k < n;)
+        {
+            ssize_t r = seekable ? ::pwrite(fd, p + k, n - k, static_cast<off_t>(at + k)) : ::write(fd, p + k, n - k);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                throw file_error("Failed to write archive: ", name, r < 0 ? errno : EIO);
+            k += r;
+        }
+        at += n;
+    }
 
-    std::ofstream ofs;
-    std::unordered_map<uint64_t, uint64_t> written; // hash -> position
 public:
-    ArchiveWriter(const fs::path& out) : ofs(out, std::ios::binary) {}
+    ArchiveOutput() = default;
+
+    ArchiveOutput(const ArchiveOutput&)            = delete;
+    ArchiveOutput& operator=(const ArchiveOutput&) = delete;
+
+    ~ArchiveOutput()
+    {
+        if (owned && fd >= 0)
+            ::close(fd);
+    }
+
+    void open(const fs::path& path)
+    {
+        name = path;
+        fd   = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0)
+            throw file_error("Failed to create archive: ", path, errno);
+        owned = seekable = true;
+    }
+
+    // Written front to back whatever stdout is: a file it names may have been opened for appending.
+    void open_stdout()
+    {
+        name = "stdout";
+        fd   = STDOUT_FILENO;
+    }
 
-    void add_file_if_new(const fs::path& path, uint64_t hash, const std::string& data)
+    // An unnamed file in the temporary directory, gone once closed.
+    void open_temp()
     {
-        if (written.count(hash))
+        fs::path dir = fs::temp_directory_path();
+        name         = dir / "archiveTool spool";
+        fd           = ::open(dir.c_str(), O_RDWR | O_TMPFILE | O_CLOEXEC, 0600);
+        if (fd < 0) // no O_TMPFILE on this filesystem
         {
-            std::cout << "file: " << path << " already added.\n";
-            return;
+            std::string tmp = (dir / "archiveTool-spool-XXXXXX").string();
+            fd              = ::mkstemp(tmp.data());
+            if (fd >= 0)
+                ::unlink(tmp.c_str());
         }
+        if (fd < 0)
+            throw file_error("Failed to create a temporary file in ", dir, errno);
+        owned = seekable = true;
+    }
+
+    bool is_open() const { return fd >= 0; }
+    uint64_t position() const { return at + buf.size(); }
 
-        size_t bound = ZSTD_compressBound(data.size());
-        std::string compressed(bound, '\0');
+    void write(const char* p, size_t n)
+    {
+        if (buf.size() + n > BUFFER_SIZE)
+            flush();
+        if (n >= BUFFER_SIZE)
+            return put(p, n);
+        if (buf.capacity() < BUFFER_SIZE)
+            buf.reserve(BUFFER_SIZE);
+        buf.append(p, n);
+    }
 
-        size_t csize = ZSTD_compress2(zctx.compressor(), compressed.data(), bound, // destination buffer + size
-                                      data.data(), data.size()                     // source buffer + size
-        );
+    void flush()
+    {
+        put(buf.data(), buf.size());
+        buf.clear();
+    }
 
-        if (ZSTD_isError(csize))
+    // Further writes go to off.
+    void seek(uint64_t off)
+    {
+        if (!seekable)
+            throw std::logic_error("seek on a pipe");
+        flush();
+        at = off;
+    }
+
+    void truncate(uint64_t size)
+    {
+        flush();
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+            throw file_error("Failed to write archive: ", name, errno);
+    }
+
+    // Appends the first n bytes written here to out.
+    void copy_to(ArchiveOutput& out, uint64_t n)
+    {
+        flush();
+        std::string piece;
+        for (uint64_t pos = 0; pos < n;)
         {
-            std::cerr << "ZSTD compression error: " << ZSTD_getErrorName(csize) << '\n';
-            return;
+            resize_for_overwrite(piece, std::min<uint64_t>(n - pos, BUFFER_SIZE));
+            ssize_t r = ::pread(fd, piece.data(), piece.size(), static_cast<off_t>(pos));
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                throw file_error("Failed to read ", name, r < 0 ? errno : EIO);
+            out.write(piece.data(), r);
+            pos += r;
+        }
+    }
+
+    void close()
+    {
+        flush();
+        if (owned && ::close(std::exchange(fd, -1)) != 0)
+            throw file_error("Failed to write archive: ", name, errno);
+    }
+};
+
+// --- archive writer ---
+// Appends records in the order they are handed in. Compression happens elsewhere (see packPipeline.hpp),
+// so the writer itself is only ever touched by a single thread.
+class ArchiveWriter
+{
+    fs::path path; // "-" for stdout
+    ArchiveOutput file;
+    ArchiveOutput spool;        // stream layout: frames held back, see hold()
+    ArchiveOutput* out = &file; // where frames go: the archive, or the spool while holding
+    uint64_t out_base  = 0;     // archive offset of out's first byte
+    HashAlgo algo;
+    bool stream = false; // the stream layout
+    std::unordered_map<Digest, IndexEntry> written; // digest -> record location
+    std::vector<std::pair<std::string, IndexEntry>> sections; // tag -> payload location (usize = csize = size)
+    std::vector<IndexEntry> blocks;                           // solid block id -> payload location
+    std::vector<std::pair<Digest, Digest>> references;        // record digest -> digest of its prefix blob
+    uint64_t header_offset = 0;
+    uint64_t header_size   = 0;
+    uint64_t high_water    = 0; // furthest byte ever written, past the end after a rollback
+    bool spooling          = false; // stream layout: frames go to the spool until release()
+    std::vector<Digest> held_records; // records in the spool
+    size_t held_blocks     = 0;     // blocks and sections from these on are in the spool
+    size_t held_sections   = 0;
+    Codec stream_codec     = Codec::Zstd; // streamed record in progress: its codec and payload CRC so far
+    uint32_t stream_crc    = 0;
+    PipelineStats* counters = nullptr; // archive writes are timed as Stage::Write
+
+    // A record's frame header (the layout frame_head() gives), built in place: there is one per stored file or chunk.
+    static std::array<char, RECORD_HEADER_SIZE> record_head(Codec codec, const Digest& hash, uint64_t usize, uint64_t csize, uint32_t crc)
+    {
+        static_assert(RECORD_HEADER_SIZE == 44);
+        std::array<char, RECORD_HEADER_SIZE> head;
+        char* p = head.data();
+        std::memcpy(p, record_tag(codec), 4);
+        storeLE(p + 4, hash.hi);
+        storeLE(p + 12, hash.lo);
+        storeLE(p + 20, usize);
+        storeLE(p + 28, csize);
+        storeLE(p + 36, crc);
+        storeLE(p + 40, crc32c(p, 40));
+        return head;
+    }
+
+    void write_frame(const std::string& tag, const std::string& payload)
+    {
+        StageTimer timer(counters, Stage::Write, payload.size());
+        std::string head = frame_head(tag, payload.size(), crc32c(payload.data(), payload.size()));
+        out->write(head.data(), head.size());
+        out->write(payload.data(), payload.size());
+    }
+
+    uint64_t tell() const { return out_base + out->position(); }
+
+public:
+    /**
+     * Creates the archive at dest, or writes it to stdout when dest is "-". An archive on stdout always has the stream
+     * layout; stream_layout asks for it in a file too.
+     */
+    ArchiveWriter(const fs::path& dest, HashAlgo hash_algo = HashAlgo::Xxh3, bool stream_layout = false)
+        : path(dest), algo(hash_algo), stream(stream_layout || dest == "-")
+    {
+        if (dest == "-")
+            file.open_stdout();
+        else
+            file.open(dest);
+        if (stream)
+            write_frame("STRM", std::string(1, static_cast<char>(algo)));
+    }
+
+    HashAlgo hash_algo() const { return algo; }
+    bool stream_layout() const { return stream; }
+
+    // Statistics the pipeline packing into this archive reports to (none when null).
+    void set_stats(PipelineStats* stats) { counters = stats; }
+    PipelineStats* stats() const { return counters; }
+
+    bool contains(const Digest& hash) const { return written.count(hash) != 0; }
+
+    const IndexEntry* find(const Digest& hash) const
+    {
+        auto it = written.find(hash);
+        return it == written.end() ? nullptr : &it->second;
+    }
+
+    void write_record(const Digest& hash, uint64_t usize, const std::string& compressed, Codec codec = Codec::Zstd)
+    {
+        StageTimer timer(counters, Stage::Write, compressed.size());
+        uint64_t offset = tell();
+        uint64_t csize  = compressed.size();
+        auto head       = record_head(codec, hash, usize, csize, crc32c(compressed.data(), csize));
+        out->write(head.data(), head.size());
+        out->write(compressed.data(), csize);
+        written[hash] = {offset, usize, csize};
+        if (spooling)
+            held_records.push_back(hash);
+    }
+
+    // --- streamed records: begin_record(), append_payload()*, then end_record() or rollback() ---
+    // The header is written as a placeholder and patched once hash, sizes and CRC are known.
+    uint64_t begin_record(Codec codec = Codec::Zstd)
+    {
+        uint64_t offset = tell();
+        char placeholder[RECORD_HEADER_SIZE] = {};
+        out->write(placeholder, sizeof(placeholder));
+        stream_codec = codec;
+        stream_crc   = 0;
+        return offset;
+    }
+
+    void append_payload(const char* data, size_t size)
+    {
+        StageTimer timer(counters, Stage::Write, size);
+        stream_crc = crc32c(data, size, stream_crc);
+        out->write(data, size);
+    }
+
+    void end_record(uint64_t offset, const Digest& hash, uint64_t usize)
+    {
+        uint64_t end   = tell();
+        uint64_t csize = end - offset - RECORD_HEADER_SIZE;
+        auto head      = record_head(stream_codec, hash, usize, csize, stream_crc);
+        out->seek(offset - out_base);
+        out->write(head.data(), head.size());
+        out->seek(end - out_base);
+        written[hash] = {offset, usize, csize};
+        if (spooling)
+            held_records.push_back(hash);
+    }
+
+    // Discard a streamed record, e.g. when its content turned out to be a duplicate.
+    void rollback(uint64_t offset)
+    {
+        if (!spooling) // the spool's stale bytes are never copied
+            high_water = std::max(high_water, tell());
+        out->seek(offset - out_base);
+    }
+
+    // --- stream layout: hold(), records, then release() ---
+    // A large file is written before its manifest entry is known (that needs its digest), so its frames are held back
+    // in a temporary file and go to the archive after the entry. The seek streamed records need happens there too.
+    void hold()
+    {
+        if (!spool.is_open())
+            spool.open_temp();
+        out_base      = tell();
+        out           = &spool;
+        spooling      = true;
+        held_sections = sections.size();
+        held_blocks   = blocks.size();
+        held_records.clear();
+    }
+
+    bool holding() const { return spooling; }
+
+    // Writes entries (the manifest entries the held frames need, if any), then the held frames.
+    void release(const std::string& entries)
+    {
+        uint64_t held = spool.position();
+        out           = &file;
+        out_base      = 0;
+        spooling      = false;
+        uint64_t from = tell();
+        if (!entries.empty())
+            write_entries(entries);
+        uint64_t shift = tell() - from;
+        for (auto& hash : held_records)
+            written[hash].offset += shift;
+        for (size_t i = held_blocks; i < blocks.size(); ++i)
+            blocks[i].offset += shift;
+        for (size_t i = held_sections; i < sections.size(); ++i)
+            sections[i].second.offset += shift;
+        {
+            StageTimer timer(counters, Stage::Write, held);
+            spool.copy_to(file, held);
         }
+        spool.seek(0);
+    }
+
+    // Manifest entries, see Manifest::entries(). Not a section: only a reader going front to back needs them.
+    void write_entries(const std::string& entries) { write_frame("ENTS", entries); }
 
-        ofs.write("ZSTD", 4);
+    // One zstd or LZ4 frame holding the concatenated members.
+    void write_solid_block(uint64_t usize, const std::string& compressed, const std::vector<SolidMember>& members)
+    {
+        StageTimer timer(counters, Stage::Write, compressed.size());
+        auto id          = static_cast<uint32_t>(blocks.size());
+        std::string head = "SBLK";
+        appendLE(head, usize);
+        head = frame_head(std::move(head), compressed.size(), crc32c(compressed.data(), compressed.size()));
+        if (stream)
+        {
+            std::string list;
+            list.reserve(members.size() * 4 * sizeof(uint64_t));
+            for (auto& m : members)
+                for (uint64_t v : {m.hash.hi, m.hash.lo, m.offset, m.size})
+                    appendLE(list, v);
+            write_frame("SMEM", list);
+        }
+        out->write(head.data(), head.size());
+        blocks.push_back({tell(), usize, compressed.size()});
+        out->write(compressed.data(), compressed.size());
+        for (auto& m : members)
+            written[m.hash] = {m.offset, m.size, 0, id};
+    }
 
-        //for hashes, endianness doesn't matter
-        ofs.write(reinterpret_cast<char*>(&hash), sizeof(hash));
-        uint64_t usize = data.size();
+    // Marks the record of hash as compressed against the content of blob ref (which must end up in the archive or its base).
+    void add_reference(const Digest& hash, const Digest& ref) { references.emplace_back(hash, ref); }
 
-        writeLE(ofs, usize);
-        writeLE(ofs, csize);
+    // Chain this archive to base: the reader resolves blobs this archive doesn't store there.
+    void write_base_link(const fs::path& base)
+    {
+        std::string link;
+        appendLE<uint64_t>(link, fs::file_size(base));
+        link += fs::proximate(fs::absolute(base), fs::absolute(path).parent_path()).string();
+        write_block("BASE", link);
+    }
 
-        ofs.write(compressed.data(), csize);
-        written[hash] = ofs.tellp();
+    // A tagged block the reader finds through the section table, e.g. the compression dictionary.
+    void write_block(const std::string& tag, const std::string& payload)
+    {
+        uint64_t offset = tell() + BLOCK_HEADER_SIZE;
+        write_frame(tag, payload);
+        sections.push_back({tag, {offset, payload.size(), payload.size()}});
     }
 
     void write_header(const std::string& header)
     {
-        uint64_t hlen = header.size();
-        ofs.write("HDR0", 4);
-        writeLE(ofs, hlen);
-        ofs.write(header.data(), hlen);
+        header_offset = tell();
+        header_size   = header.size();
+        write_frame("HDR0", header);
+    }
+
+    // Must follow write_header(): the trailer points at both frames. Closes the archive.
+    void write_index()
+    {
+        // sorted by offset so the index bytes don't depend on hash-map iteration order
+        std::vector<std::pair<Digest, IndexEntry>> entries, members;
+        for (auto& kv : written)
+            (kv.second.block == NO_BLOCK ? entries : members).push_back(kv);
+        auto by_location = [](auto& a, auto& b) { return std::tie(a.second.block, a.second.offset) < std::tie(b.second.block, b.second.offset); };
+        std::sort(entries.begin(), entries.end(), by_location);
+        std::sort(members.begin(), members.end(), by_location);
+
+        if (!blocks.empty())
+        {
+            std::string table, sidx;
+            for (auto& b : blocks)
+            {
+                appendLE(table, b.offset);
+                appendLE(table, b.usize);
+                appendLE(table, b.csize);
+            }
+            for (auto& [hash, e] : members)
+            {
+                appendLE(sidx, hash.hi);
+                appendLE(sidx, hash.lo);
+                appendLE(sidx, e.block);
+                appendLE(sidx, e.offset);
+                appendLE(sidx, e.usize);
+            }
+            write_block("BLKS", table);
+            write_block("SIDX", sidx);
+        }
+        if (!references.empty())
+        {
+            std::string refs;
+            for (auto& [hash, ref] : references)
+                for (uint64_t v : {hash.hi, hash.lo, ref.hi, ref.lo})
+                    appendLE(refs, v);
+            write_block("REFS", refs);
+        }
+
+        std::string index;
+        index.reserve(9 + entries.size() * 5 * sizeof(uint64_t));
+        appendLE<uint64_t>(index, entries.size());
+        appendLE(index, static_cast<uint8_t>(algo));
+        for (auto& [hash, e] : entries)
+        {
+            appendLE(index, hash.hi);
+            appendLE(index, hash.lo);
+            appendLE(index, e.offset);
+            appendLE(index, e.usize);
+            appendLE(index, e.csize);
+        }
+        if (!sections.empty())
+        {
+            appendLE<uint32_t>(index, sections.size());
+            for (auto& [tag, s] : sections)
+            {
+                index += tag;
+                appendLE(index, s.offset);
+                appendLE(index, s.usize);
+            }
+        }
+        uint64_t index_offset = tell();
+        write_frame("IDX2", index);
+
+        std::string trailer;
+        appendLE(trailer, FORMAT_VERSION);
+        appendLE(trailer, header_offset);
+        appendLE(trailer, header_size);
+        appendLE(trailer, index_offset);
+        appendLE<uint64_t>(trailer, index.size());
+        appendLE(trailer, crc32c(trailer.data(), trailer.size()));
+        trailer.append(TRAILER_MAGIC, 4);
+        out->write(trailer.data(), trailer.size());
+
+        if (tell() < high_water)
+            file.truncate(tell()); // drop rolled-back bytes past the trailer
+        file.close();
     }
 };
 
+// What a salvage scan found, see ArchiveReader.
+struct SalvageReport
+{
+    uint64_t frames     = 0; // intact frames
+    uint64_t damaged    = 0; // frames with an intact header but a damaged payload
+    uint64_t lost_bytes = 0; // bytes in damaged frames or between frames
+};
+
 // --- archive reader ---
+// The archive is mapped read-only and records are decompressed straight out of the mapping; where mmap is
+// unavailable (or disabled) every access is a positioned read (pread) into a caller-owned buffer instead.
+// Either way one reader can be shared by any number of extracting threads as long as each brings its own
+// decompression context.
+// Opened for salvage, the reader ignores the trailer and index and finds the intact frames with one sequential pass
+// instead; it then holds whatever records, solid blocks, sections and manifest survived.
 class ArchiveReader
 {
-    ZstdCtx zctx{ZstdCtx::Mode::Decompress};
+public:
+    // Access pattern hint for the kernel's read-ahead.
+    enum class Access
+    {
+        Sequential, // full restore, records visited front to back
+        Random,     // a few records extracted on demand
+    };
 
-    std::ifstream ifs;
+private:
+    int fd = -1;
+    uint64_t file_size = 0;
+    const char* map    = nullptr; // whole file, or null in pread mode
+    std::unordered_map<Digest, IndexEntry> index; // digest -> record location
+    int64_t header_offset       = -1;
+    uint64_t header_size        = 0; // framed archives only
+    HashAlgo algo               = HashAlgo::Fnv1a64;
+    uint64_t record_header_size = RECORD_HEADER_SIZE_V0;
+    bool framed                 = false; // version 2: frames with checksums
+    std::unordered_map<std::string, IndexEntry> sections; // tag -> block payload (usize = csize = size)
+    ZSTD_DDict* ddict = nullptr; // shared by all threads, read-only once loaded
+    unsigned ddict_id = 0;
+    std::vector<IndexEntry> blocks; // solid block id -> payload location
+    std::vector<Digest> references; // IndexEntry::ref -> digest of the prefix blob
+    std::unique_ptr<ArchiveReader> base; // delta archives: the archive they were packed against
+    bool salvaged = false;
+    SalvageReport report;
+    PipelineStats* counters = nullptr; // decoding is timed as Stage::Decompress, restored file writes as Stage::Write
+    std::unordered_set<uint64_t> intact_blocks; // salvage: payload offsets of the solid blocks found intact
 
-public:
-    ArchiveReader(const fs::path& in) : ifs(in, std::ios::binary) {}
+    void read_exact(void* buf, size_t n, uint64_t off) const
+    {
+        if (off > file_size || n > file_size - off)
+            throw std::runtime_error("truncated archive");
+        if (map)
+        {
+            std::memcpy(buf, map + off, n);
+            return;
+        }
+        char* p = static_cast<char*>(buf);
+        while (n > 0)
+        {
+            ssize_t r = ::pread(fd, p, n, static_cast<off_t>(off));
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                throw std::runtime_error("truncated archive");
+            p += r;
+            off += r;
+            n -= r;
+        }
+    }
 
-    std::string read_header()
+    // n bytes at off: a pointer into the mapping, or read into scratch in pread mode.
+    const char* bytes_at(uint64_t off, size_t n, std::string& scratch) const
     {
-        // Read from end
-        ifs.seekg(0, std::ios::end);
-        std::streampos end       = ifs.tellg();
-        std::streamoff pos       = end;
-        const std::string marker = "HDR0";
+        if (map)
+        {
+            if (off > file_size || n > file_size - off)
+                throw std::runtime_error("truncated archive");
+            return map + off;
+        }
+        resize_for_overwrite(scratch, n);
+        read_exact(scratch.data(), n, off);
+        return scratch.data();
+    }
 
-        // scan backwards up to some limit
-        const size_t scan_window = 4096;
-        while (pos > 0)
+    // Hint that [off, off + n) is about to be read; with Access::Random the kernel would otherwise fault it in page by page.
+    void prefetch(uint64_t off, uint64_t n) const
+    {
+        if (map)
+            page_advise(off, n, MADV_WILLNEED, false);
+    }
+
+    // Drop already-consumed pages of a large record from the mapping so a full restore doesn't grow the resident set.
+    void release(uint64_t off, uint64_t n) const
+    {
+        if (map)
+            page_advise(off, n, MADV_DONTNEED, true);
+    }
+
+    void page_advise(uint64_t off, uint64_t n, int advice, bool inner) const
+    {
+        static const uint64_t page = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+        uint64_t begin = inner ? (off + page - 1) / page * page : off / page * page;
+        uint64_t end   = inner ? (off + n) / page * page : off + n;
+        if (begin < end)
+            ::madvise(const_cast<char*>(map) + begin, end - begin, advice);
+    }
+
+    // The payload of the frame at off, after checking its tag (unless null), size and both CRCs.
+    const char* frame_payload(uint64_t off, const char* tag, uint64_t size, std::string& scratch) const
+    {
+        if (size > file_size)
+            damaged_frame(off);
+        const char* f = bytes_at(off, BLOCK_HEADER_SIZE + size, scratch);
+        if ((tag && std::memcmp(f, tag, 4) != 0) || frame_size(f, BLOCK_HEADER_SIZE) != size || !frame_head_intact(f, BLOCK_HEADER_SIZE) ||
+            crc32c(f + BLOCK_HEADER_SIZE, size) != frame_crc(f, BLOCK_HEADER_SIZE))
+            damaged_frame(off);
+        return f + BLOCK_HEADER_SIZE;
+    }
+
+    // Payload of a block listed in the section table; its CRCs are checked in framed archives.
+    const char* section_payload(const std::string& tag, const IndexEntry& s, std::string& scratch) const
+    {
+        if (!framed)
+            return bytes_at(s.offset, s.usize, scratch);
+        return frame_payload(s.offset - BLOCK_HEADER_SIZE, tag.c_str(), s.usize, scratch);
+    }
+
+    // Payload of a solid block; only the frame header is checked here, the zstd or LZ4 frame carries its own checksum.
+    const char* solid_payload(const IndexEntry& b, std::string& scratch) const
+    {
+        if (!framed)
+            return bytes_at(b.offset, b.csize, scratch);
+        const char* f = bytes_at(b.offset - SOLID_HEADER_SIZE, SOLID_HEADER_SIZE + b.csize, scratch);
+        if (!frame_head_intact(f, SOLID_HEADER_SIZE))
+            damaged_frame(b.offset - SOLID_HEADER_SIZE);
+        return f + SOLID_HEADER_SIZE;
+    }
+
+    bool load_index()
+    {
+        char magic[4];
+        if (file_size < sizeof(magic))
+            return false;
+        read_exact(magic, sizeof(magic), file_size - sizeof(magic));
+        if (std::memcmp(magic, TRAILER_MAGIC, 4) == 0)
         {
-            std::streamoff chunk_size = std::min<std::streamoff>(scan_window, pos);
-            pos -= chunk_size;
-            ifs.seekg(pos);
-            std::string buf(chunk_size, '\0');
-            ifs.read(buf.data(), chunk_size);
-            size_t found = buf.rfind(marker);
-            if (found != std::string::npos)
-            {
-                // found header tag
-                ifs.seekg(pos + found + 4);
-                uint64_t len = readLE<uint64_t>(ifs);
+            load_trailer();
+            return true;
+        }
 
-                std::string h(len, '\0');
-                ifs.read(h.data(), len);
-                return h;
-            }
+        bool v0 = std::memcmp(magic, INDEX_TRAILER_MAGIC_V0, 4) == 0;
+        if ((!v0 && std::memcmp(magic, INDEX_TRAILER_MAGIC, 4) != 0) || file_size < static_cast<uint64_t>(INDEX_TRAILER_SIZE))
+            return false;
+        char trailer[INDEX_TRAILER_SIZE];
+        read_exact(trailer, sizeof(trailer), file_size - INDEX_TRAILER_SIZE);
+        uint64_t hdr_off = loadLE<uint64_t>(trailer);
+        uint64_t idx_off = loadLE<uint64_t>(trailer + 8);
+        if (hdr_off >= idx_off || idx_off > file_size - INDEX_TRAILER_SIZE || file_size - INDEX_TRAILER_SIZE - idx_off < 4)
+            throw std::runtime_error("corrupt index trailer");
+
+        std::string scratch;
+        uint64_t size = file_size - INDEX_TRAILER_SIZE - idx_off;
+        const char* p = bytes_at(idx_off, size, scratch);
+        if (std::string(p, 4) != (v0 ? "IDX0" : "IDX1"))
+            throw std::runtime_error("corrupt index");
+        if (!v0)
+            record_header_size = RECORD_HEADER_SIZE_V1;
+        parse_index(p + 4, p + size, v0);
+        header_offset = hdr_off;
+        return true;
+    }
+
+    // Version 2: the fixed-size trailer gives the manifest's and the index's frames.
+    void load_trailer()
+    {
+        if (file_size < static_cast<uint64_t>(TRAILER_SIZE))
+            throw std::runtime_error("corrupt archive trailer");
+        char t[TRAILER_SIZE];
+        read_exact(t, sizeof(t), file_size - TRAILER_SIZE);
+        if (loadLE<uint32_t>(t + TRAILER_SIZE - 8) != crc32c(t, TRAILER_SIZE - 8))
+            throw std::runtime_error("corrupt archive trailer");
+        if (uint32_t version = loadLE<uint32_t>(t); version != FORMAT_VERSION)
+            throw std::runtime_error("unsupported archive version " + std::to_string(version));
+        uint64_t hdr_off  = loadLE<uint64_t>(t + 4);
+        uint64_t hdr_size = loadLE<uint64_t>(t + 12);
+        uint64_t idx_off  = loadLE<uint64_t>(t + 20);
+        uint64_t idx_size = loadLE<uint64_t>(t + 28);
+        if (hdr_off > file_size || idx_off > file_size || idx_size > file_size - idx_off)
+            throw std::runtime_error("corrupt archive trailer");
+
+        framed             = true;
+        record_header_size = RECORD_HEADER_SIZE;
+        std::string scratch;
+        const char* p = frame_payload(idx_off, "IDX2", idx_size, scratch);
+        parse_index(p, p + idx_size, false);
+        header_offset = hdr_off;
+        header_size   = hdr_size;
+    }
+
+    // Index payload past the tag: count [algo] entries [sections].
+    void parse_index(const char* p, const char* end, bool v0)
+    {
+        const size_t head_size = v0 ? 8 : 9;
+        if (static_cast<size_t>(end - p) < head_size)
+            throw std::runtime_error("corrupt index");
+        uint64_t count = loadLE<uint64_t>(p);
+        if (!v0)
+        {
+            algo = static_cast<HashAlgo>(p[8]);
+            if (algo != HashAlgo::Xxh3 && algo != HashAlgo::Blake3)
+                throw std::runtime_error("unknown hash algorithm in index");
         }
-        throw std::runtime_error("no header");
+        p += head_size;
+
+        const size_t entry_size = (v0 ? 4 : 5) * sizeof(uint64_t);
+        if (count > static_cast<size_t>(end - p) / entry_size)
+            throw std::runtime_error("corrupt index");
+        index.reserve(count);
+        for (const char* last = p + count * entry_size; p < last; p += entry_size)
+        {
+            Digest d      = v0 ? Digest::from_u64(loadLE<uint64_t>(p)) : Digest{loadLE<uint64_t>(p), loadLE<uint64_t>(p + 8)};
+            const char* e = p + entry_size - 3 * sizeof(uint64_t); // offset, usize, csize
+            index.emplace(d, IndexEntry{loadLE<uint64_t>(e), loadLE<uint64_t>(e + 8), loadLE<uint64_t>(e + 16)});
+        }
+
+        if (v0 || end - p < 4)
+            return;
+        const size_t section_size = 4 + 2 * sizeof(uint64_t);
+        uint64_t nsections        = loadLE<uint32_t>(p);
+        p += 4;
+        if (nsections > static_cast<size_t>(end - p) / section_size)
+            throw std::runtime_error("corrupt index");
+        for (uint64_t i = 0; i < nsections; ++i, p += section_size)
+        {
+            uint64_t off = loadLE<uint64_t>(p + 4), size = loadLE<uint64_t>(p + 12);
+            if (off > file_size || size > file_size - off)
+                throw std::runtime_error("corrupt index");
+            sections[std::string(p, 4)] = {off, size, size};
+        }
+    }
+
+    void load_solid_blocks()
+    {
+        auto table = sections.find("BLKS");
+        auto sidx  = sections.find("SIDX");
+        if (table == sections.end() || sidx == sections.end())
+            return;
+
+        std::string scratch;
+        const char* p = section_payload("BLKS", table->second, scratch);
+        for (const char* end = p + table->second.usize / 24 * 24; p < end; p += 24)
+        {
+            IndexEntry b{loadLE<uint64_t>(p), loadLE<uint64_t>(p + 8), loadLE<uint64_t>(p + 16)};
+            if (b.offset > file_size || b.csize > file_size - b.offset)
+                throw std::runtime_error("corrupt block table");
+            blocks.push_back(b);
+        }
+
+        const size_t member_size = 2 * sizeof(uint64_t) + sizeof(uint32_t) + 2 * sizeof(uint64_t);
+        p                        = section_payload("SIDX", sidx->second, scratch);
+        index.reserve(index.size() + sidx->second.usize / member_size);
+        for (const char* end = p + sidx->second.usize / member_size * member_size; p < end; p += member_size)
+        {
+            IndexEntry e{loadLE<uint64_t>(p + 20), loadLE<uint64_t>(p + 28), 0, loadLE<uint32_t>(p + 16)};
+            if (e.block >= blocks.size() || e.offset > blocks[e.block].usize || e.usize > blocks[e.block].usize - e.offset)
+                throw std::runtime_error("corrupt solid index");
+            if (salvaged && !intact_blocks.count(blocks[e.block].offset))
+                continue;
+            index.emplace(Digest{loadLE<uint64_t>(p), loadLE<uint64_t>(p + 8)}, e);
+        }
+    }
+
+    void load_references()
+    {
+        auto it = sections.find("REFS");
+        if (it == sections.end())
+            return;
+        std::string scratch;
+        const char* p = section_payload("REFS", it->second, scratch);
+        for (const char* end = p + it->second.usize / 32 * 32; p < end; p += 32)
+        {
+            auto e = index.find(Digest{loadLE<uint64_t>(p), loadLE<uint64_t>(p + 8)});
+            if (salvaged && e == index.end())
+                continue;
+            if (e == index.end() || e->second.block != NO_BLOCK)
+                throw std::runtime_error("corrupt reference table");
+            e->second.ref = static_cast<uint32_t>(references.size());
+            references.push_back({loadLE<uint64_t>(p + 16), loadLE<uint64_t>(p + 24)});
+        }
+    }
+
+    void load_dictionary()
+    {
+        auto it = sections.find("DICT");
+        if (it == sections.end())
+            return;
+        std::string scratch;
+        const char* dict = section_payload("DICT", it->second, scratch);
+        ddict            = ZSTD_createDDict(dict, it->second.usize);
+        if (!ddict)
+            throw std::runtime_error("corrupt dictionary");
+        ddict_id = ZSTD_getDictID_fromDDict(ddict);
+    }
+
+    // Opens the base archive of a delta and merges its index (entries tagged with their archive) below this one's.
+    void load_base(const fs::path& in, bool use_mmap)
+    {
+        auto it = sections.find("BASE");
+        if (it == sections.end())
+            return;
+        std::string scratch;
+        const char* link = section_payload("BASE", it->second, scratch);
+        if (it->second.usize < 8)
+            throw std::runtime_error("corrupt base link");
+        fs::path path = std::string(link + 8, it->second.usize - 8);
+        if (path.is_relative())
+            path = in.parent_path() / path;
+        if (!fs::exists(path))
+            throw std::runtime_error("base archive not found: " + path.string());
+
+        base = std::make_unique<ArchiveReader>(path, use_mmap);
+        if (base->file_size != loadLE<uint64_t>(link))
+            throw std::runtime_error("base archive has changed since the delta was packed: " + path.string());
+        index.reserve(index.size() + base->index.size());
+        for (auto& [hash, e] : base->index)
+        {
+            IndexEntry chained = e;
+            ++chained.archive;
+            index.try_emplace(hash, chained);
+        }
+    }
+
+    // The base reader that holds a chained entry, and the entry as that reader sees it.
+    std::pair<const ArchiveReader*, IndexEntry> owner(IndexEntry e) const
+    {
+        const ArchiveReader* r = this;
+        for (; e.archive > 0; --e.archive)
+            r = r->base.get();
+        return {r, e};
+    }
+
+    // Frames compressed against the archive dictionary carry its id in the frame header.
+    const ZSTD_DDict* dictionary_for(const char* frame, size_t size) const
+    {
+        return ddict && ZSTD_getDictID_fromFrame(frame, size) == ddict_id ? ddict : nullptr;
     }
 
-    void extract_file(const uint64_t hash, const fs::path& outdir)
+    // Archives without a footer index (all version 0): one pass over the record headers, skipping the payloads.
+    void build_index()
     {
-        ifs.clear();
-        ifs.seekg(0);
-        while (true)
+        uint64_t pos = 0;
+        char rec[RECORD_HEADER_SIZE_V0];
+        while (pos + 4 <= file_size)
         {
-            char tag[4];
-            if (!ifs.read(tag, 4))
+            size_t n = std::min<uint64_t>(sizeof(rec), file_size - pos);
+            read_exact(rec, n, pos);
+            std::string t(rec, 4);
+            if (t == "HDR0")
+            {
+                header_offset = pos;
                 break;
-            if (std::string(tag, 4) != "ZSTD")
+            }
+            if (t != "ZSTD" || n < sizeof(rec))
             {
-                ifs.seekg(-3, std::ios::cur);
+                ++pos; // resync
                 continue;
             }
-            uint64_t h     = readLE<uint64_t>(ifs);
-            uint64_t usize = readLE<uint64_t>(ifs);
-            uint64_t csize = readLE<uint64_t>(ifs);
+            uint64_t h;
+            std::memcpy(&h, rec + 4, sizeof(h)); // version 0 record hashes are stored in native order
+            IndexEntry e{pos, loadLE<uint64_t>(rec + 12), loadLE<uint64_t>(rec + 20)};
+            index.emplace(Digest::from_u64(h), e);
+            pos += RECORD_HEADER_SIZE_V0 + e.csize;
+        }
+    }
+
+    // --- salvage ---
+    // The frames are visited front to back. One whose header CRC holds is taken at its word and skipped whole, its
+    // payload kept only if that CRC holds too; anywhere else the scan moves on to the next offset where an intact
+    // frame header starts.
 
-            std::string comp(csize, '\0');
-            ifs.read(comp.data(), csize);
-            if (h == hash)
+    static constexpr uint64_t SCAN_WINDOW = 1 << 20;
+
+    // Whether an intact frame header starts at p (avail bytes readable), its payload ending within room bytes.
+    static bool frame_starts(const char* p, uint64_t avail, uint64_t room)
+    {
+        if (avail < static_cast<uint64_t>(BLOCK_HEADER_SIZE))
+            return false;
+        for (int k = 0; k < 4; ++k) // tags are upper-case letters and digits
+            if (!((p[k] >= 'A' && p[k] <= 'Z') || (p[k] >= '0' && p[k] <= '9')))
+                return false;
+        size_t hsize = frame_header_size(p);
+        return avail >= hsize && frame_head_intact(p, hsize) && frame_size(p, hsize) <= room - hsize;
+    }
+
+    // The first offset from pos on where a frame starts, or end.
+    uint64_t next_frame(uint64_t pos, uint64_t end) const
+    {
+        std::string scratch;
+        uint64_t n = std::min<uint64_t>(RECORD_HEADER_SIZE, end - pos);
+        if (frame_starts(bytes_at(pos, n, scratch), n, end - pos))
+            return pos;
+        for (++pos; pos < end; pos += SCAN_WINDOW)
+        {
+            n             = std::min<uint64_t>(SCAN_WINDOW + RECORD_HEADER_SIZE, end - pos);
+            const char* w = bytes_at(pos, n, scratch);
+            for (uint64_t k = 0, last = std::min(SCAN_WINDOW, n); k < last; ++k)
+                if (w[k] >= 'A' && w[k] <= 'Z' && frame_starts(w + k, n - k, end - pos - k)) // every tag starts with a letter
+                    return pos + k;
+        }
+        return end;
+    }
+
+    bool payload_intact(uint64_t off, uint64_t size, uint32_t crc) const
+    {
+        std::string scratch;
+        uint32_t c = 0;
+        for (uint64_t done = 0, n; done < size; done += n)
+        {
+            n = std::min(size - done, MAP_WINDOW);
+            c = crc32c(bytes_at(off + done, n, scratch), n, c);
+            release(off + done, n);
+        }
+        return c == crc;
+    }
+
+    void scan_frames()
+    {
+        salvaged           = true;
+        framed             = true;
+        record_header_size = RECORD_HEADER_SIZE;
+        algo               = HashAlgo::Xxh3;
+        uint64_t end       = file_size;
+        if (file_size >= static_cast<uint64_t>(TRAILER_SIZE))
+        {
+            char t[TRAILER_SIZE];
+            read_exact(t, sizeof(t), file_size - TRAILER_SIZE);
+            if (std::memcmp(t + TRAILER_SIZE - 4, TRAILER_MAGIC, 4) == 0 && loadLE<uint32_t>(t + TRAILER_SIZE - 8) == crc32c(t, TRAILER_SIZE - 8))
+                end -= TRAILER_SIZE;
+        }
+        advise(Access::Sequential);
+
+        for (uint64_t pos = 0; pos < end;)
+        {
+            uint64_t next = next_frame(pos, end);
+            report.lost_bytes += next - pos;
+            if ((pos = next) == end)
+                break;
+            char h[RECORD_HEADER_SIZE];
+            read_exact(h, std::min<uint64_t>(sizeof(h), end - pos), pos);
+            size_t hsize  = frame_header_size(h);
+            uint64_t size = frame_size(h, hsize);
+            if (payload_intact(pos + hsize, size, frame_crc(h, hsize)))
+            {
+                ++report.frames;
+                add_frame(h, hsize, pos, size);
+            }
+            else
             {
-                std::string data(usize, '\0');
-                size_t r = ZSTD_decompressDCtx(zctx.decompressor(), data.data(), usize, comp.data(), comp.size());
-                if (ZSTD_isError(r))
-                    throw std::runtime_error(ZSTD_getErrorName(r));
-
-                std::ofstream ofs(outdir, std::ios::binary);
-                ofs.write(data.data(), data.size());
-                return;
+                ++report.damaged;
+                report.lost_bytes += hsize + size;
             }
+            pos += hsize + size;
         }
     }
-};
 
-static void build_structure(const fs::path& dir, mini_json::object& node, ArchiveWriter& writer)
-{
-    for (auto& e : fs::directory_iterator(dir))
+    void add_frame(const char* h, size_t hsize, uint64_t pos, uint64_t size)
     {
-        if (e.is_directory())
+        std::string tag(h, 4);
+        uint64_t payload = pos + hsize;
+        if (hsize == RECORD_HEADER_SIZE)
+            index.insert_or_assign(Digest{loadLE<uint64_t>(h + 4), loadLE<uint64_t>(h + 12)}, IndexEntry{pos, loadLE<uint64_t>(h + 20), size});
+        else if (hsize == SOLID_HEADER_SIZE)
+            intact_blocks.insert(payload);
+        else if (tag == "HDR0")
         {
-            mini_json::object sub;
-            build_structure(e.path(), sub, writer);
-            node[e.path().filename().string()] = std::move(sub);
+            header_offset = pos;
+            header_size   = size;
         }
-        else if (e.is_regular_file())
+        else if (tag == "IDX2")
         {
-            //file size < 2GB, can safely load all to memory. Reuse the buffer (hashing+compression) for performance.
-            std::string data;
+            char a = 0;
+            if (size > 8)
+                read_exact(&a, 1, payload + 8);
+            if (static_cast<HashAlgo>(a) == HashAlgo::Blake3)
+                algo = HashAlgo::Blake3;
+        }
+        else
+            sections[tag] = {payload, size, size};
+    }
 
-            auto hash = fnv1a_hash_file(e.path(), data);
-            writer.add_file_if_new(e.path(), hash, data);
-            node[e.path().filename().string()] = hash;
+    std::string scan_header() const
+    {
+        const std::string marker = "HDR0";
+        if (map)
+        {
+            size_t found = std::string_view(map, file_size).rfind(marker);
+            if (found == std::string_view::npos)
+                throw std::runtime_error("no header");
+            return read_header_at(found);
         }
+
+        // scan backwards from the end, one window at a time (windows overlap so a split marker is still found)
+        const uint64_t scan_window = 4096;
+        uint64_t pos               = file_size;
+        std::string buf;
+        while (pos > 0)
+        {
+            uint64_t chunk_size = std::min(scan_window, pos);
+            pos -= chunk_size;
+            uint64_t len = std::min<uint64_t>(chunk_size + marker.size() - 1, file_size - pos);
+            buf.resize(len);
+            read_exact(buf.data(), len, pos);
+            size_t found = buf.rfind(marker);
+            if (found != std::string::npos)
+                return read_header_at(pos + found);
+        }
+        throw std::runtime_error("no header");
     }
-}
 
-static void restore_structure(const mini_json::object& node, const fs::path& base, ArchiveReader& reader, std::unordered_map<uint64_t, fs::path>& cache)
-{
-    for (auto& [name, val] : node)
+    std::string read_header_at(uint64_t off) const
     {
-        if (val.is_object())
+        char head[12];
+        read_exact(head, sizeof(head), off);
+        if (std::string(head, 4) != "HDR0")
+            throw std::runtime_error("no header");
+        uint64_t len = loadLE<uint64_t>(head + 4);
+        if (len > file_size - off - sizeof(head))
+            throw std::runtime_error("truncated header");
+
+        std::string h(len, '\0');
+        read_exact(h.data(), len, off + sizeof(head));
+        return h;
+    }
+
+public:
+    // With salvage the archive is opened as described above, for restoring what a damaged archive still holds.
+    explicit ArchiveReader(const fs::path& in, bool use_mmap = true, bool salvage = false)
+    {
+        fd = ::open(in.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open archive: " + in.string());
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Failed to stat archive: " + in.string());
+        }
+        file_size = static_cast<uint64_t>(st.st_size);
+        if (use_mmap && file_size > 0 && file_size <= std::numeric_limits<size_t>::max())
         {
-            fs::create_directories(base / name);
-            restore_structure(val.as_object(), base / name, reader, cache);
+            void* p = ::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED)
+                map = static_cast<const char*>(p);
         }
+        if (salvage)
+            scan_frames();
+        else if (!load_index())
+            build_index();
+        load_solid_blocks();
+        load_references();
+        load_dictionary();
+        load_base(in, use_mmap);
+    }
+
+    ArchiveReader(const ArchiveReader&)            = delete;
+    ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+    ~ArchiveReader()
+    {
+        ZSTD_freeDDict(ddict);
+        if (map)
+            ::munmap(const_cast<char*>(map), file_size);
+        ::close(fd);
+    }
+
+    bool mapped() const { return map != nullptr; }
+
+    const SalvageReport& salvage_report() const { return report; }
+
+    // Statistics the extracting threads report to (none when null); the base chain reports to the same.
+    void set_stats(PipelineStats* stats)
+    {
+        counters = stats;
+        if (base)
+            base->set_stats(stats);
+    }
+    PipelineStats* stats() const { return counters; }
+
+    // False when no manifest was found (only possible for a salvaged archive or a truncated version 0 one).
+    bool has_manifest() const { return header_offset >= 0; }
+
+    void advise(Access access) const
+    {
+        if (base)
+            base->advise(access);
+        if (map)
+            ::madvise(const_cast<char*>(map), file_size, access == Access::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
         else
+            ::posix_fadvise(fd, 0, 0, access == Access::Sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+    }
+
+    // Payload of this archive's block with the given tag (e.g. "META"); nullopt when there is none.
+    std::optional<std::string> read_section(const std::string& tag) const
+    {
+        auto it = sections.find(tag);
+        if (it == sections.end())
+            return std::nullopt;
+        std::string scratch;
+        const char* p = section_payload(tag, it->second, scratch);
+        return std::string(p, it->second.usize);
+    }
+
+    std::string read_header() const
+    {
+        if (header_offset < 0)
+            return scan_header();
+        if (!framed)
+            return read_header_at(header_offset);
+        std::string scratch;
+        const char* p = frame_payload(header_offset, "HDR0", header_size, scratch);
+        return std::string(p, header_size);
+    }
+
+    // Algorithm the archive's digests were computed with; Fnv1a64 for version 0 archives.
+    HashAlgo hash_algo() const { return algo; }
+
+    const IndexEntry* find(const Digest& hash) const
+    {
+        auto it = index.find(hash);
+        return it == index.end() ? nullptr : &it->second;
+    }
+
+    // Whether the blob and the blob it was compressed against (if any) are indexed; only salvage can lose either.
+    bool readable(const Digest& hash) const
+    {
+        const IndexEntry* e = find(hash);
+        if (!e)
+            return false;
+        auto [r, local] = owner(*e);
+        return local.ref == NO_REF || r->readable(r->references[local.ref]);
+    }
+
+    // Digests of the blobs stored in this archive itself (not its bases), in archive order.
+    std::vector<Digest> blobs() const
+    {
+        std::vector<std::pair<Digest, IndexEntry>> local;
+        for (auto& kv : index)
+            if (kv.second.archive == 0)
+                local.push_back(kv);
+        std::sort(local.begin(), local.end(), [&](auto& a, auto& b) { return record_offset(a.second) < record_offset(b.second); });
+        std::vector<Digest> out;
+        for (auto& kv : local)
+            out.push_back(kv.first);
+        return out;
+    }
+
+    /**
+     * Decompress one whole blob into data. Thread-safe: comp/data are caller-owned scratch buffers
+     * (comp is only filled when the archive isn't mapped) and zctx must not be shared between threads.
+     */
+    void read_blob(const Digest& hash, ZstdCtx& zctx, std::string& comp, std::string& data) const
+    {
+        const IndexEntry& e = entry(hash);
+        StageTimer timer(counters, Stage::Decompress, e.usize);
+        read_blob(e, zctx, comp, data);
+    }
+
+    /**
+     * Decompress one blob into outpath, below dest; with sparse, the blob is the file's packed bytes and the holes are
+     * recreated. Same threading rules as read_blob().
+     */
+    void extract_file(const Digest& hash, const OutputDir& dest, const fs::path& outpath, ZstdCtx& zctx, std::string& comp, std::string& data,
+                      const SparseMap* sparse = nullptr) const
+    {
+        const IndexEntry& e = entry(hash);
+        StageTimer timer(counters, Stage::Decompress, e.usize);
+        if (e.block == NO_BLOCK && e.usize > STREAM_THRESHOLD && e.ref == NO_REF)
+            return extract_streamed(e, dest, outpath, zctx, comp, data, sparse);
+
+        read_blob(e, zctx, comp, data);
+        StageTimer write_timer(counters, Stage::Write, data.size());
+        FileSink out(dest, outpath, sparse);
+        out.write(data.data(), data.size());
+        out.close();
+    }
+
+    // --- solid blocks ---
+
+    // Where the blob's bytes live in their archive (see IndexEntry::archive), for visiting records front to back.
+    uint64_t record_offset(const IndexEntry& e) const
+    {
+        if (e.archive > 0)
+        {
+            auto [r, local] = owner(e);
+            return r->record_offset(local);
+        }
+        return e.block == NO_BLOCK ? e.offset : blocks[e.block].offset;
+    }
+
+    // Compressed bytes attributable to the blob; solid block members get their share of the block.
+    uint64_t stored_size(const IndexEntry& e) const
+    {
+        if (e.archive > 0)
         {
-            auto hash        = val.as_uint64();
-            fs::path outpath = base / name;
-            if (auto it = cache.find(hash); it != cache.end())
+            auto [r, local] = owner(e);
+            return r->stored_size(local);
+        }
+        if (e.block == NO_BLOCK)
+            return e.csize;
+        const IndexEntry& b = blocks[e.block];
+        return b.usize ? e.usize * b.csize / b.usize : 0;
+    }
+
+    /**
+     * Decompress the whole solid block holding member e into data; members are then at [offset, offset + usize).
+     * Same threading rules as read_blob().
+     */
+    void read_block(const IndexEntry& member, ZstdCtx& zctx, std::string& comp, std::string& data) const
+    {
+        if (member.archive > 0)
+        {
+            auto [r, local] = owner(member);
+            return r->read_block(local, zctx, comp, data);
+        }
+        const IndexEntry& b = blocks.at(member.block);
+        StageTimer timer(counters, Stage::Decompress, b.usize);
+        if (b.csize >= PREFETCH_MIN)
+            prefetch(b.offset, b.csize);
+        const char* src = solid_payload(b, comp);
+        resize_for_overwrite(data, b.usize);
+        if (codec_of_frame(src, b.csize) == Codec::Lz4)
+            return lz4_decompress(src, b.csize, data.data(), b.usize);
+        size_t r = ZSTD_decompressDCtx(zctx.decompressor(), data.data(), b.usize, src, b.csize);
+        if (ZSTD_isError(r) || r != b.usize)
+            throw std::runtime_error(ZSTD_isError(r) ? ZSTD_getErrorName(r) : "corrupt solid block");
+    }
+
+    /**
+     * Reassemble a chunked file from its chunk blobs, in order, into outpath below dest.
+     */
+    void extract_chunks(const std::vector<Digest>& chunks, const OutputDir& dest, const fs::path& outpath, ZstdCtx& zctx, std::string& comp,
+                        std::string& data) const
+    {
+        StageTimer timer(counters, Stage::Decompress);
+        FileSink out(dest, outpath);
+        for (const Digest& h : chunks)
+        {
+            read_blob(entry(h), zctx, comp, data);
+            timer.add_bytes(data.size());
+            StageTimer write_timer(counters, Stage::Write, data.size());
+            out.write(data.data(), data.size());
+        }
+        out.close();
+    }
+
+private:
+    const IndexEntry& entry(const Digest& hash) const
+    {
+        const IndexEntry* e = find(hash);
+        if (!e)
+            throw std::runtime_error("hash " + hash.hex() + " not found in archive");
+        return *e;
+    }
+
+    void read_blob(const IndexEntry& e, ZstdCtx& zctx, std::string& comp, std::string& data) const
+    {
+        if (e.archive > 0)
+        {
+            auto [r, local] = owner(e);
+            return r->read_blob(local, zctx, comp, data);
+        }
+        if (e.block != NO_BLOCK)
+            return read_member(e, zctx, comp, data);
+        if (e.csize >= PREFETCH_MIN)
+            prefetch(e.offset, record_header_size + e.csize);
+        const char* record = bytes_at(e.offset, record_header_size + e.csize, comp);
+        const char* src    = record + record_header_size;
+        Codec codec        = codec_of_tag(record);
+        if (framed && (!frame_head_intact(record, RECORD_HEADER_SIZE) || (codec == Codec::Store && crc32c(src, e.csize) != frame_crc(record, RECORD_HEADER_SIZE))))
+            damaged_frame(e.offset);
+        if (codec == Codec::Store)
+        {
+            if (e.csize != e.usize)
+                throw std::runtime_error("corrupt raw record");
+            data.assign(src, e.csize);
+            return;
+        }
+
+        if (e.ref != NO_REF)
+            return read_against_reference(e, src, zctx, data);
+        resize_for_overwrite(data, e.usize);
+        if (codec == Codec::Lz4)
+            return lz4_decompress(src, e.csize, data.data(), e.usize);
+        const ZSTD_DDict* dict = dictionary_for(src, e.csize);
+        size_t r = dict ? ZSTD_decompress_usingDDict(zctx.decompressor(), data.data(), e.usize, src, e.csize, dict)
+                        : ZSTD_decompressDCtx(zctx.decompressor(), data.data(), e.usize, src, e.csize);
+        if (ZSTD_isError(r) || r != e.usize)
+            throw std::runtime_error(ZSTD_isError(r) ? ZSTD_getErrorName(r) : "corrupt record");
+    }
+
+    // A frame compressed with another blob as prefix: that blob is decoded first (with its own scratch buffers, src may
+    // point into comp), then handed to the decoder, which lifts the window limit a plain frame would be held to.
+    void read_against_reference(const IndexEntry& e, const char* src, ZstdCtx& zctx, std::string& data) const
+    {
+        std::string prefix, scratch;
+        read_blob(entry(references[e.ref]), zctx, scratch, prefix);
+
+        ZSTD_DCtx* dctx = zctx.decompressor();
+        ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+        ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, ZSTD_dParam_getBounds(ZSTD_d_windowLogMax).upperBound);
+        ZSTD_DCtx_refPrefix(dctx, prefix.data(), prefix.size());
+        resize_for_overwrite(data, e.usize);
+        size_t r = ZSTD_decompressDCtx(dctx, data.data(), e.usize, src, e.csize);
+        if (ZSTD_isError(r) || r != e.usize)
+            throw std::runtime_error(ZSTD_isError(r) ? ZSTD_getErrorName(r) : "corrupt record");
+    }
+
+    // Decodes the block only up to the end of the member.
+    void read_member(const IndexEntry& e, ZstdCtx& zctx, std::string& comp, std::string& data) const
+    {
+        const IndexEntry& b = blocks[e.block];
+        const char* src     = solid_payload(b, comp);
+        if (codec_of_frame(src, b.csize) == Codec::Lz4)
+        {
+            resize_for_overwrite(data, b.usize);
+            lz4_decompress(src, b.csize, data.data(), b.usize); // LZ4 decodes fast enough to take the whole block
+            data.erase(0, e.offset);
+            data.resize(e.usize);
+            return;
+        }
+
+        ZSTD_DCtx* dctx = zctx.decompressor();
+        ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+        ZSTD_DCtx_refDDict(dctx, nullptr);
+        resize_for_overwrite(data, e.offset + e.usize);
+        ZSTD_inBuffer in{src, b.csize, 0};
+        ZSTD_outBuffer out{data.data(), data.size(), 0};
+        while (out.pos < out.size)
+        {
+            size_t before = out.pos;
+            size_t r      = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(r))
+                throw std::runtime_error(ZSTD_getErrorName(r));
+            if (out.pos < out.size && (r == 0 || (in.pos == in.size && out.pos == before)))
+                throw std::runtime_error("truncated solid block");
+        }
+        data.erase(0, e.offset);
+    }
+
+    // Fixed-size buffers regardless of the blob size: the mapping is consumed in windows that are released
+    // behind the decoder, the pread path reads zstd's preferred input size at a time.
+    void extract_streamed(const IndexEntry& e, const OutputDir& dest, const fs::path& outpath, ZstdCtx& zctx, std::string& comp,
+                          std::string& data, const SparseMap* sparse) const
+    {
+        if (e.archive > 0)
+        {
+            auto [r, local] = owner(e);
+            return r->extract_streamed(local, dest, outpath, zctx, comp, data, sparse);
+        }
+        ZSTD_DCtx* dctx = zctx.decompressor();
+        ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+        data.resize(ZSTD_DStreamOutSize());
+
+        char head[RECORD_HEADER_SIZE];
+        read_exact(head, record_header_size, e.offset);
+        if (framed && !frame_head_intact(head, RECORD_HEADER_SIZE))
+            damaged_frame(e.offset);
+        const Codec codec = codec_of_tag(head);
+        const bool raw    = codec == Codec::Store;
+        if (raw && e.csize != e.usize)
+            throw std::runtime_error("corrupt raw record");
+
+        FileSink sink(dest, outpath, sparse);
+        uint64_t written = 0; // must come to e.usize, and never past it
+        auto write       = [&](const char* p, size_t k) {
+            if ((written += k) > e.usize)
+                throw std::runtime_error("corrupt record");
+            StageTimer timer(counters, Stage::Write, k);
+            sink.write(p, k);
+        };
+        const uint64_t window = map ? MAP_WINDOW : raw ? 1 << 20 : ZSTD_DStreamInSize();
+        uint64_t pos          = e.offset + record_header_size;
+        uint64_t left         = e.csize;
+        size_t ret            = raw ? 0 : 1;
+        uint32_t crc          = 0;
+        while (left > 0)
+        {
+            size_t n        = std::min(left, window);
+            const char* src = bytes_at(pos, n, comp);
+            prefetch(pos, n);
+            if (framed && raw)
+                crc = crc32c(src, n, crc);
+            if (codec != Codec::Zstd)
             {
-                fs::copy_file(it->second, outpath, fs::copy_options::overwrite_existing);
+                if (raw)
+                    write(src, n);
+                else if (lz4_decompress_part(src, n, left == e.csize, data, write))
+                    ret = 0;
+                release(pos, n);
+                pos += n;
+                left -= n;
+                continue;
             }
-            else
+            if (left == e.csize)
+                ZSTD_DCtx_refDDict(dctx, dictionary_for(src, n)); // sticky: set (or clear) for every frame
+
+            ZSTD_inBuffer in{src, n, 0};
+            while (in.pos < in.size)
             {
-                reader.extract_file(hash, outpath);
-                cache[hash] = outpath;
+                ZSTD_outBuffer out{data.data(), data.size(), 0};
+                ret = ZSTD_decompressStream(dctx, &out, &in);
+                if (ZSTD_isError(ret))
+                    throw std::runtime_error(ZSTD_getErrorName(ret));
+                write(data.data(), out.pos);
             }
+            release(pos, n);
+            pos += n;
+            left -= n;
         }
+        if (framed && raw && crc != frame_crc(head, RECORD_HEADER_SIZE))
+            damaged_frame(e.offset);
+        if (ret != 0)
+            throw std::runtime_error("truncated zstd frame");
+        if (written != e.usize)
+            throw std::runtime_error("corrupt record");
+        sink.close();
     }
-}
+};
@@ -0,0 +1,745 @@
+#pragma once
+#include "blockingQueue.hpp"
+#include "bufferPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if __has_include(<linux/openat2.h>) && defined(SYS_openat2)
+#include <linux/openat2.h>
+#define ARCHIVETOOL_HAVE_OPENAT2 1
+#endif
+
+#if defined(ARCHIVETOOL_HAVE_OPENAT2) && __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define ARCHIVETOOL_HAVE_URING 1
+#endif
+
+// --- asynchronous file I/O ---
+// On trees of many small files the cost is in open, read or write, and close, one blocking call after another,
+// not in bandwidth. These helpers keep many files in flight at once and off the compressing threads:
+//   Sync     the caller does its own blocking I/O (the default, and the baseline to compare against)
+//   Threads  a pool of io_depth threads doing blocking I/O
+//   Uring    one thread driving an io_uring (raw syscalls, no liburing) with up to io_depth files in flight, each
+//            going open -> read or write (repeated until complete) -> close without a thread of its own
+// Uring falls back to Threads at runtime when the kernel (or a seccomp filter) refuses io_uring.
+enum class IoBackend : uint8_t
+{
+    Sync,
+    Threads,
+    Uring,
+};
+
+inline const char* io_backend_name(IoBackend b)
+{
+    switch (b)
+    {
+        case IoBackend::Sync: return "sync";
+        case IoBackend::Threads: return "threads";
+        case IoBackend::Uring: return "uring";
+    }
+    return "unknown";
+}
+
+inline std::optional<IoBackend> io_backend_from_name(std::string_view name)
+{
+    for (IoBackend b : {IoBackend::Sync, IoBackend::Threads, IoBackend::Uring})
+        if (name == io_backend_name(b))
+            return b;
+    return std::nullopt;
+}
+
+inline std::runtime_error file_error(const char* what, const std::filesystem::path& path, int err)
+{
+    return std::runtime_error(std::string(what) + path.string() + ": " + std::strerror(err));
+}
+
+// Blocking whole-file read of (at most) size bytes; a file that shrank since it was sized comes back shorter.
+inline void read_whole(const std::filesystem::path& path, uint64_t size, std::string& buf)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw file_error("Failed to open file: ", path, errno);
+    resize_for_overwrite(buf, size);
+    size_t done = 0;
+    while (done < buf.size())
+    {
+        ssize_t r = ::read(fd, buf.data() + done, buf.size() - done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+        {
+            int err = errno;
+            ::close(fd);
+            throw file_error("Failed to read file: ", path, err);
+        }
+        if (r == 0)
+            break;
+        done += r;
+    }
+    ::close(fd);
+    buf.resize(done);
+}
+
+// --- output directory ---
+// Unpack writes only below the directory it was given, and never through a symbolic link, whether it was there before
+// or was restored from the archive. Paths handed to an OutputDir (built as dir / ...) are resolved relative to a
+// descriptor of dir without following links: openat2 with RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS, or, on kernels
+// before 5.6, one O_NOFOLLOW openat per component, as MetaApplier does.
+class OutputDir
+{
+    int fd = -1;
+    std::string base; // the prefix of the paths given
+
+    // Opens rel below dir without following a link on the way; -1 and errno on failure.
+    static int open_beneath(int dir, const char* rel, int flags, mode_t mode)
+    {
+#ifdef ARCHIVETOOL_HAVE_OPENAT2
+        static std::atomic<bool> missing{false};
+        if (!missing.load(std::memory_order_relaxed))
+        {
+            open_how how{};
+            how.flags   = static_cast<uint64_t>(flags | O_NOFOLLOW);
+            how.mode    = flags & O_CREAT ? mode : 0;
+            how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+            long r;
+            while ((r = ::syscall(SYS_openat2, dir, rel, &how, sizeof(how))) < 0 && (errno == EINTR || errno == EAGAIN))
+                ; // EAGAIN: a rename raced the lookup
+            if (r >= 0 || errno != ENOSYS)
+                return static_cast<int>(r);
+            missing.store(true, std::memory_order_relaxed);
+        }
+#endif
+        std::string part;
+        for (int at = dir;;)
+        {
+            const char* slash = std::strchr(rel, '/');
+            int next = slash ? ::openat(at, part.assign(rel, slash).c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+                             : ::openat(at, rel, flags | O_NOFOLLOW, mode);
+            int err  = errno;
+            if (at != dir)
+                ::close(at);
+            errno = err;
+            if (next < 0 || !slash)
+                return next;
+            at  = next;
+            rel = slash + 1;
+        }
+    }
+
+    // f(directory descriptor, name) for the directory holding path; -1 and errno when it can't be opened.
+    template <typename F>
+    int in_parent(const std::filesystem::path& path, F f) const
+    {
+        const char* rel   = below(path);
+        const char* slash = std::strrchr(rel, '/');
+        if (!slash)
+            return f(fd, rel);
+        int dir = open_beneath(fd, std::string(rel, slash).c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+        if (dir < 0)
+            return -1;
+        int r   = f(dir, slash + 1);
+        int err = errno;
+        ::close(dir);
+        errno = err;
+        return r;
+    }
+
+public:
+#ifdef ARCHIVETOOL_HAVE_OPENAT2
+    // How a file is created through openat2: as create() does.
+    static constexpr open_how CREATE = {O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0666, RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS};
+#endif
+
+    explicit OutputDir(const std::filesystem::path& dir) : base(dir.native())
+    {
+        fd = ::open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            throw file_error("Failed to open directory: ", dir, errno);
+    }
+
+    OutputDir(const OutputDir&)            = delete;
+    OutputDir& operator=(const OutputDir&) = delete;
+
+    ~OutputDir() { ::close(fd); }
+
+    int descriptor() const { return fd; }
+
+    // The part of path below the directory.
+    const char* below(const std::filesystem::path& path) const
+    {
+        const std::string& p = path.native();
+        if (p.compare(0, base.size(), base) != 0 || (p.size() > base.size() && p[base.size()] != '/' && !base.ends_with('/')))
+            throw std::logic_error("path outside the output directory: " + p);
+        size_t at = base.size();
+        while (at < p.size() && p[at] == '/')
+            ++at;
+        return p.c_str() + at;
+    }
+
+    // Opens path; -1 and errno on failure.
+    int open(const std::filesystem::path& path, int flags) const { return open_beneath(fd, below(path), flags | O_CLOEXEC, 0666); }
+
+    // Creates or truncates the file at path for writing; a link in its place is an error, not followed.
+    int create(const std::filesystem::path& path) const { return open(path, O_WRONLY | O_CREAT | O_TRUNC); }
+
+    // Creates the directory at path, unless there is one; its parent must exist.
+    void make_dir(const std::filesystem::path& path) const
+    {
+        int r = in_parent(path, [](int dir, const char* name) {
+            if (::mkdirat(dir, name, 0777) == 0)
+                return 0;
+            struct stat st;
+            if (errno != EEXIST)
+                return -1;
+            if (::fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode))
+                return 0;
+            errno = EEXIST; // a file, or a link (even to a directory)
+            return -1;
+        });
+        if (r != 0)
+            throw file_error("Failed to create directory: ", path, errno);
+    }
+
+    // Replaces whatever is at path with a symbolic link to target.
+    void make_symlink(const std::string& target, const std::filesystem::path& path) const
+    {
+        int r = in_parent(path, [&](int dir, const char* name) {
+            ::unlinkat(dir, name, 0);
+            return ::symlinkat(target.c_str(), dir, name);
+        });
+        if (r != 0)
+            throw file_error("Failed to create symbolic link: ", path, errno);
+    }
+
+    // Replaces whatever is at dst with a hard link to src; false when the filesystem refuses (other device, link limit...).
+    bool make_link(const std::filesystem::path& src, const std::filesystem::path& dst) const
+    {
+        return in_parent(src, [&](int from, const char* src_name) {
+                   return in_parent(dst, [&](int to, const char* dst_name) {
+                       ::unlinkat(to, dst_name, 0);
+                       return ::linkat(from, src_name, to, dst_name, 0);
+                   });
+               }) == 0;
+    }
+
+    // Whether there is anything at path itself (a link counts, it isn't followed).
+    bool exists(const std::filesystem::path& path) const
+    {
+        return in_parent(path, [](int dir, const char* name) {
+                   struct stat st;
+                   return ::fstatat(dir, name, &st, AT_SYMLINK_NOFOLLOW);
+               }) == 0;
+    }
+
+    // Removes the file at path, if there is one.
+    void remove(const std::filesystem::path& path) const
+    {
+        in_parent(path, [](int dir, const char* name) { return ::unlinkat(dir, name, 0); });
+    }
+};
+
+// Blocking whole-file write below dest, creating or truncating the file.
+inline void write_whole(const OutputDir& dest, const std::filesystem::path& path, const char* data, size_t size)
+{
+    int fd = dest.create(path);
+    if (fd < 0)
+        throw file_error("Failed to write file: ", path, errno);
+    for (size_t done = 0; done < size;)
+    {
+        ssize_t r = ::write(fd, data + done, size - done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+        {
+            int err = r < 0 ? errno : EIO;
+            ::close(fd);
+            throw file_error("Failed to write file: ", path, err);
+        }
+        done += r;
+    }
+    if (::close(fd) != 0)
+        throw file_error("Failed to write file: ", path, errno);
+}
+
+#ifdef ARCHIVETOOL_HAVE_URING
+// A minimal io_uring: the two rings and the entry array mapped from the kernel, filled and drained by one thread.
+class IoRing
+{
+    int fd = -1;
+    unsigned entries = 0;
+    void* sq_map     = nullptr;
+    void* cq_map     = nullptr;
+    void* sqe_map    = nullptr;
+    size_t sq_map_size = 0, cq_map_size = 0, sqe_map_size = 0;
+    unsigned *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned tail    = 0; // local submission tail, published by enter()
+    unsigned pending = 0; // queued, not yet taken by the kernel
+
+    void release()
+    {
+        if (sqe_map)
+            ::munmap(sqe_map, sqe_map_size);
+        if (cq_map && cq_map != sq_map)
+            ::munmap(cq_map, cq_map_size);
+        if (sq_map)
+            ::munmap(sq_map, sq_map_size);
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    static void* map(int fd, size_t size, off_t what)
+    {
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, what);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "io_uring mmap");
+        return p;
+    }
+
+    io_uring_sqe& sqe(uint8_t opcode, int target, uint64_t user_data)
+    {
+        unsigned idx    = tail++ & *sq_mask;
+        io_uring_sqe& s = sqes[idx];
+        std::memset(&s, 0, sizeof(s));
+        s.opcode    = opcode;
+        s.fd        = target;
+        s.user_data = user_data;
+        sq_array[idx] = idx;
+        ++pending;
+        return s;
+    }
+
+public:
+    // Throws std::system_error when the kernel has no usable io_uring (before 5.6, or blocked by seccomp).
+    explicit IoRing(unsigned depth)
+    {
+        io_uring_params p{};
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, depth, &p));
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+        try
+        {
+            if (!(p.features & IORING_FEAT_RW_CUR_POS)) // 5.6, the release that added openat and close
+                throw std::system_error(ENOSYS, std::generic_category(), "io_uring too old");
+            entries     = p.sq_entries;
+            sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            if (p.features & IORING_FEAT_SINGLE_MMAP)
+                sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+            sq_map       = map(fd, sq_map_size, IORING_OFF_SQ_RING);
+            cq_map       = p.features & IORING_FEAT_SINGLE_MMAP ? sq_map : map(fd, cq_map_size, IORING_OFF_CQ_RING);
+            sqe_map_size = p.sq_entries * sizeof(io_uring_sqe);
+            sqe_map      = map(fd, sqe_map_size, IORING_OFF_SQES);
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+
+        char* sq = static_cast<char*>(sq_map);
+        char* cq = static_cast<char*>(cq_map);
+        sq_tail  = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask  = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        cq_head  = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail  = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask  = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes     = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        sqes     = static_cast<io_uring_sqe*>(sqe_map);
+        tail     = *sq_tail;
+    }
+
+    IoRing(const IoRing&)            = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    ~IoRing() { release(); }
+
+    // Most operations that may be outstanding at once.
+    unsigned capacity() const { return entries; }
+
+    void open(const char* path, int flags, uint64_t user_data)
+    {
+        io_uring_sqe& s = sqe(IORING_OP_OPENAT, AT_FDCWD, user_data);
+        s.addr          = reinterpret_cast<uintptr_t>(path);
+        s.open_flags    = flags;
+        s.len           = 0666;
+    }
+
+    // openat2 of path relative to dir; how is read when the operation is submitted.
+    void open(int dir, const char* path, const open_how* how, uint64_t user_data)
+    {
+        io_uring_sqe& s = sqe(IORING_OP_OPENAT2, dir, user_data);
+        s.addr          = reinterpret_cast<uintptr_t>(path);
+        s.addr2         = reinterpret_cast<uintptr_t>(how);
+        s.len           = sizeof(open_how);
+    }
+
+    // At most 1 GiB per operation: the length field is 32 bits.
+    void read(int file, char* buf, size_t n, uint64_t offset, uint64_t user_data)
+    {
+        io_uring_sqe& s = sqe(IORING_OP_READ, file, user_data);
+        s.addr          = reinterpret_cast<uintptr_t>(buf);
+        s.len           = static_cast<uint32_t>(std::min<size_t>(n, 1u << 30));
+        s.off           = offset;
+    }
+
+    void write(int file, const char* buf, size_t n, uint64_t offset, uint64_t user_data)
+    {
+        io_uring_sqe& s = sqe(IORING_OP_WRITE, file, user_data);
+        s.addr          = reinterpret_cast<uintptr_t>(buf);
+        s.len           = static_cast<uint32_t>(std::min<size_t>(n, 1u << 30));
+        s.off           = offset;
+    }
+
+    void close(int file, uint64_t user_data) { sqe(IORING_OP_CLOSE, file, user_data); }
+
+    // Hands the queued operations to the kernel and waits until at least wait_nr completions are available.
+    void enter(unsigned wait_nr)
+    {
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        do
+        {
+            long r = ::syscall(__NR_io_uring_enter, fd, pending, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0)
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            pending -= static_cast<unsigned>(r);
+        } while (pending > 0);
+    }
+
+    // Calls f(user_data, result) for every available completion; f may queue further operations.
+    template <typename F>
+    void reap(F f)
+    {
+        unsigned head = *cq_head;
+        unsigned end  = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != end; ++head)
+        {
+            const io_uring_cqe& c = cqes[head & *cq_mask];
+            f(c.user_data, c.res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+};
+
+// What a queued item transfers: the file, and the buffer to read into or write from. A file written is created below
+// the output directory dir (see OutputDir), path being relative to it.
+struct IoSpan
+{
+    const char* path;
+    char* buf;
+    size_t size;
+    int dir = AT_FDCWD;
+};
+
+/**
+ * Moves items from in through the ring until in is closed and drained, up to ring.capacity() files at a time.
+ * bind(T&) gives the item's IoSpan (it must stay valid while the item is in flight); finished(T&&, size_t done,
+ * int err) gets each item back in completion order, with the bytes transferred and 0 or the errno of the failed step.
+ */
+template <typename T, typename Bind, typename Finished>
+void uring_pump(IoRing& ring, bool writing, BlockingQueue<T>& in, Bind bind, Finished finished)
+{
+    struct Op
+    {
+        T item;
+        IoSpan span{};
+        size_t done = 0;
+        int fd      = -1;
+        int error   = 0;
+        enum class Step : uint8_t
+        {
+            Open,
+            Data,
+            Close,
+        } step = Step::Open;
+    };
+    auto tag      = [](Op* op) { return reinterpret_cast<uint64_t>(op); };
+    auto transfer = [&](Op* op) {
+        if (writing)
+            ring.write(op->fd, op->span.buf + op->done, op->span.size - op->done, op->done, tag(op));
+        else
+            ring.read(op->fd, op->span.buf + op->done, op->span.size - op->done, op->done, tag(op));
+    };
+    auto close = [&](Op* op) {
+        op->step = Op::Step::Close;
+        ring.close(op->fd, tag(op));
+    };
+    auto open = [&](Op* op) {
+        if (writing)
+            ring.open(op->span.dir, op->span.path, &OutputDir::CREATE, tag(op));
+        else
+            ring.open(op->span.path, O_RDONLY | O_CLOEXEC, tag(op));
+    };
+
+    unsigned inflight = 0;
+    auto finish       = [&](Op* op) {
+        std::unique_ptr<Op> owned(op);
+        --inflight;
+        finished(std::move(op->item), op->done, op->error);
+    };
+
+    bool more = true;
+    while (more || inflight > 0)
+    {
+        while (inflight < ring.capacity())
+        {
+            std::optional<T> item = inflight == 0 ? in.pop() : in.try_pop(); // block only when idle
+            if (!item)
+            {
+                more = inflight > 0;
+                break;
+            }
+            Op* op   = new Op{std::move(*item)};
+            op->span = bind(op->item);
+            open(op);
+            ++inflight;
+        }
+        if (inflight == 0)
+            break;
+
+        ring.enter(1);
+        ring.reap([&](uint64_t user_data, int res) {
+            Op* op = reinterpret_cast<Op*>(user_data);
+            switch (op->step)
+            {
+                case Op::Step::Open:
+                    if (res == -EAGAIN && writing) // a rename raced the lookup beneath the output directory
+                        return open(op);
+                    if (res < 0)
+                    {
+                        op->error = -res;
+                        return finish(op);
+                    }
+                    op->fd   = res;
+                    op->step = Op::Step::Data;
+                    return op->span.size ? transfer(op) : close(op);
+                case Op::Step::Data:
+                    if (res < 0)
+                        op->error = -res;
+                    else if (res == 0 && writing)
+                        op->error = EIO;
+                    else
+                        op->done += res;
+                    // a read returning 0 is end of file: the file shrank since it was sized
+                    return res > 0 && op->done < op->span.size ? transfer(op) : close(op);
+                case Op::Step::Close:
+                    if (res < 0 && !op->error)
+                        op->error = -res;
+                    return finish(op);
+            }
+        });
+    }
+}
+#endif
+
+// Whether io_uring can be used here; probed once.
+inline bool uring_available()
+{
+#ifdef ARCHIVETOOL_HAVE_URING
+    static const bool ok = [] {
+        try
+        {
+            IoRing probe(2);
+            return true;
+        }
+        catch (const std::system_error&)
+        {
+            return false;
+        }
+    }();
+    return ok;
+#else
+    return false;
+#endif
+}
+
+// The backend that will actually run: Uring degrades to Threads where io_uring is unavailable.
+inline IoBackend usable_backend(IoBackend b) { return b == IoBackend::Uring && !uring_available() ? IoBackend::Threads : b; }
+
+// --- read-ahead ---
+// Reads whole files ahead of the compressing threads: jobs from in get their data read (or their error set) and are
+// passed on to out in completion order. Job needs path, stat.size (bytes to read), data and error.
+template <typename Job>
+class FileLoader
+{
+    std::vector<std::thread> threads;
+#ifdef ARCHIVETOOL_HAVE_URING
+    std::unique_ptr<IoRing> ring;
+#endif
+
+public:
+    // backend must be usable (see usable_backend()), and not Sync.
+    FileLoader(IoBackend backend, unsigned depth, BlockingQueue<Job>& in, BlockingQueue<Job>& out)
+    {
+        depth = std::max(1u, depth);
+#ifdef ARCHIVETOOL_HAVE_URING
+        if (backend == IoBackend::Uring)
+        {
+            ring = std::make_unique<IoRing>(depth);
+            threads.emplace_back([&in, &out, r = ring.get()] {
+                auto bind = [](Job& job) {
+                    resize_for_overwrite(job.data, job.stat.size);
+                    return IoSpan{job.path.c_str(), job.data.data(), job.data.size()};
+                };
+                uring_pump(*r, false, in, bind, [&out](Job&& job, size_t done, int err) {
+                    job.data.resize(done);
+                    if (err)
+                        job.error = std::make_exception_ptr(file_error("Failed to read file: ", job.path, err));
+                    out.push(std::move(job));
+                });
+            });
+            return;
+        }
+#endif
+        for (unsigned i = 0; i < depth; ++i)
+            threads.emplace_back([&in, &out] {
+                while (auto job = in.pop())
+                {
+                    try
+                    {
+                        read_whole(job->path, job->stat.size, job->data);
+                    }
+                    catch (...)
+                    {
+                        job->error = std::current_exception();
+                    }
+                    out.push(std::move(*job));
+                }
+            });
+    }
+
+    FileLoader(const FileLoader&)            = delete;
+    FileLoader& operator=(const FileLoader&) = delete;
+
+    ~FileLoader() { join(); }
+
+    // Once in is closed: returns when every job has been passed on. Leaves out open.
+    void join()
+    {
+        for (auto& t : threads)
+            if (t.joinable())
+                t.join();
+    }
+};
+
+// --- write-behind ---
+// Writes whole files out of shared buffers, so decompressing threads hand a file over and move on. Duplicates and
+// solid block members share one buffer, which lives until its last write completes. At most budget bytes are
+// queued (write() blocks beyond that); finish() waits for everything and rethrows the first error.
+class FileWriter
+{
+    struct Request
+    {
+        std::filesystem::path path;
+        std::shared_ptr<const std::string> buf;
+        size_t offset;
+        size_t size;
+    };
+
+    const OutputDir& dest;
+    BlockingQueue<Request> queue;
+    ByteBudget budget;
+    std::vector<std::thread> threads;
+#ifdef ARCHIVETOOL_HAVE_URING
+    std::unique_ptr<IoRing> ring;
+#endif
+    std::mutex error_m;
+    std::exception_ptr first_error;
+
+    void fail(std::exception_ptr e)
+    {
+        std::lock_guard lock(error_m);
+        if (!first_error)
+            first_error = e;
+    }
+
+public:
+    // backend must be usable (see usable_backend()), and not Sync. Files are created below out.
+    FileWriter(IoBackend backend, unsigned depth, uint64_t budget_bytes, const OutputDir& out) : dest(out), budget(budget_bytes)
+    {
+        depth = std::max(1u, depth);
+#ifdef ARCHIVETOOL_HAVE_URING
+        if (backend == IoBackend::Uring)
+        {
+            ring = std::make_unique<IoRing>(depth);
+            threads.emplace_back([this, r = ring.get()] {
+                auto bind = [this](Request& q) { return IoSpan{dest.below(q.path), const_cast<char*>(q.buf->data() + q.offset), q.size, dest.descriptor()}; };
+                uring_pump(*r, true, queue, bind, [this](Request&& q, size_t, int err) {
+                    if (err)
+                        fail(std::make_exception_ptr(file_error("Failed to write file: ", q.path, err)));
+                    budget.release(q.size);
+                });
+            });
+            return;
+        }
+#endif
+        for (unsigned i = 0; i < depth; ++i)
+            threads.emplace_back([this] {
+                while (auto q = queue.pop())
+                {
+                    try
+                    {
+                        write_whole(dest, q->path, q->buf->data() + q->offset, q->size);
+                    }
+                    catch (...)
+                    {
+                        fail(std::current_exception());
+                    }
+                    budget.release(q->size);
+                }
+            });
+    }
+
+    FileWriter(const FileWriter&)            = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    ~FileWriter()
+    {
+        queue.close();
+        for (auto& t : threads)
+            if (t.joinable())
+                t.join();
+    }
+
+    // Queues [offset, offset + size) of buf to be written to a new file at path (replacing any old one), below the output directory.
+    void write(std::filesystem::path path, std::shared_ptr<const std::string> buf, size_t offset, size_t size)
+    {
+        budget.acquire(size);
+        queue.push({std::move(path), std::move(buf), offset, size});
+    }
+
+    void finish()
+    {
+        queue.close();
+        for (auto& t : threads)
+            t.join();
+        if (first_error)
+            std::rethrow_exception(first_error);
+    }
+};
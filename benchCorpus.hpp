@@ -0,0 +1,284 @@
+#pragma once
+#include "sparseFile.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// --- benchmark corpus ---
+// Synthetic trees for the bench command, generated from a seed: the same seed, profile and size give the same files
+// with the same content on any machine. Only the engine's raw output is used (std::mt19937_64 is specified bit for
+// bit; the standard distributions are not). Files go 64 to a directory, 16 directories to a parent.
+//   random   incompressible files, 4 KiB to 16 MiB (log-uniform)
+//   text     log files of timestamped lines drawn from a small vocabulary, 4 KiB to 8 MiB
+//   sparse   16 to 64 MiB files with holes; the data extents (about a sixth) are half text, half random
+//   small    many files of 64 bytes to 8 KiB in source-like text, spread over many directories
+//   dup      copies of a few distinct files (70%), copies with a few bytes changed (20%) and new files (10%)
+// The size is the number of bytes written (a sparse file's data, not its holes).
+enum class CorpusProfile : uint8_t
+{
+    Random,
+    Text,
+    Sparse,
+    Small,
+    Dup,
+};
+
+inline constexpr CorpusProfile CORPUS_PROFILES[] = {CorpusProfile::Random, CorpusProfile::Text, CorpusProfile::Sparse, CorpusProfile::Small,
+                                                    CorpusProfile::Dup};
+
+inline const char* corpus_profile_name(CorpusProfile p)
+{
+    switch (p)
+    {
+        case CorpusProfile::Random: return "random";
+        case CorpusProfile::Text: return "text";
+        case CorpusProfile::Sparse: return "sparse";
+        case CorpusProfile::Small: return "small";
+        case CorpusProfile::Dup: return "dup";
+    }
+    return "unknown";
+}
+
+inline std::optional<CorpusProfile> corpus_profile_from_name(std::string_view name)
+{
+    for (CorpusProfile p : CORPUS_PROFILES)
+        if (name == corpus_profile_name(p))
+            return p;
+    return std::nullopt;
+}
+
+struct CorpusInfo
+{
+    uint64_t files = 0;
+    uint64_t dirs  = 0;
+    uint64_t bytes = 0; // apparent size of all files, holes included
+};
+
+class CorpusGenerator
+{
+    static constexpr size_t FILES_PER_DIR = 64;
+    static constexpr size_t DIR_FANOUT    = 16;
+
+    uint64_t seed;
+    std::mt19937_64 rng;
+    std::filesystem::path root;
+    CorpusInfo info;
+    std::string buf; // content of the file being generated
+
+    uint64_t below(uint64_t n) { return rng() % n; }
+
+    // Log-uniform in [lo, hi]: as many files between 4 and 8 KiB as between 4 and 8 MiB.
+    uint64_t size_between(uint64_t lo, uint64_t hi)
+    {
+        unsigned lo_bits = std::bit_width(lo) - 1, hi_bits = std::bit_width(hi) - 1;
+        unsigned bits    = lo_bits + below(hi_bits - lo_bits + 1);
+        uint64_t size    = (1ull << bits) + below(1ull << bits);
+        return std::clamp(size, lo, hi);
+    }
+
+    void append_random(std::string& out, size_t n)
+    {
+        size_t at = out.size();
+        out.resize(at + n);
+        for (size_t k = 0; k < n; k += 8)
+        {
+            uint64_t v = rng();
+            std::memcpy(out.data() + at + k, &v, std::min<size_t>(8, n - k));
+        }
+    }
+
+    void append_text(std::string& out, size_t n)
+    {
+        static constexpr std::string_view levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+        static constexpr std::string_view components[] = {"http", "db", "cache", "auth", "scheduler", "worker", "storage", "api"};
+        static constexpr std::string_view words[] = {
+            "request", "completed", "started", "user",    "session", "timeout",  "retry",  "connection", "closed",  "opened",
+            "query",   "slow",      "cache",   "miss",    "hit",     "token",    "expired", "job",       "queued",  "failed",
+            "written", "bytes",     "from",    "to",      "in",      "after",    "with",    "status",    "updated", "deleted"};
+        size_t end    = out.size() + n;
+        uint64_t time = 1700000000000ull + below(1000000);
+        char line[48];
+        while (out.size() < end)
+        {
+            time += below(2000);
+            int len = std::snprintf(line, sizeof(line), "%llu.%03llu ", static_cast<unsigned long long>(time / 1000),
+                                    static_cast<unsigned long long>(time % 1000));
+            out.append(line, len);
+            out += levels[below(std::size(levels))];
+            out += " [";
+            out += components[below(std::size(components))];
+            out += "]";
+            for (uint64_t w = 3 + below(8); w > 0; --w)
+            {
+                out += ' ';
+                out += words[below(std::size(words))];
+            }
+            len = std::snprintf(line, sizeof(line), " id=%llu ms=%llu\n", static_cast<unsigned long long>(below(100000)),
+                                static_cast<unsigned long long>(below(5000)));
+            out.append(line, len);
+        }
+        out.resize(end);
+    }
+
+    void append_source(std::string& out, size_t n)
+    {
+        static constexpr std::string_view lines[] = {
+            "#include <string>\n", "namespace app {\n", "}\n", "    return value;\n", "    if (count == 0)\n", "        return false;\n",
+            "    for (size_t i = 0; i < items.size(); ++i)\n", "    {\n", "    }\n", "// TODO: handle the error case\n",
+            "static int compute(int a, int b)\n", "    std::string name = \"default\";\n", "    total += item.size;\n", "\n"};
+        size_t end = out.size() + n;
+        while (out.size() < end)
+            out += lines[below(std::size(lines))];
+        out.resize(end);
+    }
+
+    std::filesystem::path next_path(const char* ext)
+    {
+        uint64_t dir = info.files / FILES_PER_DIR;
+        std::filesystem::path d = root / ("d" + std::to_string(dir / DIR_FANOUT)) / ("d" + std::to_string(dir % DIR_FANOUT));
+        if (info.files % FILES_PER_DIR == 0 && std::filesystem::create_directories(d))
+            info.dirs += dir % DIR_FANOUT == 0 ? 2 : 1;
+        return d / ("f" + std::to_string(info.files++) + ext);
+    }
+
+    void write(const std::filesystem::path& path, const std::string& data, const SparseMap* map = nullptr)
+    {
+        FileSink out(path, map);
+        out.write(data.data(), data.size());
+        out.close();
+        info.bytes += map ? map->size : data.size();
+    }
+
+    void generate_random(uint64_t budget)
+    {
+        for (uint64_t left = budget; left > 0;)
+        {
+            uint64_t size = std::min(left, size_between(4 << 10, 16 << 20));
+            buf.clear();
+            append_random(buf, size);
+            write(next_path(".bin"), buf);
+            left -= size;
+        }
+    }
+
+    void generate_text(uint64_t budget)
+    {
+        for (uint64_t left = budget; left > 0;)
+        {
+            uint64_t size = std::min(left, size_between(4 << 10, 8 << 20));
+            buf.clear();
+            append_text(buf, size);
+            write(next_path(".log"), buf);
+            left -= size;
+        }
+    }
+
+    void generate_sparse(uint64_t budget)
+    {
+        for (uint64_t left = budget; left > 0;)
+        {
+            SparseMap map{size_between(16 << 20, 64 << 20) & ~0xFFFFull, {}};
+            buf.clear();
+            for (uint64_t pos = 0; pos < map.size && buf.size() < left;)
+            {
+                uint64_t gap = (below(14) + 1) << 16; // 64 to 896 KiB of hole before an extent of 64 or 128 KiB
+                uint64_t len = std::min({(below(2) + 1) << 16, left - buf.size(), map.size - std::min(map.size, pos + gap)});
+                pos += gap;
+                if (len == 0)
+                    break;
+                map.extents.push_back({pos, len});
+                if (below(2))
+                    append_text(buf, len);
+                else
+                    append_random(buf, len);
+                pos += len;
+            }
+            if (buf.empty()) // too little left for an extent: end with a plain file
+            {
+                buf.clear();
+                append_random(buf, left);
+                write(next_path(".bin"), buf);
+                return;
+            }
+            write(next_path(".img"), buf, &map);
+            left -= buf.size();
+        }
+    }
+
+    void generate_small(uint64_t budget)
+    {
+        static constexpr const char* exts[] = {".cpp", ".hpp", ".txt", ".json"};
+        for (uint64_t left = budget; left > 0;)
+        {
+            uint64_t size = std::min(left, size_between(64, 8 << 10));
+            buf.clear();
+            append_source(buf, size);
+            write(next_path(exts[below(std::size(exts))]), buf);
+            left -= size;
+        }
+    }
+
+    void generate_dup(uint64_t budget)
+    {
+        std::vector<std::string> pool;
+        for (uint64_t distinct = 0; distinct < budget / 8 || pool.empty();)
+        {
+            std::string data;
+            uint64_t size = size_between(64 << 10, 4 << 20);
+            if (below(2))
+                append_text(data, size);
+            else
+                append_random(data, size);
+            distinct += data.size();
+            pool.push_back(std::move(data));
+        }
+        for (uint64_t left = budget; left > 0;)
+        {
+            uint64_t roll = below(10);
+            if (roll == 0)
+            {
+                buf.clear();
+                append_text(buf, size_between(64 << 10, 4 << 20));
+            }
+            else
+            {
+                buf = pool[below(pool.size())];
+                for (uint64_t edits = roll < 3 ? 1 + below(4) : 0; edits > 0; --edits)
+                    buf[below(buf.size())] ^= static_cast<char>(1 + below(255));
+            }
+            buf.resize(std::min<uint64_t>(buf.size(), left));
+            write(next_path(".dat"), buf);
+            left -= buf.size();
+        }
+    }
+
+public:
+    explicit CorpusGenerator(uint64_t s) : seed(s) {}
+
+    // Fills dir (created if needed) with about bytes of the profile's files.
+    CorpusInfo generate(CorpusProfile profile, const std::filesystem::path& dir, uint64_t bytes)
+    {
+        root = dir;
+        info = {};
+        std::filesystem::create_directories(root);
+        rng.seed(seed ^ (static_cast<uint64_t>(profile) + 1) * 0x9E3779B97F4A7C15ull); // each profile its own stream
+        switch (profile)
+        {
+            case CorpusProfile::Random: generate_random(bytes); break;
+            case CorpusProfile::Text: generate_text(bytes); break;
+            case CorpusProfile::Sparse: generate_sparse(bytes); break;
+            case CorpusProfile::Small: generate_small(bytes); break;
+            case CorpusProfile::Dup: generate_dup(bytes); break;
+        }
+        return info;
+    }
+};
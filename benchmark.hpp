@@ -0,0 +1,241 @@
+#pragma once
+#include "archiver.hpp"
+#include "benchCorpus.hpp"
+#include "manifest.hpp"
+#include "metadata.hpp"
+#include "miniJson.hpp"
+#include "packPipeline.hpp"
+#include "pipelineStats.hpp"
+#include "unpackPipeline.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+// --- benchmark harness ---
+// bench generates the corpus of each profile (see benchCorpus.hpp), packs it and unpacks it again in this process,
+// checks that the restored tree is identical, and reports as JSON:
+//   corpus      files, directories and bytes generated
+//   ratio       corpus bytes per archive byte
+//   pack        wall time, throughput and peak RSS; p50/p99 per-file latency; per-stage time, bytes and throughput;
+//               counters (files, bytes, dedup hits) and queue peaks
+//   unpack      the same
+// Stage times are summed over the threads running the stage (see pipelineStats.hpp), so a stage's throughput is per
+// thread; the phase's own throughput is corpus bytes over wall time. The corpus is read back from the page cache,
+// just written. Peak RSS is reset before each phase where the kernel allows (/proc/self/clear_refs), else it is the
+// process's peak so far.
+struct BenchOptions
+{
+    std::vector<CorpusProfile> profiles{std::begin(CORPUS_PROFILES), std::end(CORPUS_PROFILES)};
+    uint64_t size = 64ull << 20; // corpus bytes per profile
+    uint64_t seed = 1;
+    fs::path dir;                // work directory; a new one below the temporary directory when empty
+    fs::path out;                // write the JSON here instead of stdout
+    bool keep = false;           // leave corpus, archive and restored tree in place
+};
+
+// Restarts the peak RSS count from the current resident size; false where the kernel doesn't support it.
+inline bool reset_peak_rss()
+{
+    std::ofstream f("/proc/self/clear_refs");
+    if (!f)
+        return false;
+    f << "5" << std::flush;
+    return static_cast<bool>(f);
+}
+
+// Peak resident set size of the process, in bytes.
+inline uint64_t peak_rss()
+{
+    std::ifstream status("/proc/self/status");
+    for (std::string line; std::getline(status, line);)
+        if (line.starts_with("VmHWM:"))
+            return std::stoull(line.substr(6)) << 10;
+    struct rusage ru;
+    ::getrusage(RUSAGE_SELF, &ru);
+    return static_cast<uint64_t>(ru.ru_maxrss) << 10;
+}
+
+// Whether every directory, file and symbolic link below a is below b with the same content, and b has nothing more.
+inline bool same_trees(const fs::path& a, const fs::path& b)
+{
+    size_t entries = 0;
+    std::string abuf(1 << 20, '\0'), bbuf(1 << 20, '\0');
+    for (auto& e : fs::recursive_directory_iterator(a))
+    {
+        ++entries;
+        fs::path other = b / e.path().lexically_relative(a);
+        if (fs::symlink_status(other).type() != e.symlink_status().type())
+            return false;
+        if (e.is_symlink())
+        {
+            if (fs::read_symlink(e.path()) != fs::read_symlink(other))
+                return false;
+            continue;
+        }
+        if (!e.is_regular_file())
+            continue;
+        if (fs::file_size(other) != e.file_size())
+            return false;
+        std::ifstream fa(e.path(), std::ios::binary), fb(other, std::ios::binary);
+        while (fa && fb)
+        {
+            fa.read(abuf.data(), abuf.size());
+            fb.read(bbuf.data(), bbuf.size());
+            if (fa.gcount() != fb.gcount() || std::memcmp(abuf.data(), bbuf.data(), fa.gcount()) != 0)
+                return false;
+        }
+    }
+    size_t restored = std::distance(fs::recursive_directory_iterator(b), fs::recursive_directory_iterator{});
+    return restored == entries;
+}
+
+// The pipelines print notes on stdout (a trained dictionary, refused metadata, files already added with -v), which
+// would end up in the middle of the JSON.
+class QuietStdout
+{
+    std::streambuf* saved = std::cout.rdbuf(nullptr);
+
+public:
+    QuietStdout()                              = default;
+    QuietStdout(const QuietStdout&)            = delete;
+    QuietStdout& operator=(const QuietStdout&) = delete;
+
+    ~QuietStdout()
+    {
+        std::cout.rdbuf(saved);
+        std::cout.clear();
+    }
+};
+
+inline double mib_per_s(uint64_t bytes, uint64_t ns) { return ns ? static_cast<double>(bytes) / (1 << 20) / (ns / 1e9) : 0.0; }
+
+// The pipeline's own statistics (see PipelineStats::to_json) with the phase's wall time, throughput and peak RSS.
+inline mini_json::object phase_json(PipelineStats& stats, std::initializer_list<Stage> stages, uint64_t ns, uint64_t bytes, uint64_t rss)
+{
+    mini_json::object o = stats.to_json(stages);
+    o["seconds"]        = ns / 1e9;
+    o["mib_per_s"]      = mib_per_s(bytes, ns);
+    o["peak_rss_bytes"] = rss;
+    return o;
+}
+
+/**
+ * Generates, packs, unpacks and compares one profile below work, which is left empty unless keep is set.
+ * Returns the profile's results; "verified" is false when the restored tree differs.
+ */
+inline mini_json::object bench_profile(CorpusProfile profile, const BenchOptions& bench, const PackOptions& opts, const fs::path& work)
+{
+    const fs::path src = work / "src", archive = work / "bench.arc", restored = work / "out";
+    std::error_code ec;
+    fs::remove_all(work, ec);
+
+    uint64_t start  = now_ns();
+    CorpusInfo info = CorpusGenerator(bench.seed).generate(profile, src, bench.size);
+    uint64_t gen_ns = now_ns() - start;
+
+    QuietStdout quiet;
+    PipelineStats pack;
+    reset_peak_rss();
+    start = now_ns();
+    {
+        ArchiveWriter writer(archive, opts.hash);
+        writer.set_stats(&pack);
+        Manifest manifest;
+        MetaTable meta;
+        build_structure(src, manifest, writer, opts, nullptr, nullptr, &meta);
+        writer.write_block("META", meta.serialize());
+        writer.write_header(manifest.serialize(opts.compress_manifest));
+        writer.write_index();
+    }
+    uint64_t pack_ns  = now_ns() - start;
+    uint64_t pack_rss = peak_rss();
+
+    UnpackOptions uopts;
+    uopts.threads  = opts.threads;
+    uopts.io       = opts.io;
+    uopts.io_depth = opts.io_depth;
+    PipelineStats unpack;
+    reset_peak_rss();
+    start = now_ns();
+    {
+        std::optional<ArchiveReader> reader;
+        std::optional<Manifest> manifest;
+        std::optional<MetaTable> meta;
+        {
+            StageTimer timer(&unpack, Stage::Index);
+            reader.emplace(archive, uopts.use_mmap);
+            reader->set_stats(&unpack);
+            manifest.emplace(Manifest::parse(reader->read_header()));
+            if (std::optional<std::string> block = reader->read_section("META"))
+                meta.emplace(MetaTable::parse(*block));
+        }
+        fs::create_directories(restored);
+        restore_structure(*manifest, restored, *reader, uopts, meta ? &*meta : nullptr);
+    }
+    uint64_t unpack_ns  = now_ns() - start;
+    uint64_t unpack_rss = peak_rss();
+
+    uint64_t archive_bytes = fs::file_size(archive);
+    bool verified          = same_trees(src, restored);
+    if (!bench.keep)
+        fs::remove_all(work, ec);
+
+    return {
+        {"corpus", mini_json::object{{"files", info.files}, {"dirs", info.dirs}, {"bytes", info.bytes}, {"generate_seconds", gen_ns / 1e9}}},
+        {"archive_bytes", archive_bytes},
+        {"ratio", archive_bytes ? static_cast<double>(info.bytes) / archive_bytes : 0.0},
+        {"pack", phase_json(pack, PACK_STAGES, pack_ns, info.bytes, pack_rss)},
+        {"unpack", phase_json(unpack, UNPACK_STAGES, unpack_ns, info.bytes, unpack_rss)},
+        {"verified", verified},
+    };
+}
+
+// Runs every requested profile; returns false when a restored tree differed from its corpus.
+inline bool run_benchmark(const BenchOptions& bench, const PackOptions& opts)
+{
+    fs::path dir = bench.dir.empty() ? fs::temp_directory_path() / ("archiveTool-bench-" + std::to_string(::getpid())) : bench.dir;
+    bool created = !fs::exists(dir);
+    fs::create_directories(dir);
+
+    bool ok = true;
+    mini_json::object profiles;
+    for (CorpusProfile p : bench.profiles)
+    {
+        mini_json::object r = bench_profile(p, bench, opts, dir / corpus_profile_name(p));
+        ok                  = ok && r["verified"].as_bool();
+        profiles[corpus_profile_name(p)] = std::move(r);
+    }
+    if (created && !bench.keep)
+    {
+        std::error_code ec;
+        fs::remove(dir, ec);
+    }
+
+    mini_json::object report{
+        {"seed", bench.seed},
+        {"size_bytes", bench.size},
+        {"threads", static_cast<uint64_t>(opts.threads)},
+        {"codec", codec_name(opts.codec)},
+        {"level", static_cast<uint64_t>(std::max(0, opts.level))},
+        {"chunked", opts.chunked},
+        {"solid", opts.solid},
+        {"io", io_backend_name(opts.io)},
+        {"rss_reset", reset_peak_rss()},
+        {"profiles", std::move(profiles)},
+    };
+    std::string json = mini_json::dump(report, 2) + "\n";
+    if (bench.out.empty())
+        std::cout << json;
+    else if (!(std::ofstream(bench.out, std::ios::binary) << json))
+        throw std::runtime_error("Failed to write " + bench.out.string());
+    return ok;
+}
@@ -0,0 +1,221 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * BLAKE3 (unkeyed hash mode), portable implementation following the reference design:
+ * 1 KiB chunks of 64-byte blocks, a stack of chaining values merged into a binary tree,
+ * and an extendable output. Used as the cryptographic content hash when --hash blake3 is set.
+ */
+namespace blake3 {
+
+inline constexpr uint32_t IV[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+inline constexpr size_t BLOCK_LEN = 64;
+inline constexpr size_t CHUNK_LEN = 1024;
+
+inline constexpr uint32_t CHUNK_START = 1 << 0;
+inline constexpr uint32_t CHUNK_END   = 1 << 1;
+inline constexpr uint32_t PARENT      = 1 << 2;
+inline constexpr uint32_t ROOT        = 1 << 3;
+
+inline void g(uint32_t* s, size_t a, size_t b, size_t c, size_t d, uint32_t mx, uint32_t my)
+{
+    s[a] = s[a] + s[b] + mx;
+    s[d] = std::rotr(s[d] ^ s[a], 16);
+    s[c] = s[c] + s[d];
+    s[b] = std::rotr(s[b] ^ s[c], 12);
+    s[a] = s[a] + s[b] + my;
+    s[d] = std::rotr(s[d] ^ s[a], 8);
+    s[c] = s[c] + s[d];
+    s[b] = std::rotr(s[b] ^ s[c], 7);
+}
+
+// Full 16-word output of the compression function.
+inline void compress(const uint32_t cv[8], const uint32_t block[16], uint64_t counter, uint32_t block_len, uint32_t flags, uint32_t out[16])
+{
+    static constexpr uint8_t PERMUTATION[16] = {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8};
+
+    uint32_t s[16] = {cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7], IV[0], IV[1], IV[2], IV[3],
+                      static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), block_len, flags};
+    uint32_t m[16];
+    std::memcpy(m, block, sizeof(m));
+
+    for (int round = 0; round < 7; ++round)
+    {
+        g(s, 0, 4, 8, 12, m[0], m[1]);
+        g(s, 1, 5, 9, 13, m[2], m[3]);
+        g(s, 2, 6, 10, 14, m[4], m[5]);
+        g(s, 3, 7, 11, 15, m[6], m[7]);
+        g(s, 0, 5, 10, 15, m[8], m[9]);
+        g(s, 1, 6, 11, 12, m[10], m[11]);
+        g(s, 2, 7, 8, 13, m[12], m[13]);
+        g(s, 3, 4, 9, 14, m[14], m[15]);
+
+        uint32_t permuted[16];
+        for (size_t i = 0; i < 16; ++i)
+            permuted[i] = m[PERMUTATION[i]];
+        std::memcpy(m, permuted, sizeof(m));
+    }
+
+    for (size_t i = 0; i < 8; ++i)
+    {
+        out[i]     = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+    }
+}
+
+inline void load_block(const uint8_t* bytes, uint32_t words[16])
+{
+    for (size_t i = 0; i < 16; ++i)
+        words[i] = uint32_t(bytes[4 * i]) | uint32_t(bytes[4 * i + 1]) << 8 | uint32_t(bytes[4 * i + 2]) << 16 | uint32_t(bytes[4 * i + 3]) << 24;
+}
+
+// Inputs to one final compression; either a chunk's last block or a parent node.
+struct Output
+{
+    uint32_t cv[8];
+    uint32_t block[16];
+    uint64_t counter;
+    uint32_t block_len;
+    uint32_t flags;
+
+    void chaining_value(uint32_t out[8]) const
+    {
+        uint32_t full[16];
+        compress(cv, block, counter, block_len, flags, full);
+        std::memcpy(out, full, 8 * sizeof(uint32_t));
+    }
+
+    void root_bytes(uint8_t* out, size_t len) const
+    {
+        for (uint64_t block_counter = 0; len > 0; ++block_counter)
+        {
+            uint32_t words[16];
+            compress(cv, block, block_counter, block_len, flags | ROOT, words);
+            for (size_t i = 0; i < 16 && len > 0; ++i)
+                for (size_t b = 0; b < 4 && len > 0; ++b, --len)
+                    *out++ = static_cast<uint8_t>(words[i] >> (8 * b));
+        }
+    }
+};
+
+inline Output parent_output(const uint32_t left[8], const uint32_t right[8])
+{
+    Output o;
+    std::memcpy(o.cv, IV, sizeof(o.cv));
+    std::memcpy(o.block, left, 8 * sizeof(uint32_t));
+    std::memcpy(o.block + 8, right, 8 * sizeof(uint32_t));
+    o.counter   = 0;
+    o.block_len = BLOCK_LEN;
+    o.flags     = PARENT;
+    return o;
+}
+
+struct ChunkState
+{
+    uint32_t cv[8];
+    uint64_t chunk_counter;
+    uint8_t block[BLOCK_LEN];
+    size_t block_len;
+    size_t blocks_compressed;
+
+    explicit ChunkState(uint64_t counter = 0) : chunk_counter(counter), block{}, block_len(0), blocks_compressed(0)
+    {
+        std::memcpy(cv, IV, sizeof(cv));
+    }
+
+    size_t len() const { return BLOCK_LEN * blocks_compressed + block_len; }
+    uint32_t start_flag() const { return blocks_compressed == 0 ? CHUNK_START : 0; }
+
+    void update(const uint8_t* input, size_t n)
+    {
+        while (n > 0)
+        {
+            if (block_len == BLOCK_LEN)
+            {
+                uint32_t words[16], out[16];
+                load_block(block, words);
+                compress(cv, words, chunk_counter, BLOCK_LEN, start_flag(), out);
+                std::memcpy(cv, out, sizeof(cv));
+                ++blocks_compressed;
+                std::memset(block, 0, sizeof(block));
+                block_len = 0;
+            }
+            size_t take = std::min(BLOCK_LEN - block_len, n);
+            std::memcpy(block + block_len, input, take);
+            block_len += take;
+            input += take;
+            n -= take;
+        }
+    }
+
+    Output output() const
+    {
+        Output o;
+        std::memcpy(o.cv, cv, sizeof(cv));
+        load_block(block, o.block);
+        o.counter   = chunk_counter;
+        o.block_len = static_cast<uint32_t>(block_len);
+        o.flags     = start_flag() | CHUNK_END;
+        return o;
+    }
+};
+
+class Hasher
+{
+    ChunkState chunk;
+    uint32_t cv_stack[54][8]; // enough for 2^54 chunks
+    size_t cv_stack_len = 0;
+
+    void add_chunk_cv(uint32_t cv[8], uint64_t total_chunks)
+    {
+        // merge completed subtrees: one per trailing zero bit of the chunk count
+        while ((total_chunks & 1) == 0)
+        {
+            parent_output(cv_stack[--cv_stack_len], cv).chaining_value(cv);
+            total_chunks >>= 1;
+        }
+        std::memcpy(cv_stack[cv_stack_len++], cv, 8 * sizeof(uint32_t));
+    }
+
+public:
+    void reset() { *this = Hasher(); }
+
+    void update(const void* data, size_t n)
+    {
+        const uint8_t* input = static_cast<const uint8_t*>(data);
+        while (n > 0)
+        {
+            if (chunk.len() == CHUNK_LEN)
+            {
+                uint32_t cv[8];
+                chunk.output().chaining_value(cv);
+                uint64_t total_chunks = chunk.chunk_counter + 1;
+                add_chunk_cv(cv, total_chunks);
+                chunk = ChunkState(total_chunks);
+            }
+            size_t take = std::min(CHUNK_LEN - chunk.len(), n);
+            chunk.update(input, take);
+            input += take;
+            n -= take;
+        }
+    }
+
+    void finalize(uint8_t* out, size_t len) const
+    {
+        Output o = chunk.output();
+        for (size_t i = cv_stack_len; i > 0; --i)
+        {
+            uint32_t cv[8];
+            o.chaining_value(cv);
+            o = parent_output(cv_stack[i - 1], cv);
+        }
+        o.root_bytes(out, len);
+    }
+};
+
+} // namespace blake3
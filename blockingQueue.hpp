@@ -0,0 +1,148 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+// Current and highest depth of a queue, for statistics; only set by the queue, under its lock.
+struct QueueGauge
+{
+    std::atomic<uint64_t> depth{0};
+    std::atomic<uint64_t> peak{0};
+
+    void set(uint64_t d)
+    {
+        depth.store(d, std::memory_order_relaxed);
+        if (d > peak.load(std::memory_order_relaxed))
+            peak.store(d, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Unbounded multi-producer/multi-consumer queue.
+ * pop() blocks until an item is available or the queue is closed and drained.
+ * Items live in a ring that only grows (doubling): a std::deque of items as large as a pack job would allocate a
+ * node per push.
+ */
+template <typename T>
+class BlockingQueue
+{
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<T> ring;
+    size_t head       = 0; // index of the oldest item
+    size_t count      = 0;
+    bool closed       = false;
+    QueueGauge* gauge = nullptr;
+
+    void measure()
+    {
+        if (gauge)
+            gauge->set(count);
+    }
+
+    void append(T&& item)
+    {
+        if (count == ring.size())
+        {
+            std::vector<T> bigger(std::max<size_t>(16, 2 * ring.size()));
+            for (size_t i = 0; i < count; ++i)
+                bigger[i] = std::move(ring[(head + i) % ring.size()]);
+            ring = std::move(bigger);
+            head = 0;
+        }
+        ring[(head + count++) % ring.size()] = std::move(item);
+    }
+
+    T take_front()
+    {
+        T item = std::move(ring[head]);
+        head   = (head + 1) % ring.size();
+        --count;
+        return item;
+    }
+
+public:
+    // Keeps g up to date with the number of queued items from now on; null stops it.
+    void report_depth(QueueGauge* g)
+    {
+        std::lock_guard lock(m);
+        gauge = g;
+    }
+
+    void push(T item)
+    {
+        {
+            std::lock_guard lock(m);
+            append(std::move(item));
+            measure();
+        }
+        cv.notify_one();
+    }
+
+    std::optional<T> pop()
+    {
+        std::unique_lock lock(m);
+        cv.wait(lock, [&] { return closed || count > 0; });
+        if (count == 0)
+            return std::nullopt;
+        T item = take_front();
+        measure();
+        return item;
+    }
+
+    // Non-blocking pop: nullopt when nothing is queued right now.
+    std::optional<T> try_pop()
+    {
+        std::lock_guard lock(m);
+        if (count == 0)
+            return std::nullopt;
+        T item = take_front();
+        measure();
+        return item;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard lock(m);
+            closed = true;
+        }
+        cv.notify_all();
+    }
+};
+
+/**
+ * Caps the number of bytes held in memory by a pipeline.
+ * A request larger than the whole budget is admitted once nothing else is in flight.
+ */
+class ByteBudget
+{
+    std::mutex m;
+    std::condition_variable cv;
+    uint64_t limit;
+    uint64_t used = 0;
+
+public:
+    explicit ByteBudget(uint64_t limitBytes) : limit(limitBytes) {}
+
+    void acquire(uint64_t n)
+    {
+        std::unique_lock lock(m);
+        cv.wait(lock, [&] { return used == 0 || used + n <= limit; });
+        used += n;
+    }
+
+    void release(uint64_t n)
+    {
+        {
+            std::lock_guard lock(m);
+            used -= n;
+        }
+        cv.notify_all();
+    }
+};
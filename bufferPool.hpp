@@ -0,0 +1,97 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --- buffer pool ---
+// The pipelines move file data around in std::string buffers. Those kept by one thread (a worker's read buffer, a
+// decoder's scratch) are reused from file to file already; those handed between threads (a record's compressed bytes
+// from worker to writer, a file read ahead from loader to worker, a decoded file from decoder to write-behind) would
+// otherwise be allocated per file and freed once consumed, which for the large ones, served by mmap, also means a page
+// fault per 4 KiB on every file. A BufferPool takes them back with their capacity for the next file.
+
+// Capacity a pipeline's pool keeps at most.
+inline constexpr uint64_t POOL_BYTES = 256ull << 20;
+
+/**
+ * Sets buf's size to n for the caller to overwrite: the new bytes are left uninitialized where the standard library
+ * allows it (C++23 resize_and_overwrite), and zeroed otherwise. Growth is geometric either way.
+ * __cpp_lib_string_resize_and_overwrite is not defined under C++20, the default standard: only a C++23 build
+ * (-DCMAKE_CXX_STANDARD=23) skips the zero-fill, the default one gets the pooling but still zeroes on every growth.
+ * A buffer type that skips the fill under C++20 too would have to replace std::string in every codec and I/O
+ * interface. Pooled buffers are already mapped, so the fill is a memset without page faults.
+ */
+inline void resize_for_overwrite(std::string& buf, size_t n)
+{
+#ifdef __cpp_lib_string_resize_and_overwrite
+    buf.resize_and_overwrite(n, [](char*, size_t m) { return m; });
+#else
+    buf.resize(n);
+#endif
+}
+
+/**
+ * Released buffers kept for reuse, at most limit bytes of capacity in all; thread-safe. Only buffers of MIN_CAPACITY
+ * or more are kept: malloc recycles smaller blocks well by itself. take(n) hands out the smallest kept buffer that
+ * holds n bytes, else the largest (which grows, freeing its old storage), else a new one; emptied, in any case.
+ */
+class BufferPool
+{
+    static constexpr size_t MIN_CAPACITY = 64 << 10;
+
+    std::mutex m;
+    std::vector<std::string> free; // by capacity, ascending
+    uint64_t held = 0;             // capacity of the buffers in free
+    uint64_t limit;
+
+public:
+    explicit BufferPool(uint64_t limitBytes) : limit(limitBytes) {}
+
+    BufferPool(const BufferPool&)            = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    std::string take(size_t n)
+    {
+        if (n < MIN_CAPACITY)
+            return {};
+        std::lock_guard lock(m);
+        if (free.empty())
+            return {};
+        auto it = std::lower_bound(free.begin(), free.end(), n, [](const std::string& b, size_t k) { return b.capacity() < k; });
+        if (it == free.end())
+            --it;
+        std::string buf = std::move(*it);
+        free.erase(it);
+        held -= buf.capacity();
+        return buf;
+    }
+
+    // Keeps buf for a later take(), or frees it.
+    void give(std::string buf)
+    {
+        if (buf.capacity() < MIN_CAPACITY)
+            return;
+        buf.clear();
+        std::lock_guard lock(m);
+        if (held + buf.capacity() > limit)
+            return;
+        held += buf.capacity();
+        auto it = std::upper_bound(free.begin(), free.end(), buf.capacity(), [](size_t k, const std::string& b) { return k < b.capacity(); });
+        free.insert(it, std::move(buf));
+    }
+
+    // buf as a shared buffer that comes back to the pool once its last owner is gone; the pool must outlive them all.
+    std::shared_ptr<const std::string> share(std::string buf)
+    {
+        if (buf.capacity() < MIN_CAPACITY)
+            return std::make_shared<const std::string>(std::move(buf));
+        return {new std::string(std::move(buf)), [this](const std::string* p) {
+                    give(std::move(*const_cast<std::string*>(p)));
+                    delete p;
+                }};
+    }
+};
@@ -0,0 +1,244 @@
+#pragma once
+#include "zstdCtxWrapper.hpp"
+#ifdef ARCHIVETOOL_HAVE_LZ4
+#include "lz4CtxWrapper.hpp"
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// --- codecs ---
+// A record's tag names the codec of its payload, so one archive can mix them and the reader dispatches per record.
+// Solid blocks have no tag of their own: their payload is a zstd or LZ4 frame, told apart by the frame magic.
+// LZ4 support is compiled in when CMake finds liblz4 (ARCHIVETOOL_HAVE_LZ4).
+enum class Codec : uint8_t
+{
+    Store = 0, // "RAW0", the data as is
+    Zstd  = 1, // "ZSTD"
+    Lz4   = 2, // "LZ4F", one LZ4 frame
+};
+
+inline const char* codec_name(Codec c)
+{
+    switch (c)
+    {
+        case Codec::Store: return "store";
+        case Codec::Zstd: return "zstd";
+        case Codec::Lz4: return "lz4";
+    }
+    return "unknown";
+}
+
+inline std::optional<Codec> codec_from_name(std::string_view name)
+{
+    for (Codec c : {Codec::Store, Codec::Zstd, Codec::Lz4})
+        if (name == codec_name(c))
+            return c;
+    return std::nullopt;
+}
+
+inline bool codec_available(Codec c)
+{
+#ifdef ARCHIVETOOL_HAVE_LZ4
+    (void)c;
+    return true;
+#else
+    return c != Codec::Lz4;
+#endif
+}
+
+// The 4-byte record tag.
+inline const char* record_tag(Codec c)
+{
+    switch (c)
+    {
+        case Codec::Store: return "RAW0";
+        case Codec::Zstd: return "ZSTD";
+        case Codec::Lz4: return "LZ4F";
+    }
+    throw std::logic_error("bad codec");
+}
+
+inline Codec codec_of_tag(const char* tag)
+{
+    for (Codec c : {Codec::Zstd, Codec::Store, Codec::Lz4})
+        if (std::memcmp(tag, record_tag(c), 4) == 0)
+            return c;
+    throw std::runtime_error("unknown record type " + std::string(tag, 4));
+}
+
+// Codec of a solid block payload, from the frame magic number.
+inline Codec codec_of_frame(const char* frame, size_t size)
+{
+    static constexpr unsigned char lz4_magic[4] = {0x04, 0x22, 0x4D, 0x18};
+    return size >= 4 && std::memcmp(frame, lz4_magic, 4) == 0 ? Codec::Lz4 : Codec::Zstd;
+}
+
+/**
+ * Decompress one whole LZ4 frame of exactly size bytes, with a decompression context kept per thread.
+ */
+inline void lz4_decompress(const char* src, size_t csize, char* dst, size_t size)
+{
+#ifdef ARCHIVETOOL_HAVE_LZ4
+    static thread_local Lz4Ctx ctx{Lz4Ctx::Mode::Decompress};
+    ctx.decompress(src, csize, dst, size);
+#else
+    (void)src, (void)csize, (void)dst, (void)size;
+    throw std::runtime_error("archive uses lz4, but this build has no LZ4 support");
+#endif
+}
+
+// --- compressor ---
+// One thread's compression state for the archive codec: whole frames with compress(), or one frame streamed
+// piecewise with begin(), update()* and end(). Output goes to a sink(const char*, size_t); buf is scratch.
+// fast picks the cheapest setting (zstd level 1, LZ4 fast mode) for data that barely compresses.
+class Compressor
+{
+    Codec kind;
+    ZstdCtx zstd;
+#ifdef ARCHIVETOOL_HAVE_LZ4
+    Lz4Ctx lz4;
+#endif
+
+public:
+    // level 0 picks the codec default (zstd 6, LZ4 fast mode); long_range: zstd with a 128 MB window and long-distance matching.
+    Compressor(Codec codec, int level, bool long_range, int workers = 0)
+        : kind(codec)
+        , zstd(ZstdCtx::Mode::Compress, codec == Codec::Zstd && level != 0 ? level : 6, workers)
+#ifdef ARCHIVETOOL_HAVE_LZ4
+        , lz4(Lz4Ctx::Mode::Compress, codec == Codec::Lz4 ? level : 0)
+#endif
+    {
+        if (!codec_available(codec))
+            throw std::runtime_error(std::string("this build has no ") + codec_name(codec) + " support");
+        if (long_range)
+            zstd.enable_long_range();
+    }
+
+    Codec codec() const { return kind; }
+
+    // The zstd context underneath, e.g. for tuning or dictionary compression; only meaningful for Codec::Zstd.
+    const ZstdCtx& zstd_ctx() const { return zstd; }
+
+    void compress(const char* src, size_t size, std::string& dst, bool fast = false, const ZSTD_CDict* dict = nullptr)
+    {
+        switch (kind)
+        {
+            case Codec::Store: dst.assign(src, size); return;
+            case Codec::Zstd:
+                zstd.set_level(fast ? 1 : zstd.default_level());
+                zstd.compress(src, size, dst, dict);
+                return;
+            case Codec::Lz4:
+#ifdef ARCHIVETOOL_HAVE_LZ4
+                lz4.set_level(fast ? 0 : lz4.default_level());
+                lz4.compress(src, size, dst);
+#endif
+                return;
+        }
+    }
+
+    // zstd only: a frame compressed against prefix, see ZstdCtx::compress_with_prefix().
+    void compress_with_prefix(const char* src, size_t size, std::string& dst, bool fast, const std::string& prefix)
+    {
+        zstd.set_level(fast ? 1 : zstd.default_level());
+        zstd.compress_with_prefix(src, size, dst, prefix.data(), prefix.size());
+    }
+
+    template <typename Sink>
+    void begin(bool fast, std::string& buf, Sink sink)
+    {
+        if (kind == Codec::Zstd)
+        {
+            ZSTD_CCtx_reset(zstd.compressor(), ZSTD_reset_session_only);
+            zstd.set_level(fast ? 1 : zstd.default_level());
+            buf.resize(ZSTD_CStreamOutSize());
+        }
+#ifdef ARCHIVETOOL_HAVE_LZ4
+        if (kind == Codec::Lz4)
+        {
+            lz4.set_level(fast ? 0 : lz4.default_level());
+            buf.resize(LZ4F_HEADER_SIZE_MAX);
+            sink(buf.data(), Lz4Ctx::check(LZ4F_compressBegin(lz4.compressor(), buf.data(), buf.size(), &lz4.preferences())));
+        }
+#endif
+    }
+
+    template <typename Sink>
+    void update(const char* src, size_t size, std::string& buf, Sink sink)
+    {
+        if (kind == Codec::Store)
+            return sink(src, size);
+        if (kind == Codec::Zstd)
+            return zstd_stream(src, size, ZSTD_e_continue, buf, sink);
+#ifdef ARCHIVETOOL_HAVE_LZ4
+        buf.resize(LZ4F_compressBound(size, &lz4.preferences()));
+        sink(buf.data(), Lz4Ctx::check(LZ4F_compressUpdate(lz4.compressor(), buf.data(), buf.size(), src, size, nullptr)));
+#endif
+    }
+
+    template <typename Sink>
+    void end(std::string& buf, Sink sink)
+    {
+        if (kind == Codec::Zstd)
+            return zstd_stream(nullptr, 0, ZSTD_e_end, buf, sink);
+#ifdef ARCHIVETOOL_HAVE_LZ4
+        if (kind == Codec::Lz4)
+        {
+            buf.resize(LZ4F_compressBound(0, &lz4.preferences()));
+            sink(buf.data(), Lz4Ctx::check(LZ4F_compressEnd(lz4.compressor(), buf.data(), buf.size(), nullptr)));
+        }
+#endif
+    }
+
+private:
+    template <typename Sink>
+    void zstd_stream(const char* src, size_t size, ZSTD_EndDirective mode, std::string& buf, Sink sink)
+    {
+        ZSTD_inBuffer in{src, size, 0};
+        bool finished = false;
+        while (!finished)
+        {
+            ZSTD_outBuffer out{buf.data(), buf.size(), 0};
+            size_t remaining = ZSTD_compressStream2(zstd.compressor(), &out, &in, mode);
+            if (ZSTD_isError(remaining))
+                throw std::runtime_error(std::string("ZSTD compression error: ") + ZSTD_getErrorName(remaining));
+            sink(buf.data(), out.pos);
+            finished = mode == ZSTD_e_end ? remaining == 0 : in.pos == in.size;
+        }
+    }
+};
+
+/**
+ * Streaming decode of one LZ4 frame fed in consecutive pieces (first = the piece holding the frame header).
+ * Decoded bytes go to sink(const char*, size_t); returns true once the frame is complete.
+ */
+template <typename Sink>
+inline bool lz4_decompress_part(const char* src, size_t size, bool first, std::string& buf, Sink sink)
+{
+#ifdef ARCHIVETOOL_HAVE_LZ4
+    static thread_local Lz4Ctx ctx{Lz4Ctx::Mode::Decompress};
+    if (first)
+        LZ4F_resetDecompressionContext(ctx.decompressor());
+    buf.resize(1 << 20);
+    size_t hint = 1;
+    do
+    {
+        size_t in = size, out = buf.size();
+        hint      = Lz4Ctx::check(LZ4F_decompress(ctx.decompressor(), buf.data(), &out, src, &in, nullptr));
+        sink(buf.data(), out);
+        src += in;
+        size -= in;
+        if (in == 0 && out == 0)
+            break;
+    } while (hint != 0);
+    return hint == 0;
+#else
+    (void)src, (void)size, (void)first, (void)buf, (void)sink;
+    throw std::runtime_error("archive uses lz4, but this build has no LZ4 support");
+#endif
+}
@@ -0,0 +1,177 @@
+#pragma once
+#include "blake3.hpp"
+#include "xxh3.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/**
+ * 128-bit content digest: the dedup key of every blob.
+ * Archives written before the digest widening used 64-bit FNV-1a; those hashes load as {hi = 0, lo = fnv}.
+ */
+struct Digest
+{
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    bool operator==(const Digest&) const = default;
+    auto operator<=>(const Digest&) const = default;
+
+    std::string hex() const
+    {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string s(32, '0');
+        for (int i = 0; i < 16; ++i)
+        {
+            s[15 - i] = digits[(hi >> (4 * i)) & 0xF];
+            s[31 - i] = digits[(lo >> (4 * i)) & 0xF];
+        }
+        return s;
+    }
+
+    static Digest from_hex(std::string_view s)
+    {
+        if (s.size() != 32)
+            throw std::runtime_error("bad digest: " + std::string(s));
+        Digest d;
+        for (size_t i = 0; i < 32; ++i)
+        {
+            char c = s[i];
+            uint64_t v;
+            if (c >= '0' && c <= '9')
+                v = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                v = c - 'a' + 10;
+            else
+                throw std::runtime_error("bad digest: " + std::string(s));
+            uint64_t& half = i < 16 ? d.hi : d.lo;
+            half           = (half << 4) | v;
+        }
+        return d;
+    }
+
+    static Digest from_u64(uint64_t v) { return {0, v}; }
+};
+
+template <>
+struct std::hash<Digest>
+{
+    size_t operator()(const Digest& d) const noexcept { return static_cast<size_t>(d.lo ^ (d.hi * 0x9E3779B97F4A7C15ull)); }
+};
+
+enum class HashAlgo : uint8_t
+{
+    Fnv1a64 = 0, // legacy archives only, never written
+    Xxh3    = 1, // XXH3-128, default
+    Blake3  = 2, // BLAKE3 truncated to 128 bits
+};
+
+inline const char* hash_algo_name(HashAlgo a)
+{
+    switch (a)
+    {
+        case HashAlgo::Fnv1a64: return "fnv1a64";
+        case HashAlgo::Xxh3: return "xxh3";
+        case HashAlgo::Blake3: return "blake3";
+    }
+    return "unknown";
+}
+
+inline Digest digest_from_blake3(const uint8_t out[16])
+{
+    Digest d;
+    for (int i = 0; i < 8; ++i)
+    {
+        d.hi = (d.hi << 8) | out[i];
+        d.lo = (d.lo << 8) | out[i + 8];
+    }
+    return d;
+}
+
+/**
+ * Incremental content hasher for the selected algorithm.
+ */
+class ContentHasher
+{
+    HashAlgo algo;
+    xxh3::State xxh;
+    blake3::Hasher b3;
+
+public:
+    explicit ContentHasher(HashAlgo a = HashAlgo::Xxh3) : algo(a)
+    {
+        if (a == HashAlgo::Fnv1a64)
+            throw std::invalid_argument("fnv1a64 is only read from legacy archives");
+    }
+
+    void reset()
+    {
+        if (algo == HashAlgo::Xxh3)
+            xxh.reset();
+        else
+            b3.reset();
+    }
+
+    void update(const char* data, size_t size)
+    {
+        if (algo == HashAlgo::Xxh3)
+            xxh.update(data, size);
+        else
+            b3.update(data, size);
+    }
+
+    Digest digest() const
+    {
+        if (algo == HashAlgo::Xxh3)
+        {
+            xxh3::Hash128 h = xxh.digest();
+            return {h.high64, h.low64};
+        }
+        uint8_t out[16];
+        b3.finalize(out, sizeof(out));
+        return digest_from_blake3(out);
+    }
+};
+
+/**
+ * One-shot digest of a memory buffer.
+ */
+inline Digest hash_bytes(HashAlgo algo, const char* data, size_t size)
+{
+    if (algo == HashAlgo::Xxh3)
+    {
+        xxh3::Hash128 h = xxh3::hash128(data, size);
+        return {h.high64, h.low64};
+    }
+    ContentHasher h(algo);
+    h.update(data, size);
+    return h.digest();
+}
+
+inline Digest hash_bytes(HashAlgo algo, const std::string& data) { return hash_bytes(algo, data.data(), data.size()); }
+
+/**
+ * Load file contents into provided buffer.
+ * The buffer is resized automatically and can be reused.
+ */
+inline void load_file(const std::filesystem::path& path, std::string& buffer)
+{
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    if (!ifs)
+        throw std::runtime_error("Failed to open file: " + path.string());
+
+    std::streamsize size = ifs.tellg();
+    ifs.seekg(0, std::ios::beg);
+
+    buffer.resize(static_cast<size_t>(size));
+    if (size > 0)
+    {
+        if (!ifs.read(buffer.data(), size))
+            throw std::runtime_error("Failed to read file: " + path.string());
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+/**
+ * CRC-32C (Castagnoli), as used by iSCSI, ext4 and SSE4.2's crc32 instruction.
+ * Incremental: crc32c(b, m, crc32c(a, n)) is the CRC of a followed by b.
+ * On x86-64 the crc32 instruction is used whenever the CPU has it (checked at run time, unlike the hashes: the
+ * table fallback is three times slower, which would show on every stored record), on ARM when the target has the
+ * CRC extension. Three independent streams are interleaved to hide the instruction's latency, and joined by
+ * shifting the earlier ones' CRCs over the later ones. Elsewhere slicing-by-8 tables are used.
+ */
+namespace crc32c_detail {
+
+inline constexpr uint32_t POLY = 0x82F63B78u; // reflected
+inline constexpr size_t LANE   = 4096;        // bytes per stream when three are interleaved
+
+inline constexpr std::array<std::array<uint32_t, 256>, 8> make_tables()
+{
+    std::array<std::array<uint32_t, 256>, 8> t{};
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+            c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+        t[0][i] = c;
+    }
+    for (size_t s = 1; s < 8; ++s)
+        for (uint32_t i = 0; i < 256; ++i)
+            t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+    return t;
+}
+
+inline constexpr auto TABLES = make_tables();
+
+// The (linear) effect of LANE zero bytes on a CRC register, one table per register byte.
+inline constexpr std::array<std::array<uint32_t, 256>, 4> make_shift()
+{
+    std::array<uint32_t, 32> bit{};
+    for (int i = 0; i < 32; ++i)
+    {
+        uint32_t c = 1u << i;
+        for (size_t k = 0; k < LANE; ++k)
+            c = (c >> 8) ^ TABLES[0][c & 0xFF];
+        bit[i] = c;
+    }
+    std::array<std::array<uint32_t, 256>, 4> t{};
+    for (int k = 0; k < 4; ++k)
+        for (uint32_t b = 0; b < 256; ++b)
+            for (int i = 0; i < 8; ++i)
+                if (b >> i & 1)
+                    t[k][b] ^= bit[8 * k + i];
+    return t;
+}
+
+inline constexpr auto SHIFT = make_shift();
+
+inline uint32_t shift(uint32_t c) { return SHIFT[0][c & 0xFF] ^ SHIFT[1][(c >> 8) & 0xFF] ^ SHIFT[2][(c >> 16) & 0xFF] ^ SHIFT[3][c >> 24]; }
+
+// On the CRC register (before and after the inversion the public function applies).
+inline uint32_t sw(const unsigned char* p, size_t n, uint32_t crc)
+{
+    for (; n >= 8; p += 8, n -= 8)
+    {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24);
+        crc         = TABLES[7][lo & 0xFF] ^ TABLES[6][(lo >> 8) & 0xFF] ^ TABLES[5][(lo >> 16) & 0xFF] ^ TABLES[4][lo >> 24] ^
+              TABLES[3][p[4]] ^ TABLES[2][p[5]] ^ TABLES[1][p[6]] ^ TABLES[0][p[7]];
+    }
+    for (; n > 0; ++p, --n)
+        crc = (crc >> 8) ^ TABLES[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(__ARM_FEATURE_CRC32)
+#if defined(__x86_64__)
+inline bool hw_available()
+{
+    static const bool has = __builtin_cpu_supports("sse4.2");
+    return has;
+}
+#define CRC32C_HW_TARGET __attribute__((target("sse4.2")))
+#define CRC32C_STEP64(c, v) _mm_crc32_u64(c, v)
+#define CRC32C_STEP8(c, v) _mm_crc32_u8(c, v)
+#else
+inline bool hw_available() { return true; }
+#define CRC32C_HW_TARGET
+#define CRC32C_STEP64(c, v) __crc32cd(static_cast<uint32_t>(c), v)
+#define CRC32C_STEP8(c, v) __crc32cb(c, v)
+#endif
+
+CRC32C_HW_TARGET inline uint32_t hw(const unsigned char* p, size_t n, uint32_t crc)
+{
+    auto load = [](const unsigned char* q) {
+        uint64_t v;
+        std::memcpy(&v, q, 8);
+        return v;
+    };
+    uint64_t c0 = crc;
+    for (; n >= 3 * LANE; p += 3 * LANE, n -= 3 * LANE)
+    {
+        uint64_t c1 = 0, c2 = 0;
+        for (size_t k = 0; k < LANE; k += 8)
+        {
+            c0 = CRC32C_STEP64(c0, load(p + k));
+            c1 = CRC32C_STEP64(c1, load(p + LANE + k));
+            c2 = CRC32C_STEP64(c2, load(p + 2 * LANE + k));
+        }
+        c0 = shift(shift(static_cast<uint32_t>(c0)) ^ static_cast<uint32_t>(c1)) ^ static_cast<uint32_t>(c2);
+    }
+    for (; n >= 8; p += 8, n -= 8)
+        c0 = CRC32C_STEP64(c0, load(p));
+    uint32_t c = static_cast<uint32_t>(c0);
+    for (; n > 0; ++p, --n)
+        c = CRC32C_STEP8(c, *p);
+    return c;
+}
+
+#undef CRC32C_HW_TARGET
+#undef CRC32C_STEP64
+#undef CRC32C_STEP8
+#define CRC32C_HAVE_HW
+#endif
+
+} // namespace crc32c_detail
+
+inline uint32_t crc32c(const void* data, size_t n, uint32_t crc = 0)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+#ifdef CRC32C_HAVE_HW
+    if (crc32c_detail::hw_available())
+        return ~crc32c_detail::hw(p, n, ~crc);
+#endif
+    return ~crc32c_detail::sw(p, n, ~crc);
+}
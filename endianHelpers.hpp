@@ -1,7 +1,10 @@
+#pragma once
 #include <bit>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
 
 // --- Write any integer (LE) ---
@@ -46,3 +49,72 @@ inline T readLE(std::ifstream& ifs)
 
     return value;
 }
+
+// --- Decode any integer (LE) from a byte buffer ---
+template <typename T>
+inline T loadLE(const char* p)
+{
+    static_assert(std::is_integral_v<T>, "loadLE requires an integer type");
+
+    T value{};
+    if constexpr (std::endian::native == std::endian::big)
+    {
+        for (size_t i = 0; i < sizeof(T); ++i)
+            value |= static_cast<T>(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    else
+    {
+        std::memcpy(&value, p, sizeof(T));
+    }
+
+    return value;
+}
+
+// --- Unsigned LEB128 varints ---
+inline void appendVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+// Advances p; throws on overrun or an over-long encoding.
+inline uint64_t readVarint(const char*& p, const char* end)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (p == end)
+            throw std::runtime_error("truncated varint");
+        auto byte = static_cast<unsigned char>(*p++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+    throw std::runtime_error("bad varint");
+}
+
+// Zigzag mapping for signed deltas, so small negative values stay short varints.
+inline uint64_t zigzag(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); }
+inline int64_t unzigzag(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+
+// --- Encode any integer (LE) into a byte buffer ---
+template <typename T>
+inline void storeLE(char* p, T value)
+{
+    static_assert(std::is_integral_v<T>, "storeLE requires an integer type");
+    for (size_t i = 0; i < sizeof(T); ++i)
+        p[i] = static_cast<char>((static_cast<std::make_unsigned_t<T>>(value) >> (8 * i)) & 0xFF);
+}
+
+// --- Append any integer (LE) to a byte buffer ---
+template <typename T>
+inline void appendLE(std::string& out, T value)
+{
+    static_assert(std::is_integral_v<T>, "appendLE requires an integer type");
+    for (size_t i = 0; i < sizeof(T); ++i)
+        out.push_back(static_cast<char>((static_cast<std::make_unsigned_t<T>>(value) >> (8 * i)) & 0xFF));
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+// 256 random 64-bit values, generated with splitmix64 so the table (and every cut point) is the same on all platforms.
+constexpr std::array<uint64_t, 256> make_gear_table(int shift)
+{
+    std::array<uint64_t, 256> t{};
+    uint64_t x = 0x243F6A8885A308D3ull;
+    for (auto& v : t)
+    {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+        z          = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z          = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        v          = (z ^ (z >> 31)) << shift;
+    }
+    return t;
+}
+
+inline constexpr std::array<uint64_t, 256> GEAR    = make_gear_table(0);
+inline constexpr std::array<uint64_t, 256> GEAR_LS = make_gear_table(1); // GEAR << 1, for the two-byte roll
+
+struct CdcParams
+{
+    uint32_t min = 16 << 10;
+    uint32_t avg = 64 << 10;
+    uint32_t max = 256 << 10;
+};
+
+/**
+ * FastCDC content-defined chunker (Xia et al., "FastCDC", USENIX ATC'16 / TPDS'20).
+ *
+ * Cut points depend only on the bytes around them, so an insertion early in a file shifts
+ * the following chunks instead of changing all of them. Uses normalized chunking (a stricter
+ * mask before the average size, a looser one after) and rolls two bytes per iteration.
+ */
+class FastCdc
+{
+public:
+    using Params = CdcParams;
+
+private:
+    // The high bits of the gear hash depend on the last 64 bytes, the low bits only on the last few: mask near the top,
+    // leaving bit 63 out so the mask survives the one-bit shift of the two-byte roll.
+    static constexpr uint64_t high_bits(unsigned n) { return ((1ull << n) - 1) << (63 - n); }
+
+    Params p;
+    uint64_t mask_s, mask_l;       // before / after the average size
+    uint64_t mask_s_ls, mask_l_ls; // the same, shifted for the odd byte of each pair
+
+public:
+    explicit FastCdc(Params params = {}) : p(params)
+    {
+        if (p.min == 0 || p.min > p.avg || p.avg > p.max || p.avg < 64 || !std::has_single_bit(p.avg))
+            throw std::invalid_argument("chunk sizes must satisfy 0 < min <= avg <= max with avg a power of two >= 64");
+        unsigned bits = std::countr_zero(p.avg);
+        mask_s        = high_bits(bits + 1);
+        mask_l        = high_bits(bits - 1);
+        mask_s_ls     = mask_s << 1;
+        mask_l_ls     = mask_l << 1;
+    }
+
+    const Params& params() const { return p; }
+
+    /**
+     * Length of the chunk starting at data. Returns n when the input ends before a cut point is found,
+     * so callers streaming a file must supply at least params().max bytes until the last chunk.
+     */
+    size_t cut(const unsigned char* data, size_t n) const
+    {
+        if (n <= p.min)
+            return n;
+        size_t end    = n < p.max ? n : p.max;
+        size_t normal = n < p.avg ? n : p.avg;
+
+        uint64_t fp = 0;
+        size_t i    = p.min;
+        // Each step advances the hash by two bytes: fp' = (fp << 2) + (G[a] << 1) + G[b]; the intermediate
+        // value (fp << 1) + G[a] is checked through the shifted mask, so the cuts match a byte-at-a-time roll.
+        for (; i + 1 < normal; i += 2)
+        {
+            fp = (fp << 2) + GEAR_LS[data[i]];
+            if (!(fp & mask_s_ls))
+                return i + 1;
+            fp += GEAR[data[i + 1]];
+            if (!(fp & mask_s))
+                return i + 2;
+        }
+        for (; i + 1 < end; i += 2)
+        {
+            fp = (fp << 2) + GEAR_LS[data[i]];
+            if (!(fp & mask_l_ls))
+                return i + 1;
+            fp += GEAR[data[i + 1]];
+            if (!(fp & mask_l))
+                return i + 2;
+        }
+        return end;
+    }
+
+    size_t cut(const char* data, size_t n) const { return cut(reinterpret_cast<const unsigned char*>(data), n); }
+};
@@ -0,0 +1,142 @@
+#pragma once
+#include "contentHash.hpp"
+#include "endianHelpers.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// --- persistent hash cache ---
+// Digests of the files packed last time, keyed by (device, inode), valid while size and mtime_ns still match.
+// With it an unchanged file costs a stat instead of a full read and hash, at least when its content is already
+// in the archive (a duplicate, or in the --base archive); otherwise it's still read to be compressed, but not hashed.
+//
+// Layout (little-endian): "HCA1" algo(u8) pad(3) count(u64) {dev inode size mtime_ns hi lo csize}* sorted by (dev, inode)
+// The table is mapped read-only and binary-searched in place, so opening it costs nothing however large it is.
+// save() writes the entries recorded during this pack to a temporary file and renames it over the old table.
+class HashCache
+{
+public:
+    struct Entry
+    {
+        uint64_t dev, inode, size, mtime_ns;
+        Digest hash;
+        uint64_t csize; // compressed size of the file's own record, 0 when it has none (shared, solid or in the base)
+    };
+
+private:
+    static constexpr size_t HEAD_SIZE  = 16;
+    static constexpr size_t ENTRY_SIZE = 7 * sizeof(uint64_t);
+
+    fs::path path;
+    HashAlgo algo;
+    int fd            = -1;
+    const char* map   = nullptr;
+    uint64_t map_size = 0;
+    uint64_t count    = 0;
+    std::vector<Entry> fresh; // recorded during this pack
+
+    Entry at(uint64_t i) const
+    {
+        const char* p = map + HEAD_SIZE + i * ENTRY_SIZE;
+        return {loadLE<uint64_t>(p), loadLE<uint64_t>(p + 8), loadLE<uint64_t>(p + 16), loadLE<uint64_t>(p + 24),
+                {loadLE<uint64_t>(p + 32), loadLE<uint64_t>(p + 40)}, loadLE<uint64_t>(p + 48)};
+    }
+
+public:
+    // A missing, unreadable or foreign table (other hash algorithm) is treated as empty and replaced on save().
+    HashCache(const fs::path& file, HashAlgo hash_algo) : path(file), algo(hash_algo)
+    {
+        fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < HEAD_SIZE)
+            return;
+        map_size = static_cast<uint64_t>(st.st_size);
+        void* p  = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            return;
+        map = static_cast<const char*>(p);
+
+        uint64_t n = loadLE<uint64_t>(map + 8);
+        if (std::memcmp(map, "HCA1", 4) != 0 || static_cast<HashAlgo>(map[4]) != algo || n > (map_size - HEAD_SIZE) / ENTRY_SIZE)
+            return;
+        count = n;
+        ::madvise(const_cast<char*>(map), map_size, MADV_RANDOM);
+    }
+
+    HashCache(const HashCache&)            = delete;
+    HashCache& operator=(const HashCache&) = delete;
+
+    ~HashCache()
+    {
+        if (map)
+            ::munmap(const_cast<char*>(map), map_size);
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    std::optional<Entry> find(uint64_t dev, uint64_t inode, uint64_t size, uint64_t mtime_ns) const
+    {
+        uint64_t lo = 0, hi = count;
+        while (lo < hi)
+        {
+            uint64_t mid = lo + (hi - lo) / 2;
+            Entry e      = at(mid);
+            if (std::tie(e.dev, e.inode) < std::tie(dev, inode))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == count)
+            return std::nullopt;
+        Entry e = at(lo);
+        if (e.dev != dev || e.inode != inode || e.size != size || e.mtime_ns != mtime_ns)
+            return std::nullopt;
+        return e;
+    }
+
+    // Single-threaded (the pack writer thread).
+    void record(const Entry& e) { fresh.push_back(e); }
+
+    void save()
+    {
+        std::sort(fresh.begin(), fresh.end(), [](auto& a, auto& b) { return std::tie(a.dev, a.inode) < std::tie(b.dev, b.inode); });
+        fresh.erase(std::unique(fresh.begin(), fresh.end(), [](auto& a, auto& b) { return a.dev == b.dev && a.inode == b.inode; }), fresh.end());
+
+        std::string out = "HCA1";
+        out.push_back(static_cast<char>(algo));
+        out.append(3, '\0');
+        appendLE<uint64_t>(out, fresh.size());
+        out.reserve(HEAD_SIZE + fresh.size() * ENTRY_SIZE);
+        for (auto& e : fresh)
+        {
+            for (uint64_t v : {e.dev, e.inode, e.size, e.mtime_ns, e.hash.hi, e.hash.lo, e.csize})
+                appendLE(out, v);
+        }
+
+        fs::path tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+            ofs.write(out.data(), out.size());
+            ofs.close();
+            if (!ofs)
+                throw std::runtime_error("Failed to write hash cache: " + tmp.string());
+        }
+        fs::rename(tmp, path);
+    }
+};
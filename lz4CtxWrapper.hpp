@@ -0,0 +1,109 @@
+#pragma once
+#include "bufferPool.hpp"
+
+#include <stdexcept>
+#include <string>
+#include <lz4frame.h>
+
+// LZ4 counterpart of ZstdCtx: one LZ4 frame per record (linked 1 MB blocks, content checksum), so any record
+// decodes with LZ4F_decompress alone. Like ZstdCtx a context belongs to one thread at a time.
+class Lz4Ctx
+{
+public:
+    enum class Mode
+    {
+        Compress,
+        Decompress
+    };
+
+private:
+    Mode mode;
+    int level       = 0; // compression level the context was created with
+    LZ4F_cctx* cctx = nullptr;
+    LZ4F_dctx* dctx = nullptr;
+    LZ4F_preferences_t prefs{}; // all zero = library defaults
+
+public:
+    explicit Lz4Ctx(Mode m, int compressionLevel = 0) : mode(m), level(compressionLevel)
+    {
+        prefs.frameInfo.blockSizeID         = LZ4F_max1MB;
+        prefs.frameInfo.blockMode           = LZ4F_blockLinked;
+        prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled; // integrity check per frame
+        prefs.compressionLevel              = compressionLevel;            // 0 = fast, 3..12 = HC
+
+        size_t r = mode == Mode::Compress ? LZ4F_createCompressionContext(&cctx, LZ4F_VERSION) : LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+        if (LZ4F_isError(r))
+            throw std::runtime_error("Failed to create LZ4F context");
+    }
+
+    Lz4Ctx(const Lz4Ctx&)            = delete;
+    Lz4Ctx& operator=(const Lz4Ctx&) = delete;
+
+    ~Lz4Ctx()
+    {
+        LZ4F_freeCompressionContext(cctx);
+        LZ4F_freeDecompressionContext(dctx);
+    }
+
+    static size_t check(size_t r)
+    {
+        if (LZ4F_isError(r))
+            throw std::runtime_error(std::string("LZ4 error: ") + LZ4F_getErrorName(r));
+        return r;
+    }
+
+    LZ4F_cctx* compressor() const
+    {
+        if (mode != Mode::Compress)
+            throw std::logic_error("Not a compression context");
+        return cctx;
+    }
+
+    LZ4F_dctx* decompressor() const
+    {
+        if (mode != Mode::Decompress)
+            throw std::logic_error("Not a decompression context");
+        return dctx;
+    }
+
+    // Level for the frames compressed from now on, as with ZstdCtx.
+    void set_level(int l) { prefs.compressionLevel = l; }
+    int default_level() const { return level; }
+
+    // Frame preferences for streaming through compressor(); content size unknown.
+    const LZ4F_preferences_t& preferences() const { return prefs; }
+
+    /**
+     * Compress src as one frame into dst. dst is resized to the frame size and can be reused.
+     */
+    void compress(const char* src, size_t size, std::string& dst) const
+    {
+        LZ4F_preferences_t p    = prefs;
+        p.frameInfo.contentSize = size;
+        resize_for_overwrite(dst, LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound(size, &p));
+        size_t n = check(LZ4F_compressBegin(compressor(), dst.data(), dst.size(), &p));
+        n += check(LZ4F_compressUpdate(cctx, dst.data() + n, dst.size() - n, src, size, nullptr));
+        n += check(LZ4F_compressEnd(cctx, dst.data() + n, dst.size() - n, nullptr));
+        dst.resize(n);
+    }
+
+    /**
+     * Decompress one whole frame of exactly size bytes into dst.
+     */
+    void decompress(const char* src, size_t csize, char* dst, size_t size) const
+    {
+        LZ4F_resetDecompressionContext(decompressor());
+        size_t in = 0, out = 0, hint = 1;
+        while (hint != 0 && (in < csize || out < size))
+        {
+            size_t src_size = csize - in, dst_size = size - out;
+            hint = check(LZ4F_decompress(dctx, dst + out, &dst_size, src + in, &src_size, nullptr));
+            if (src_size == 0 && dst_size == 0)
+                break;
+            in += src_size;
+            out += dst_size;
+        }
+        if (hint != 0 || out != size)
+            throw std::runtime_error("truncated lz4 frame");
+    }
+};
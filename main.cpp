@@ -1,40 +1,464 @@
 #include "archiver.hpp"
+#include "benchmark.hpp"
+#include "packPipeline.hpp"
+#include "streamUnpack.hpp"
+#include "unpackPipeline.hpp"
+#include <cstdio>
 #include <iostream>
 
-int main(int argc, char** argv)
+static void usage()
+{
+    std::cout << "Usage:\n"
+              << "  pack <folder> <archive> [options]\n"
+              << "      <archive> - writes the archive to stdout, in the stream layout (notes go to stderr)\n"
+              << "      -j <threads>              hashing/compression threads (default: all cores)\n"
+              << "      --max-inflight-mb <n>     memory budget for file data between read and write (default: 1024)\n"
+              << "      --stream-threshold-mb <n> stream files above this size through fixed buffers (default: 64)\n"
+              << "      --deterministic           byte-identical output regardless of thread count\n"
+              << "      --chunk                   deduplicate content-defined chunks (FastCDC) instead of whole files\n"
+              << "      --chunk-sizes <min,avg,max>  chunk sizes in KiB, avg a power of two (default: 16,64,256)\n"
+              << "      --hash <xxh3|blake3>      content digest used for deduplication (default: xxh3)\n"
+              << "      --verify                  byte-compare every deduplicated file or chunk with its first copy\n"
+              << "      --dict                    train a zstd dictionary for small files and compress them with it\n"
+              << "      --dict-size-kb <n>        dictionary size in KiB (default: 112)\n"
+              << "      --solid                   compress small files together in shared blocks, grouped by extension\n"
+              << "      --solid-block-mb <n>      solid block size in MiB, 4-64 (default: 16)\n"
+              << "      --base <archive>          incremental: skip unchanged files, store only new content, chain to archive\n"
+              << "      --hash-cache <file>       reuse digests of unchanged files (by device, inode, size, mtime) and update file\n"
+              << "      --codec <zstd|lz4|store>  record codec; lz4 only when built with liblz4 (default: zstd)\n"
+              << "      --level <n>               codec level: zstd 1-22 (default: 6), lz4 0 = fast, 3-12 = HC (default: 0)\n"
+              << "      --long                    zstd long-distance matching over a 128 MB window (more memory, better ratio)\n"
+              << "      --similar                 compress large files against an earlier file of the same name up to digits (zstd)\n"
+              << "      --io <sync|threads|uring> how files are read: inline, by a thread pool, or through io_uring (default: sync)\n"
+              << "      --io-depth <n>            files in flight (threads in the pool) for --io threads|uring (default: 32)\n"
+              << "      --streamable              use the stream layout in a file too, so that it can be unpacked from a pipe\n"
+              << "      --xattrs                  also record extended attributes (restored where permitted)\n"
+              << "      --raw-manifest            store the directory manifest uncompressed\n"
+              << "      --dump-json               print the directory manifest as JSON\n"
+              << "      --progress                show files, bytes, throughput and ETA on stderr\n"
+              << "      --stats=json              print per-stage times, counters and queue depths as JSON on stdout at the end,\n"
+              << "                                other output going to stderr\n"
+              << "      -v, --verbose             also note every file whose content was already stored\n"
+              << "  unpack <archive> <outdir> [options]\n"
+              << "      <archive> - reads an archive in the stream layout from stdin, in one pass\n"
+              << "      -j <threads>              decompression threads (default: all cores)\n"
+              << "      --no-mmap                 read the archive with pread instead of mapping it\n"
+              << "      --io <sync|threads|uring> how files are written, as for pack (default: sync)\n"
+              << "      --io-depth <n>            files in flight (threads in the pool) for --io threads|uring (default: 32)\n"
+              << "      --dedup <reflink|hardlink|copy>  how duplicate files are restored; reflink falls back to a copy\n"
+              << "                                where the filesystem can't clone (default: reflink)\n"
+              << "      --dump-json               print the directory manifest as JSON\n"
+              << "      --progress                show files, bytes, throughput and ETA on stderr\n"
+              << "      --stats=json              print per-stage times and counters as JSON on stdout at the end, as for pack\n"
+              << "  list <archive> [--long]\n"
+              << "      --long                    show uncompressed and compressed sizes\n"
+              << "  extract <archive> <path-or-glob> <outdir> [options]\n"
+              << "      restores only matching entries ('*' also matches '/'); takes the unpack options\n"
+              << "  salvage <archive> <outdir> [options]\n"
+              << "      restores what a damaged archive still holds, listing the lost files; takes the unpack options\n"
+              << "  bench [options]\n"
+              << "      packs and unpacks generated trees and prints per-stage timings, ratio, peak RSS and latencies as JSON;\n"
+              << "      also takes the pack options\n"
+              << "      --profile <list>          comma-separated: random, text, sparse, small, dup (default: all of them)\n"
+              << "      --size-mb <n>             corpus size per profile (default: 64)\n"
+              << "      --seed <n>                corpus seed; the same seed generates the same files (default: 1)\n"
+              << "      --dir <path>              work directory (default: a new one in the temporary directory)\n"
+              << "      --keep                    leave the corpus, archive and restored tree in the work directory\n"
+              << "      --out <file>              write the JSON to file instead of stdout\n";
+}
+
+// Falls back to the thread pool, with a note, where io_uring is unavailable.
+static bool parse_io_backend(const std::string& name, IoBackend& io)
+{
+    std::optional<IoBackend> b = io_backend_from_name(name);
+    if (!b)
+    {
+        std::cout << "Unknown I/O backend: " << name << "\n";
+        return false;
+    }
+    io = usable_backend(*b);
+    if (io != *b)
+        std::cout << "io_uring is unavailable, using --io threads\n";
+    return true;
+}
+
+static bool parse_pack_options(int argc, char** argv, int first, PackOptions& opts)
+{
+    for (int i = first; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc)
+            opts.threads = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--max-inflight-mb" && i + 1 < argc)
+            opts.inflight_bytes = std::max<uint64_t>(1, std::stoull(argv[++i])) << 20;
+        else if (arg == "--stream-threshold-mb" && i + 1 < argc)
+            opts.stream_threshold = std::stoull(argv[++i]) << 20;
+        else if (arg == "--deterministic")
+            opts.deterministic = true;
+        else if (arg == "--chunk")
+            opts.chunked = true;
+        else if (arg == "--chunk-sizes" && i + 1 < argc)
+        {
+            unsigned min = 0, avg = 0, max = 0;
+            if (std::sscanf(argv[++i], "%u,%u,%u", &min, &avg, &max) != 3)
+                return false;
+            opts.chunked = true;
+            opts.chunk   = {min << 10, avg << 10, max << 10};
+        }
+        else if (arg == "--hash" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+            if (name == "xxh3")
+                opts.hash = HashAlgo::Xxh3;
+            else if (name == "blake3")
+                opts.hash = HashAlgo::Blake3;
+            else
+                return false;
+        }
+        else if (arg == "--verify")
+            opts.verify = true;
+        else if (arg == "--dict")
+            opts.dictionary = true;
+        else if (arg == "--dict-size-kb" && i + 1 < argc)
+        {
+            opts.dictionary = true;
+            opts.dict_size  = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i]))) << 10;
+        }
+        else if (arg == "--solid")
+            opts.solid = true;
+        else if (arg == "--solid-block-mb" && i + 1 < argc)
+        {
+            opts.solid       = true;
+            opts.solid_block = std::clamp<uint64_t>(std::stoull(argv[++i]), 4, 64) << 20;
+        }
+        else if (arg == "--base" && i + 1 < argc)
+            opts.base = argv[++i];
+        else if (arg == "--hash-cache" && i + 1 < argc)
+            opts.hash_cache = argv[++i];
+        else if (arg == "--codec" && i + 1 < argc)
+        {
+            std::optional<Codec> codec = codec_from_name(argv[++i]);
+            if (!codec || !codec_available(*codec))
+            {
+                std::cout << "Unsupported codec: " << argv[i] << "\n";
+                return false;
+            }
+            opts.codec = *codec;
+        }
+        else if (arg == "--level" && i + 1 < argc)
+            opts.level = std::stoi(argv[++i]);
+        else if (arg == "--long")
+            opts.long_range = true;
+        else if (arg == "--similar")
+            opts.similar = true;
+        else if (arg == "--io" && i + 1 < argc)
+        {
+            if (!parse_io_backend(argv[++i], opts.io))
+                return false;
+        }
+        else if (arg == "--io-depth" && i + 1 < argc)
+            opts.io_depth = std::clamp(std::stoi(argv[++i]), 1, 4096);
+        else if (arg == "--streamable")
+            opts.streamable = true;
+        else if (arg == "--xattrs")
+            opts.xattrs = true;
+        else if (arg == "--raw-manifest")
+            opts.compress_manifest = false;
+        else if (arg == "--dump-json")
+            opts.dump_json = true;
+        else if (arg == "--progress")
+            opts.progress = true;
+        else if (arg == "--stats=json")
+            opts.stats_json = true;
+        else if (arg == "-v" || arg == "--verbose")
+            ++opts.verbose;
+        else
+        {
+            std::cout << "Unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+    if (opts.codec == Codec::Store)
+        opts.solid = false; // a solid block only pays off compressed
+    if (opts.codec != Codec::Zstd)
+        opts.similar = false; // reference prefixes are a zstd feature
+    return true;
+}
+
+static bool parse_unpack_options(int argc, char** argv, int first, UnpackOptions& opts)
+{
+    for (int i = first; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc)
+            opts.threads = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--no-mmap")
+            opts.use_mmap = false;
+        else if (arg == "--io" && i + 1 < argc)
+        {
+            if (!parse_io_backend(argv[++i], opts.io))
+                return false;
+        }
+        else if (arg == "--io-depth" && i + 1 < argc)
+            opts.io_depth = std::clamp(std::stoi(argv[++i]), 1, 4096);
+        else if (arg == "--dedup" && i + 1 < argc)
+        {
+            std::optional<Dedup> dedup = dedup_from_name(argv[++i]);
+            if (!dedup)
+            {
+                std::cout << "Unknown dedup mode: " << argv[i] << "\n";
+                return false;
+            }
+            opts.dedup = *dedup;
+        }
+        else if (arg == "--dump-json")
+            opts.dump_json = true;
+        else if (arg == "--progress")
+            opts.progress = true;
+        else if (arg == "--stats=json")
+            opts.stats_json = true;
+        else
+        {
+            std::cout << "Unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bench options are taken out; all other arguments are pack options.
+static bool parse_bench_options(int argc, char** argv, BenchOptions& bench, PackOptions& opts)
+{
+    std::vector<char*> pack_args;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--profile" && i + 1 < argc)
+        {
+            bench.profiles.clear();
+            std::string list = argv[++i];
+            for (size_t pos = 0; pos <= list.size();)
+            {
+                size_t comma                         = std::min(list.find(',', pos), list.size());
+                std::optional<CorpusProfile> profile = corpus_profile_from_name(std::string_view(list).substr(pos, comma - pos));
+                if (!profile)
+                {
+                    std::cout << "Unknown profile: " << list.substr(pos, comma - pos) << "\n";
+                    return false;
+                }
+                bench.profiles.push_back(*profile);
+                pos = comma + 1;
+            }
+        }
+        else if (arg == "--size-mb" && i + 1 < argc)
+            bench.size = std::max<uint64_t>(1, std::stoull(argv[++i])) << 20;
+        else if (arg == "--seed" && i + 1 < argc)
+            bench.seed = std::stoull(argv[++i]);
+        else if (arg == "--dir" && i + 1 < argc)
+            bench.dir = argv[++i];
+        else if (arg == "--out" && i + 1 < argc)
+            bench.out = argv[++i];
+        else if (arg == "--keep")
+            bench.keep = true;
+        else
+            pack_args.push_back(argv[i]);
+    }
+    return parse_pack_options(static_cast<int>(pack_args.size()), pack_args.data(), 0, opts);
+}
+
+// Statistics for --progress and --stats=json: the pipelines only keep them when a RunStats is enabled.
+class RunStats
+{
+    std::optional<PipelineStats> stats;
+    std::initializer_list<Stage> stages;
+    uint64_t start = now_ns();
+    std::optional<ProgressMeter> meter; // after stats: stopped first
+
+public:
+    RunStats(bool enabled, std::initializer_list<Stage> shown) : stages(shown)
+    {
+        if (enabled)
+            stats.emplace();
+    }
+
+    PipelineStats* get() { return stats ? &*stats : nullptr; }
+
+    // Shows progress on stderr until end_progress().
+    void show_progress(const char* label) { meter.emplace(*stats, label); }
+    void end_progress() { meter.reset(); }
+
+    // The JSON object alone: with --stats=json everything else goes to stderr (see json_stdout()).
+    void print(std::ostream& out)
+    {
+        uint64_t ns            = now_ns() - start;
+        mini_json::object json = stats->to_json(stages);
+        json["seconds"]        = ns / 1e9;
+        json["mib_per_s"]      = static_cast<double>(stats->get(Count::Bytes)) / (1 << 20) / (ns / 1e9);
+        out << mini_json::dump(json, 2) << "\n";
+    }
+};
+
+// Keeps stdout clean (for the JSON of --stats=json, or an archive written there): until restored, what the command
+// prints goes to stderr instead. Returns the buffer to restore, null when off.
+static std::streambuf* json_stdout(bool on)
+{
+    return on ? std::cout.rdbuf(std::cerr.rdbuf()) : nullptr;
+}
+
+// Puts stdout back for the JSON, once the command is done.
+static void print_stats(RunStats& run, std::streambuf* saved)
+{
+    std::cout.rdbuf(saved);
+    run.print(std::cout);
+}
+
+// The archive's metadata table; none for archives written before it existed.
+static std::optional<MetaTable> read_metadata(const ArchiveReader& reader)
+{
+    std::optional<std::string> block = reader.read_section("META");
+    if (!block)
+        return std::nullopt;
+    return MetaTable::parse(*block);
+}
+
+// Sizes come from the index only; a chunked file's compressed size counts chunks it shares with other files,
+// a file in a solid block shows its share of the block, a hard link shows as "path -> target" with no stored bytes.
+static void list_archive(const Manifest& manifest, const ArchiveReader& reader, bool long_format)
+{
+    std::vector<std::string> dirs = manifest.dir_paths();
+    for (size_t i = 0; i < manifest.size(); ++i)
+    {
+        const Manifest::Node& n = manifest.node(i);
+        std::string path        = dirs[n.parent] + std::string(manifest.name(n));
+        if (n.kind == Manifest::Kind::Dir)
+            path += '/';
+        const Manifest::Node& c = manifest.target(n);
+        if (n.kind == Manifest::Kind::Link)
+            path += " -> " + dirs[c.parent] + std::string(manifest.name(c));
+        else if (n.kind == Manifest::Kind::Symlink)
+            path += " -> " + std::string(manifest.link_target(n));
+        if (!long_format)
+        {
+            std::cout << path << "\n";
+            continue;
+        }
+
+        uint64_t usize = 0, csize = 0;
+        auto add       = [&](const Digest& d) {
+            const IndexEntry* e = reader.find(d);
+            if (!e)
+                throw std::runtime_error("hash " + d.hex() + " not found in archive");
+            usize += e->usize;
+            csize += reader.stored_size(*e);
+        };
+        if (c.kind == Manifest::Kind::File || c.kind == Manifest::Kind::Sparse)
+            add(manifest.digest(c));
+        else if (c.kind == Manifest::Kind::Chunked)
+            for (const Digest& d : manifest.chunks(c))
+                add(d);
+        if (n.kind == Manifest::Kind::Link)
+            csize = 0;
+        if (c.kind == Manifest::Kind::Sparse)
+            usize = manifest.sparse(c).size; // holes included
+
+        if (n.kind == Manifest::Kind::Dir || n.kind == Manifest::Kind::Symlink)
+            std::printf("%14s %14s  %s\n", "-", "-", path.c_str());
+        else
+            std::printf("%14llu %14llu  %s\n", static_cast<unsigned long long>(usize), static_cast<unsigned long long>(csize), path.c_str());
+    }
+}
+
+static int run_command(int argc, char** argv)
 {
-    if (argc < 4)
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (argc < 4 && !(mode == "list" && argc >= 3) && mode != "bench")
     {
-        std::cout << "Usage:\n"
-                  << "  pack <folder> <archive>\n"
-                  << "  unpack <archive> <outdir>\n";
+        usage();
         return 0;
     }
 
-    std::string mode = argv[1];
     if (mode == "pack")
     {
         fs::path folder  = argv[2];
         fs::path archive = argv[3];
-        ArchiveWriter writer(archive);
-        mini_json::object root;
+        PackOptions opts;
+        if (!parse_pack_options(argc, argv, 4, opts))
+        {
+            usage();
+            return 1;
+        }
+
+        // notes would corrupt an archive written to stdout, or the JSON of --stats=json
+        std::streambuf* saved = json_stdout(archive == "-" || opts.stats_json);
+        if (archive == "-")
+            opts.streamable = true;
+        if (opts.streamable && opts.similar)
+        {
+            std::cout << "--similar is not available in the stream layout, ignored\n";
+            opts.similar = false; // a reference would have to be known before the record is written
+        }
 
         if(!fs::exists(folder))
         {
             std::cout << "The folder " << folder << " does not exist.\n";
             return 1;
         }
-        build_structure(folder, root, writer);
-        std::string header = mini_json::dump(root, 2);
+        std::optional<PackBase> base;
+        if (!opts.base.empty())
+        {
+            if (!fs::exists(opts.base))
+            {
+                std::cout << "The base archive " << opts.base << " does not exist.\n";
+                return 1;
+            }
+            if (archive != "-" && fs::exists(archive) && fs::equivalent(opts.base, archive))
+            {
+                std::cout << "The base archive cannot be overwritten by its delta.\n";
+                return 1;
+            }
+            base.emplace(opts.base);
+            if (base->reader.hash_algo() != HashAlgo::Fnv1a64)
+                opts.hash = base->reader.hash_algo(); // digests must match the base's to find its blobs
+        }
+        std::optional<HashCache> cache;
+        if (!opts.hash_cache.empty())
+            cache.emplace(opts.hash_cache, opts.hash);
+        RunStats run(opts.progress || opts.stats_json, PACK_STAGES);
+        ArchiveWriter writer(archive, opts.hash, opts.streamable);
+        writer.set_stats(run.get());
+        Manifest manifest;
+        MetaTable meta;
+        if (opts.progress)
+            run.show_progress("pack");
+        build_structure(folder, manifest, writer, opts, base ? &*base : nullptr, cache ? &*cache : nullptr, &meta);
+        run.end_progress();
+        writer.write_block("META", meta.serialize());
+        std::string header = manifest.serialize(opts.compress_manifest);
         writer.write_header(header);
-        std::cout << "structure: " << header << "\n";
+        writer.write_index();
+        if (cache)
+            cache->save(); // only once the archive is complete
+        if (opts.dump_json)
+            std::cout << "structure: " << mini_json::dump(manifest.to_json(), 2) << "\n";
+        std::cout << "manifest: " << manifest.size() << " entries, " << header.size() << " bytes\n";
+        if (saved)
+            std::cout.rdbuf(saved);
+        if (opts.stats_json)
+            run.print(archive == "-" ? std::cerr : std::cout); // after the notes, when stdout holds the archive
     }
     else if (mode == "unpack")
     {        
         fs::path archive = argv[2];
         fs::path outdir  = argv[3];
+        UnpackOptions opts;
+        if (!parse_unpack_options(argc, argv, 4, opts))
+        {
+            usage();
+            return 1;
+        }
 
-        if(!fs::exists(archive))
+        std::streambuf* saved = json_stdout(opts.stats_json);
+        if(archive != "-" && !fs::exists(archive))
         {
             std::cout << "The archive " << archive << " does not exist.\n";
             return 1;
@@ -45,11 +469,170 @@ int main(int argc, char** argv)
             fs::create_directories(outdir);
         }
 
-        ArchiveReader reader(archive);
-        std::string hdr        = reader.read_header();
-        mini_json::object root = mini_json::parse(hdr).as_object();
-        std::unordered_map<uint64_t, fs::path> cache;
-        restore_structure(root, outdir, reader, cache);
+        if (archive == "-")
+        {
+            RunStats run(opts.progress || opts.stats_json, UNPACK_STAGES);
+            if (opts.progress)
+                run.show_progress("unpack");
+            StreamUnpacker unpacker(opts, run.get());
+            const Manifest& manifest = unpacker.run(outdir);
+            run.end_progress();
+            if (opts.dump_json)
+                std::cout << "structure: " << mini_json::dump(manifest.to_json(), 2) << "\n";
+            std::cout << "Unpacked to " << outdir << "\n";
+            if (opts.stats_json)
+                print_stats(run, saved);
+            return 0;
+        }
+
+        RunStats run(opts.progress || opts.stats_json, UNPACK_STAGES);
+        ArchiveReader reader(archive, opts.use_mmap);
+        reader.set_stats(run.get());
+        Manifest manifest = Manifest::parse(reader.read_header());
+        if (opts.dump_json)
+            std::cout << "structure: " << mini_json::dump(manifest.to_json(), 2) << "\n";
+        std::optional<MetaTable> meta = read_metadata(reader);
+        if (opts.progress)
+            run.show_progress("unpack");
+        restore_structure(manifest, outdir, reader, opts, meta ? &*meta : nullptr);
+        run.end_progress();
         std::cout << "Unpacked to " << outdir << "\n";
+        if (opts.stats_json)
+            print_stats(run, saved);
+    }
+    else if (mode == "list")
+    {
+        fs::path archive = argv[2];
+        bool long_format = false;
+        for (int i = 3; i < argc; ++i)
+        {
+            if (std::string(argv[i]) != "--long")
+            {
+                std::cout << "Unknown option: " << argv[i] << "\n";
+                usage();
+                return 1;
+            }
+            long_format = true;
+        }
+        if (!fs::exists(archive))
+        {
+            std::cout << "The archive " << archive << " does not exist.\n";
+            return 1;
+        }
+
+        ArchiveReader reader(archive);
+        reader.advise(ArchiveReader::Access::Random);
+        list_archive(Manifest::parse(reader.read_header()), reader, long_format);
+    }
+    else if (mode == "extract")
+    {
+        if (argc < 5)
+        {
+            usage();
+            return 1;
+        }
+        fs::path archive    = argv[2];
+        std::string pattern = argv[3];
+        fs::path outdir     = argv[4];
+        UnpackOptions opts;
+        if (!parse_unpack_options(argc, argv, 5, opts))
+        {
+            usage();
+            return 1;
+        }
+        std::streambuf* saved = json_stdout(opts.stats_json);
+        if (!fs::exists(archive))
+        {
+            std::cout << "The archive " << archive << " does not exist.\n";
+            return 1;
+        }
+
+        RunStats run(opts.progress || opts.stats_json, UNPACK_STAGES);
+        ArchiveReader reader(archive, opts.use_mmap);
+        reader.set_stats(run.get());
+        Manifest manifest = Manifest::parse(reader.read_header());
+        fs::create_directories(outdir);
+        std::optional<MetaTable> meta = read_metadata(reader);
+        if (opts.progress)
+            run.show_progress("extract");
+        size_t matched = extract_matching(manifest, pattern, outdir, reader, opts, meta ? &*meta : nullptr);
+        run.end_progress();
+        if (matched == 0)
+        {
+            std::cout << "No entries match " << pattern << "\n";
+            return 1;
+        }
+        std::cout << "Extracted " << matched << " entries to " << outdir << "\n";
+        if (opts.stats_json)
+            print_stats(run, saved);
+    }
+    else if (mode == "salvage")
+    {
+        fs::path archive = argv[2];
+        fs::path outdir  = argv[3];
+        UnpackOptions opts;
+        if (!parse_unpack_options(argc, argv, 4, opts))
+        {
+            usage();
+            return 1;
+        }
+        std::streambuf* saved = json_stdout(opts.stats_json);
+        if (!fs::exists(archive))
+        {
+            std::cout << "The archive " << archive << " does not exist.\n";
+            return 1;
+        }
+
+        ArchiveReader reader(archive, opts.use_mmap, true);
+        const SalvageReport& r = reader.salvage_report();
+        std::cout << r.frames << " intact frames, " << r.damaged << " damaged, " << r.lost_bytes << " bytes unreadable\n";
+        fs::create_directories(outdir);
+        if (!reader.has_manifest())
+        {
+            std::cout << "No intact manifest; wrote " << salvage_blobs(reader, outdir) << " blobs, named by digest, to " << outdir << "\n";
+            return 1;
+        }
+        RunStats run(opts.progress || opts.stats_json, UNPACK_STAGES);
+        reader.set_stats(run.get());
+        Manifest manifest             = Manifest::parse(reader.read_header());
+        std::optional<MetaTable> meta = read_metadata(reader);
+        if (opts.progress)
+            run.show_progress("salvage");
+        size_t lost = salvage_structure(manifest, outdir, reader, opts, meta ? &*meta : nullptr);
+        run.end_progress();
+        std::cout << "Salvaged to " << outdir << ", " << lost << " files lost\n";
+        if (opts.stats_json)
+            print_stats(run, saved);
+        return lost ? 1 : 0;
+    }
+    else if (mode == "bench")
+    {
+        BenchOptions bench;
+        PackOptions opts;
+        if (!parse_bench_options(argc, argv, bench, opts))
+        {
+            usage();
+            return 1;
+        }
+        return run_benchmark(bench, opts) ? 0 : 1;
+    }
+    else
+    {
+        usage();
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        return run_command(argc, argv);
+    }
+    catch (const std::exception& e) // a damaged archive, an I/O error, a malformed number in the options...
+    {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
     }
 }
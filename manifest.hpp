@@ -0,0 +1,661 @@
+#pragma once
+#include "contentHash.hpp"
+#include "endianHelpers.hpp"
+#include "miniJson.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <zstd.h>
+
+// A sparse file's layout: its size and its data extents (ascending, disjoint, nonempty); the rest are holes.
+struct Extent
+{
+    uint64_t offset, length;
+};
+
+struct SparseMap
+{
+    uint64_t size = 0;
+    std::vector<Extent> extents;
+
+    uint64_t data_size() const
+    {
+        uint64_t n = 0;
+        for (auto& e : extents)
+            n += e.length;
+        return n;
+    }
+};
+
+// Open-addressing table of ids into arrays its user keeps: only the ids are stored, so looking one up, or adding one,
+// allocates nothing but the table's own (geometric) growth. The user hashes and compares keys.
+class IdTable
+{
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    std::vector<uint32_t> slots; // power-of-two size, at most half full
+    size_t used = 0;
+
+public:
+    /**
+     * The id for which same(id) holds, probing from hash h; when there's none, make() is called and the id it returns
+     * added. rehash(id) must give the hash of an id already added.
+     */
+    template <typename Same, typename Make, typename Rehash>
+    uint32_t find_or_add(size_t h, Same&& same, Make&& make, Rehash&& rehash)
+    {
+        if (2 * (used + 1) > slots.size())
+        {
+            std::vector<uint32_t> old(std::max<size_t>(64, 2 * slots.size()), EMPTY);
+            old.swap(slots);
+            for (uint32_t id : old)
+                if (id != EMPTY)
+                    for (size_t i = rehash(id) & (slots.size() - 1);; i = (i + 1) & (slots.size() - 1))
+                        if (slots[i] == EMPTY)
+                        {
+                            slots[i] = id;
+                            break;
+                        }
+        }
+        for (size_t i = h & (slots.size() - 1);; i = (i + 1) & (slots.size() - 1))
+        {
+            if (slots[i] == EMPTY)
+            {
+                ++used;
+                return slots[i] = make();
+            }
+            if (same(slots[i]))
+                return slots[i];
+        }
+    }
+};
+
+// --- directory manifest ---
+// The tree stored in the archive header: a flat list of nodes in which every parent precedes its children.
+//
+// Serialized layout (all integers little-endian):
+//   "MAN1" flags(u8) body_size(u64) body           flags bit 0: body is one zstd frame, bit 1: body has stats
+//   body = strings  digests  nodes  [stats]
+//     strings: varint count, {varint len, bytes}*      every distinct name once
+//     digests: varint count, {hi(u64) lo(u64)}*        every distinct content digest once
+//     nodes:   varint count, {varint up, varint name, u8 kind, ref}*
+//       up   = own slot - parent slot, slots being index + 1 with 0 for the archive root
+//       ref  = File: digest id (u32) | Chunked: varint n, n * digest id (u32) | Link: target node index (u32) | Dir: nothing
+//              | Sparse: digest id (u32), varint size, varint n, n * {varint hole before, varint length}
+//              | Symlink: varint string id of the link target
+//              a Link is a hard link to an earlier File, Chunked or Sparse node, whose content it shares;
+//              a Sparse file's digest is that of its data extents back to back
+//     stats:   three columns over the file nodes, in node order: varint size*, zigzag mtime_ns delta*, zigzag inode delta*
+//              (what pack --base compares to skip unchanged files)
+//
+// Archives from before the binary manifest store a JSON tree instead; parse() accepts both.
+class Manifest
+{
+public:
+    enum class Kind : uint8_t
+    {
+        Dir     = 0,
+        File    = 1,
+        Chunked = 2,
+        Link    = 3,
+        Sparse  = 4,
+        Symlink = 5,
+    };
+
+    struct Node
+    {
+        uint32_t parent; // slot of the parent directory, ROOT for top-level entries
+        uint32_t name;   // string id
+        Kind kind;
+        uint32_t first = 0; // File, Sparse: digest id; Chunked: position in the chunk list; Link: target node index;
+                            // Symlink: string id of the target
+        uint32_t count = 0; // Chunked: number of chunks; Sparse: index of its map
+    };
+
+    // What the file looked like when it was packed (all zero for directories).
+    struct Stat
+    {
+        uint64_t size;
+        uint64_t mtime_ns;
+        uint64_t inode;
+
+        bool operator==(const Stat&) const = default;
+    };
+
+    static constexpr uint32_t ROOT = 0;
+
+    // Slot of node i, as referenced by Node::parent.
+    static uint32_t slot(size_t i) { return static_cast<uint32_t>(i + 1); }
+
+private:
+    struct Span
+    {
+        uint32_t offset, size;
+    };
+
+    std::string text;        // name bytes; after parse() this is the whole decoded body
+    std::vector<Span> names; // string id -> bytes in text
+    std::vector<Digest> digests;
+    std::vector<uint32_t> chunk_ids;
+    std::vector<SparseMap> sparse_maps;
+    std::vector<Node> nodes;
+    std::vector<Stat> stats; // by node (zero for directories); empty for manifests written without them
+
+    // building only: the keys are the manifest's own names, digests and nodes, so adding a file allocates nothing
+    // beyond the growth of the arrays
+    IdTable name_ids;   // string ids
+    IdTable digest_ids; // digest ids
+    IdTable dir_slots;  // directory slots, by parent slot and name
+
+    std::string_view string(uint32_t id) const { return {text.data() + names[id].offset, names[id].size}; }
+    static size_t dir_hash(uint32_t parent, uint32_t name) { return std::hash<Digest>{}({parent, name}); }
+
+    uint32_t intern(std::string_view name)
+    {
+        return name_ids.find_or_add(
+            std::hash<std::string_view>{}(name), [&](uint32_t id) { return string(id) == name; },
+            [&] {
+                names.push_back({static_cast<uint32_t>(text.size()), static_cast<uint32_t>(name.size())});
+                text.append(name);
+                return static_cast<uint32_t>(names.size() - 1);
+            },
+            [&](uint32_t id) { return std::hash<std::string_view>{}(string(id)); });
+    }
+
+    uint32_t intern(const Digest& d)
+    {
+        return digest_ids.find_or_add(
+            std::hash<Digest>{}(d), [&](uint32_t id) { return digests[id] == d; },
+            [&] {
+                digests.push_back(d);
+                return static_cast<uint32_t>(digests.size() - 1);
+            },
+            [&](uint32_t id) { return std::hash<Digest>{}(digests[id]); });
+    }
+
+    uint32_t add(uint32_t parent, std::string_view name, Kind kind, const Stat& st = {})
+    {
+        nodes.push_back({parent, intern(name), kind});
+        stats.push_back(st);
+        return slot(nodes.size() - 1);
+    }
+
+public:
+    // --- building ---
+
+    // Slot of the directory name below parent, created on first use.
+    uint32_t dir(uint32_t parent, std::string_view name)
+    {
+        uint32_t id = intern(name);
+        return dir_slots.find_or_add(
+            dir_hash(parent, id),
+            [&](uint32_t slot) {
+                const Node& n = nodes[slot - 1];
+                return n.parent == parent && n.name == id;
+            },
+            [&] { return add(parent, name, Kind::Dir); }, [&](uint32_t slot) { return dir_hash(nodes[slot - 1].parent, nodes[slot - 1].name); });
+    }
+
+    void add_file(uint32_t parent, std::string_view name, const Digest& hash, const Stat& st = {})
+    {
+        add(parent, name, Kind::File, st);
+        nodes.back().first = intern(hash);
+    }
+
+    void add_chunked(uint32_t parent, std::string_view name, const std::vector<Digest>& chunks, const Stat& st = {})
+    {
+        add(parent, name, Kind::Chunked, st);
+        nodes.back().first = static_cast<uint32_t>(chunk_ids.size());
+        nodes.back().count = static_cast<uint32_t>(chunks.size());
+        for (auto& c : chunks)
+            chunk_ids.push_back(intern(c));
+    }
+
+    // A file with holes; hash is the digest of its data extents back to back.
+    void add_sparse(uint32_t parent, std::string_view name, const Digest& hash, SparseMap map, const Stat& st = {})
+    {
+        add(parent, name, Kind::Sparse, st);
+        nodes.back().first = intern(hash);
+        nodes.back().count = static_cast<uint32_t>(sparse_maps.size());
+        sparse_maps.push_back(std::move(map));
+    }
+
+    // A symbolic link; target is stored as is, relative or not.
+    void add_symlink(uint32_t parent, std::string_view name, std::string_view target, const Stat& st = {})
+    {
+        add(parent, name, Kind::Symlink, st);
+        nodes.back().first = intern(target);
+    }
+
+    // A hard link to node target (a File, Chunked or Sparse node already added).
+    void add_link(uint32_t parent, std::string_view name, uint32_t target, const Stat& st = {})
+    {
+        add(parent, name, Kind::Link, st);
+        nodes.back().first = target;
+    }
+
+    // --- access ---
+
+    size_t size() const { return nodes.size(); }
+    const Node& node(size_t i) const { return nodes[i]; }
+    std::string_view name(const Node& n) const { return {text.data() + names[n.name].offset, names[n.name].size}; }
+    const Digest& digest(const Node& n) const { return digests[n.first]; }
+    // The node holding a file's content: n itself, or the node a Link points to.
+    const Node& target(const Node& n) const { return n.kind == Kind::Link ? nodes[n.first] : n; }
+    const Stat* stat(size_t i) const { return stats.empty() ? nullptr : &stats[i]; }
+    const SparseMap& sparse(const Node& n) const { return sparse_maps[n.count]; }
+    std::string_view link_target(const Node& n) const { return {text.data() + names[n.first].offset, names[n.first].size}; }
+
+    std::vector<Digest> chunks(const Node& n) const
+    {
+        std::vector<Digest> out;
+        out.reserve(n.count);
+        for (uint32_t i = 0; i < n.count; ++i)
+            out.push_back(digests[chunk_ids[n.first + i]]);
+        return out;
+    }
+
+    // Path of node i relative to the archive root, '/'-separated.
+    std::string path(size_t i) const
+    {
+        std::string p(name(nodes[i]));
+        for (uint32_t s = nodes[i].parent; s != ROOT; s = nodes[s - 1].parent)
+            p.insert(0, std::string(name(nodes[s - 1])) + '/');
+        return p;
+    }
+
+    // Paths of all directories by slot, each with a trailing '/' ("" for the root, and for file slots),
+    // so the path of any node is dir_paths[n.parent] + name(n) without walking up the tree.
+    std::vector<std::string> dir_paths() const
+    {
+        std::vector<std::string> dirs(nodes.size() + 1);
+        for (size_t i = 0; i < nodes.size(); ++i)
+            if (nodes[i].kind == Kind::Dir)
+                dirs[slot(i)].append(dirs[nodes[i].parent]).append(name(nodes[i])).push_back('/');
+        return dirs;
+    }
+
+    // --- serialization ---
+
+    std::string serialize(bool compress = true) const
+    {
+        std::string body;
+        write_names(body, 0);
+        write_digests(body, 0);
+        write_nodes(body, 0);
+        if (!stats.empty())
+        {
+            Stat prev{};
+            for (size_t i = 0; i < nodes.size(); ++i)
+                if (nodes[i].kind != Kind::Dir)
+                    appendVarint(body, stats[i].size);
+            for (size_t i = 0; i < nodes.size(); ++i)
+                if (nodes[i].kind != Kind::Dir)
+                    appendVarint(body, zigzag(static_cast<int64_t>(stats[i].mtime_ns - std::exchange(prev.mtime_ns, stats[i].mtime_ns))));
+            for (size_t i = 0; i < nodes.size(); ++i)
+                if (nodes[i].kind != Kind::Dir)
+                    appendVarint(body, zigzag(static_cast<int64_t>(stats[i].inode - std::exchange(prev.inode, stats[i].inode))));
+        }
+
+        std::string out = "MAN1";
+        std::string frame;
+        if (compress)
+        {
+            frame.resize(ZSTD_compressBound(body.size()));
+            size_t r = ZSTD_compress(frame.data(), frame.size(), body.data(), body.size(), 9);
+            if (ZSTD_isError(r))
+                throw std::runtime_error(std::string("ZSTD compression error: ") + ZSTD_getErrorName(r));
+            frame.resize(r);
+            compress = frame.size() < body.size();
+        }
+        out.push_back(static_cast<char>((compress ? 1 : 0) | (stats.empty() ? 0 : 2)));
+        appendLE<uint64_t>(out, body.size());
+        out += compress ? frame : body;
+        return out;
+    }
+
+    /**
+     * Decode a serialized manifest (or a legacy JSON header) in one pass.
+     * Names stay in the decoded buffer; nodes, digests and chunk ids go into flat arrays.
+     */
+    static Manifest parse(const std::string& data)
+    {
+        if (data.compare(0, 4, "MAN1") != 0)
+            return from_json(mini_json::parse(data).as_object());
+        if (data.size() < 13)
+            throw std::runtime_error("truncated manifest");
+
+        Manifest m;
+        bool compressed = data[4] & 1;
+        bool has_stats  = data[4] & 2;
+        uint64_t size   = loadLE<uint64_t>(data.data() + 5);
+        if (compressed)
+        {
+            if (ZSTD_getFrameContentSize(data.data() + 13, data.size() - 13) != size)
+                throw std::runtime_error("corrupt manifest");
+            m.text.resize(size);
+            size_t r = ZSTD_decompress(m.text.data(), size, data.data() + 13, data.size() - 13);
+            if (ZSTD_isError(r) || r != size)
+                throw std::runtime_error("corrupt manifest");
+        }
+        else
+        {
+            if (size != data.size() - 13)
+                throw std::runtime_error("corrupt manifest");
+            m.text.assign(data, 13);
+        }
+
+        const char* p   = m.text.data();
+        const char* end = p + m.text.size();
+        m.read_names(p, end, readVarint(p, end), false);
+        m.read_digests(p, end, readVarint(p, end));
+        m.read_nodes(p, end, readVarint(p, end));
+
+        if (has_stats)
+        {
+            m.stats.resize(m.nodes.size());
+            Stat prev{};
+            for (size_t i = 0; i < m.nodes.size(); ++i)
+                if (m.nodes[i].kind != Kind::Dir)
+                    m.stats[i].size = readVarint(p, end);
+            for (size_t i = 0; i < m.nodes.size(); ++i)
+                if (m.nodes[i].kind != Kind::Dir)
+                    m.stats[i].mtime_ns = prev.mtime_ns += unzigzag(readVarint(p, end));
+            for (size_t i = 0; i < m.nodes.size(); ++i)
+                if (m.nodes[i].kind != Kind::Dir)
+                    m.stats[i].inode = prev.inode += unzigzag(readVarint(p, end));
+        }
+        return m;
+    }
+
+    // --- entries (the stream layout, see archiver.hpp) ---
+    // The manifest in installments, so a reader going front to back knows a file before its content arrives:
+    //   entries = {varint first, varint count, strings}  {varint first, varint count, digests}
+    //             {varint first, varint count, nodes}  varint size*
+    // strings, digests and nodes are coded as in the body, first being the id or index of the first one; sizes are
+    // those of the stats column, one per new node that isn't a directory.
+
+    // How much of the manifest earlier entries() covered.
+    struct Mark
+    {
+        size_t names = 0, digests = 0, nodes = 0;
+    };
+
+    // The names, digests and nodes added since mark, which moves past them.
+    std::string entries(Mark& mark) const
+    {
+        std::string out;
+        appendVarint(out, mark.names);
+        write_names(out, mark.names);
+        appendVarint(out, mark.digests);
+        write_digests(out, mark.digests);
+        appendVarint(out, mark.nodes);
+        write_nodes(out, mark.nodes);
+        for (size_t i = mark.nodes; i < nodes.size(); ++i)
+            if (nodes[i].kind != Kind::Dir)
+                appendVarint(out, stats.empty() ? 0 : stats[i].size);
+        mark = {names.size(), digests.size(), nodes.size()};
+        return out;
+    }
+
+    // Appends what entries() gave, which must continue where the entries added so far ended. Returns the first new node.
+    size_t add_entries(const std::string& data)
+    {
+        const char* p   = data.data();
+        const char* end = p + data.size();
+        auto next       = [&](size_t expected) {
+            if (readVarint(p, end) != expected)
+                throw std::runtime_error("manifest entries out of order");
+            return readVarint(p, end);
+        };
+        read_names(p, end, next(names.size()), true);
+        read_digests(p, end, next(digests.size()));
+        size_t first = nodes.size();
+        read_nodes(p, end, next(nodes.size()));
+        stats.resize(nodes.size());
+        for (size_t i = first; i < nodes.size(); ++i)
+            if (nodes[i].kind != Kind::Dir)
+                stats[i].size = readVarint(p, end);
+        if (p != end)
+            throw std::runtime_error("corrupt manifest entries");
+        return first;
+    }
+
+    // --- JSON view (--dump-json, and headers written before the binary manifest) ---
+
+    mini_json::object to_json() const
+    {
+        mini_json::object root;
+        std::vector<mini_json::object*> dirs(nodes.size() + 1, nullptr);
+        dirs[ROOT] = &root;
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            const Node& n       = nodes[i];
+            mini_json::value& v = (*dirs[n.parent])[std::string(name(n))];
+            if (n.kind == Kind::Dir)
+            {
+                v             = mini_json::object{};
+                dirs[slot(i)] = &v.as_object();
+            }
+            else if (n.kind == Kind::Symlink)
+                v = "-> " + std::string(link_target(n));
+            else if (target(n).kind != Kind::Chunked) // links show their target's content, sparse files their data's digest
+                v = digest(target(n)).hex();
+            else
+            {
+                mini_json::array list;
+                for (auto& c : chunks(target(n)))
+                    list.emplace_back(c.hex());
+                v = std::move(list);
+            }
+        }
+        return root;
+    }
+
+    static Manifest from_json(const mini_json::object& root)
+    {
+        Manifest m;
+        m.add_json(ROOT, root);
+        m.stats.clear(); // not recorded in JSON headers
+        return m;
+    }
+
+private:
+    void write_names(std::string& body, size_t from) const
+    {
+        appendVarint(body, names.size() - from);
+        for (size_t i = from; i < names.size(); ++i)
+        {
+            appendVarint(body, names[i].size);
+            body.append(text, names[i].offset, names[i].size);
+        }
+    }
+
+    void write_digests(std::string& body, size_t from) const
+    {
+        appendVarint(body, digests.size() - from);
+        for (size_t i = from; i < digests.size(); ++i)
+        {
+            appendLE(body, digests[i].hi);
+            appendLE(body, digests[i].lo);
+        }
+    }
+
+    void write_nodes(std::string& body, size_t from) const
+    {
+        appendVarint(body, nodes.size() - from);
+        for (size_t i = from; i < nodes.size(); ++i)
+        {
+            const Node& n = nodes[i];
+            appendVarint(body, slot(i) - n.parent);
+            appendVarint(body, n.name);
+            body.push_back(static_cast<char>(n.kind));
+            if (n.kind == Kind::File || n.kind == Kind::Link)
+                appendLE(body, n.first);
+            else if (n.kind == Kind::Chunked)
+            {
+                appendVarint(body, n.count);
+                for (uint32_t k = 0; k < n.count; ++k)
+                    appendLE(body, chunk_ids[n.first + k]);
+            }
+            else if (n.kind == Kind::Symlink)
+                appendVarint(body, n.first);
+            else if (n.kind == Kind::Sparse)
+            {
+                const SparseMap& map = sparse(n);
+                appendLE(body, n.first);
+                appendVarint(body, map.size);
+                appendVarint(body, map.extents.size());
+                uint64_t end = 0;
+                for (auto& e : map.extents)
+                {
+                    appendVarint(body, e.offset - end);
+                    appendVarint(body, e.length);
+                    end = e.offset + e.length;
+                }
+            }
+        }
+    }
+
+    static void need(const char* p, const char* end, uint64_t n)
+    {
+        if (static_cast<uint64_t>(end - p) < n)
+            throw std::runtime_error("corrupt manifest");
+    }
+
+    // Names either point into text, when p is in it (parse()), or are copied to its end.
+    void read_names(const char*& p, const char* end, uint64_t count, bool copy)
+    {
+        need(p, end, count);
+        if (names.empty()) // parse(); entries come a few at a time
+            names.reserve(count);
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            uint64_t len = readVarint(p, end);
+            need(p, end, len);
+            names.push_back({static_cast<uint32_t>(copy ? text.size() : p - text.data()), static_cast<uint32_t>(len)});
+            if (copy)
+                text.append(p, len);
+            p += len;
+        }
+    }
+
+    void read_digests(const char*& p, const char* end, uint64_t count)
+    {
+        need(p, end, count * 16);
+        if (digests.empty()) // parse(); entries come a few at a time
+            digests.reserve(count);
+        for (uint64_t i = 0; i < count; ++i, p += 16)
+            digests.push_back({loadLE<uint64_t>(p), loadLE<uint64_t>(p + 8)});
+    }
+
+    void read_nodes(const char*& p, const char* end, uint64_t count)
+    {
+        need(p, end, count * 3);
+        if (nodes.empty()) // parse(); entries come a few at a time
+            nodes.reserve(count);
+        for (uint64_t i = nodes.size(), last = i + count; i < last; ++i)
+        {
+            uint64_t up   = readVarint(p, end);
+            uint64_t name = readVarint(p, end);
+            need(p, end, 1);
+            Node n{static_cast<uint32_t>(slot(i) - up), static_cast<uint32_t>(name), static_cast<Kind>(*p++)};
+            if (up == 0 || up > slot(i) || name >= names.size() || (n.parent != ROOT && nodes[n.parent - 1].kind != Kind::Dir))
+                throw std::runtime_error("corrupt manifest");
+            if (std::string_view s = this->name(n); s.empty() || s == "." || s == ".." || s.find('/') != s.npos || s.find('\0') != s.npos)
+                throw std::runtime_error("unsafe name in manifest: " + std::string(s));
+
+            if (n.kind == Kind::File)
+            {
+                need(p, end, 4);
+                n.first = loadLE<uint32_t>(p);
+                p += 4;
+                if (n.first >= digests.size())
+                    throw std::runtime_error("corrupt manifest");
+            }
+            else if (n.kind == Kind::Chunked)
+            {
+                n.count = static_cast<uint32_t>(readVarint(p, end));
+                n.first = static_cast<uint32_t>(chunk_ids.size());
+                need(p, end, 4ull * n.count);
+                for (uint32_t k = 0; k < n.count; ++k, p += 4)
+                {
+                    uint32_t id = loadLE<uint32_t>(p);
+                    if (id >= digests.size())
+                        throw std::runtime_error("corrupt manifest");
+                    chunk_ids.push_back(id);
+                }
+            }
+            else if (n.kind == Kind::Link)
+            {
+                need(p, end, 4);
+                n.first = loadLE<uint32_t>(p);
+                p += 4;
+                if (n.first >= i || nodes[n.first].kind == Kind::Dir || nodes[n.first].kind == Kind::Link || nodes[n.first].kind == Kind::Symlink)
+                    throw std::runtime_error("corrupt manifest");
+            }
+            else if (n.kind == Kind::Symlink)
+            {
+                n.first = static_cast<uint32_t>(readVarint(p, end));
+                if (n.first >= names.size())
+                    throw std::runtime_error("corrupt manifest");
+            }
+            else if (n.kind == Kind::Sparse)
+            {
+                need(p, end, 4);
+                n.first = loadLE<uint32_t>(p);
+                p += 4;
+                SparseMap map{readVarint(p, end), {}};
+                uint64_t extent_count = readVarint(p, end);
+                need(p, end, extent_count * 2);
+                map.extents.reserve(extent_count);
+                for (uint64_t k = 0, at = 0; k < extent_count; ++k)
+                {
+                    uint64_t offset = at + readVarint(p, end);
+                    uint64_t length = readVarint(p, end);
+                    if (offset < at || length == 0 || length > map.size || offset > map.size - length)
+                        throw std::runtime_error("corrupt manifest");
+                    map.extents.push_back({offset, length});
+                    at = offset + length;
+                }
+                if (n.first >= digests.size())
+                    throw std::runtime_error("corrupt manifest");
+                n.count = static_cast<uint32_t>(sparse_maps.size());
+                sparse_maps.push_back(std::move(map));
+            }
+            else if (n.kind != Kind::Dir)
+                throw std::runtime_error("corrupt manifest");
+            nodes.push_back(n);
+        }
+    }
+
+    // Values are digests in hex; the oldest headers hold the 64-bit hash as a number.
+    static Digest digest_of(const mini_json::value& v)
+    {
+        return v.is_string() ? Digest::from_hex(v.as_string()) : Digest::from_u64(v.as_uint64());
+    }
+
+    void add_json(uint32_t parent, const mini_json::object& node)
+    {
+        for (auto& [name, val] : node)
+        {
+            if (val.is_object())
+                add_json(dir(parent, name), val.as_object());
+            else if (val.is_array())
+            {
+                std::vector<Digest> list;
+                for (auto& c : val.as_array())
+                    list.push_back(digest_of(c));
+                add_chunked(parent, name, list);
+            }
+            else
+                add_file(parent, name, digest_of(val));
+        }
+    }
+};
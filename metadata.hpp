@@ -0,0 +1,303 @@
+#pragma once
+#include "asyncIo.hpp"
+#include "endianHelpers.hpp"
+#include "manifest.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <zstd.h>
+
+// --- metadata table ---
+// Mode, owner, timestamps and (with pack --xattrs) extended attributes of every manifest node, in a "META" block next
+// to the manifest. Column by column, each value stored as the zigzag delta from the node before it (atime from the
+// node's own mtime), so runs of files with the same mode, owner and similar times cost about a byte each before the
+// body is zstd-compressed.
+//
+// Serialized layout (all integers little-endian):
+//   "MET1" flags(u8) body_size(u64) body           flags bit 0: body is one zstd frame, bit 1: body has xattrs
+//   body = varint count  mode*  uid*  gid*  mtime_ns*  atime_ns*  [xattrs*]      count = number of manifest nodes
+//     mode, uid, gid, mtime_ns: zigzag delta from the previous node's   atime_ns: zigzag delta from the node's mtime_ns
+//     xattrs: varint n, n * {varint len, name, varint len, value}
+// A node with mode 0 has no metadata (and is left as unpack creates it).
+struct FileMeta
+{
+    uint32_t mode = 0; // st_mode, file type bits included
+    uint32_t uid  = 0;
+    uint32_t gid  = 0;
+    int64_t mtime_ns = 0;
+    int64_t atime_ns = 0;
+    std::vector<std::pair<std::string, std::string>> xattrs;
+};
+
+/**
+ * Metadata of the file at path, from its lstat (st). Extended attributes are only listed when xattrs is set,
+ * as that costs two more system calls per file and more per attribute.
+ */
+inline FileMeta capture_meta(const std::filesystem::path& path, const struct stat& st, bool xattrs)
+{
+    FileMeta m{st.st_mode, st.st_uid, st.st_gid, st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec, st.st_atim.tv_sec * 1000000000ll + st.st_atim.tv_nsec, {}};
+    if (!xattrs)
+        return m;
+    std::string names(256, '\0');
+    ssize_t n;
+    while ((n = ::llistxattr(path.c_str(), names.data(), names.size())) < 0 && errno == ERANGE)
+        names.resize(names.size() * 4);
+    for (size_t pos = 0; n > 0 && pos < static_cast<size_t>(n);)
+    {
+        std::string name(names.c_str() + pos);
+        pos += name.size() + 1;
+        std::string value(64, '\0');
+        ssize_t len;
+        while ((len = ::lgetxattr(path.c_str(), name.c_str(), value.data(), value.size())) < 0 && errno == ERANGE)
+            value.resize(value.size() * 4);
+        if (len < 0)
+            continue; // removed meanwhile
+        value.resize(len);
+        m.xattrs.emplace_back(std::move(name), std::move(value));
+    }
+    return m;
+}
+
+class MetaTable
+{
+    std::vector<FileMeta> rows; // by manifest node
+    bool has_xattrs = false;
+
+public:
+    void set(size_t node, FileMeta m)
+    {
+        if (node >= rows.size())
+            rows.resize(node + 1);
+        has_xattrs |= !m.xattrs.empty();
+        rows[node] = std::move(m);
+    }
+
+    // Metadata of node i, null when there's none.
+    const FileMeta* get(size_t i) const { return i < rows.size() && rows[i].mode ? &rows[i] : nullptr; }
+
+    // --- serialization ---
+
+    std::string serialize() const
+    {
+        std::string body;
+        appendVarint(body, rows.size());
+        int64_t prev = 0;
+        for (auto column : {&FileMeta::mode, &FileMeta::uid, &FileMeta::gid})
+        {
+            prev = 0;
+            for (auto& r : rows)
+                appendVarint(body, zigzag(static_cast<int64_t>(r.*column) - std::exchange(prev, r.*column)));
+        }
+        prev = 0;
+        for (auto& r : rows)
+            appendVarint(body, zigzag(r.mtime_ns - std::exchange(prev, r.mtime_ns)));
+        for (auto& r : rows)
+            appendVarint(body, zigzag(r.atime_ns - r.mtime_ns));
+        if (has_xattrs)
+            for (auto& r : rows)
+            {
+                appendVarint(body, r.xattrs.size());
+                for (auto& [name, value] : r.xattrs)
+                {
+                    appendVarint(body, name.size());
+                    body += name;
+                    appendVarint(body, value.size());
+                    body += value;
+                }
+            }
+
+        std::string frame(ZSTD_compressBound(body.size()), '\0');
+        size_t r = ZSTD_compress(frame.data(), frame.size(), body.data(), body.size(), 9);
+        if (ZSTD_isError(r))
+            throw std::runtime_error(std::string("ZSTD compression error: ") + ZSTD_getErrorName(r));
+        frame.resize(r);
+        bool compress = frame.size() < body.size();
+
+        std::string out = "MET1";
+        out.push_back(static_cast<char>((compress ? 1 : 0) | (has_xattrs ? 2 : 0)));
+        appendLE<uint64_t>(out, body.size());
+        out += compress ? frame : body;
+        return out;
+    }
+
+    static MetaTable parse(const std::string& data)
+    {
+        if (data.size() < 13 || data.compare(0, 4, "MET1") != 0)
+            throw std::runtime_error("corrupt metadata table");
+        bool compressed = data[4] & 1;
+        uint64_t size   = loadLE<uint64_t>(data.data() + 5);
+        std::string body;
+        if (compressed)
+        {
+            if (ZSTD_getFrameContentSize(data.data() + 13, data.size() - 13) != size)
+                throw std::runtime_error("corrupt metadata table");
+            body.resize(size);
+            size_t r = ZSTD_decompress(body.data(), size, data.data() + 13, data.size() - 13);
+            if (ZSTD_isError(r) || r != size)
+                throw std::runtime_error("corrupt metadata table");
+        }
+        else
+            body.assign(data, 13);
+
+        MetaTable t;
+        t.has_xattrs    = data[4] & 2;
+        const char* p   = body.data();
+        const char* end = p + body.size();
+        uint64_t count  = readVarint(p, end);
+        if (count > body.size())
+            throw std::runtime_error("corrupt metadata table");
+        t.rows.resize(count);
+        for (auto column : {&FileMeta::mode, &FileMeta::uid, &FileMeta::gid})
+        {
+            int64_t prev = 0;
+            for (auto& r : t.rows)
+                r.*column = static_cast<uint32_t>(prev += unzigzag(readVarint(p, end)));
+        }
+        int64_t prev = 0;
+        for (auto& r : t.rows)
+            r.mtime_ns = prev += unzigzag(readVarint(p, end));
+        for (auto& r : t.rows)
+            r.atime_ns = r.mtime_ns + unzigzag(readVarint(p, end));
+        if (t.has_xattrs)
+            for (auto& r : t.rows)
+            {
+                auto text = [&] {
+                    uint64_t len = readVarint(p, end);
+                    if (static_cast<uint64_t>(end - p) < len)
+                        throw std::runtime_error("corrupt metadata table");
+                    return std::string(std::exchange(p, p + len), len);
+                };
+                for (uint64_t n = readVarint(p, end); n > 0; --n)
+                {
+                    std::string name = text();
+                    r.xattrs.emplace_back(std::move(name), text());
+                }
+            }
+        return t;
+    }
+};
+
+// --- applying metadata ---
+// After unpack has written everything: nodes are visited last to first, so a directory's children are done (and its
+// mtime no longer disturbed) before the directory itself, and a read-only directory is made so only at the end.
+// Each node is changed relative to an O_PATH descriptor of its directory (fchownat, fchmodat, utimensat), so no
+// path is resolved more than once; descriptors are opened on first use and closed once their directory is done.
+// Ownership is only restored when running as root. Symbolic links keep their own times and owner, not their mode.
+// Which nodes are links comes from the manifest, and a row whose file type disagrees with its node is rejected.
+// Extended attributes go through the /proc/self/fd path of the directory descriptor.
+class MetaApplier
+{
+    static constexpr size_t MAX_OPEN = 256; // directory descriptors kept open at most
+
+    const Manifest& manifest;
+    std::vector<int> fds; // by slot, -1 when not open
+    size_t open_count = 0;
+    size_t failures   = 0;
+    bool root         = ::geteuid() == 0;
+
+    int dir_fd(uint32_t slot)
+    {
+        if (fds[slot] >= 0)
+            return fds[slot];
+        if (open_count >= MAX_OPEN)
+            close_all();
+        const Manifest::Node& n = manifest.node(slot - 1);
+        std::string name(manifest.name(n));
+        int fd = ::openat(dir_fd(n.parent), name.c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+            throw file_error("Failed to open directory: ", manifest.path(slot - 1), errno);
+        ++open_count;
+        return fds[slot] = fd;
+    }
+
+    void close_all()
+    {
+        for (size_t s = 1; s < fds.size(); ++s)
+            if (fds[s] >= 0)
+                ::close(std::exchange(fds[s], -1));
+        open_count = 0;
+    }
+
+    // The file type a node's metadata must have.
+    static uint32_t type_of(Manifest::Kind kind)
+    {
+        switch (kind)
+        {
+            case Manifest::Kind::Dir: return S_IFDIR;
+            case Manifest::Kind::Symlink: return S_IFLNK;
+            default: return S_IFREG;
+        }
+    }
+
+    void apply(size_t i, const FileMeta& m)
+    {
+        const Manifest::Node& n = manifest.node(i);
+        if ((m.mode & S_IFMT) != type_of(n.kind)) // the table is the archive's word, not the filesystem's
+            throw std::runtime_error("corrupt metadata table: " + manifest.path(i) + " has the mode of another file type");
+        std::string name(manifest.name(n));
+        int dir   = dir_fd(n.parent);
+        bool link = n.kind == Manifest::Kind::Symlink;
+        if (root && ::fchownat(dir, name.c_str(), m.uid, m.gid, AT_SYMLINK_NOFOLLOW) != 0)
+            ++failures;
+        // never through a link: a file swapped for one meanwhile fails instead of changing the link's target
+        if (!link && ::fchmodat(dir, name.c_str(), m.mode & 07777, AT_SYMLINK_NOFOLLOW) != 0)
+            ++failures;
+        for (auto& [key, value] : m.xattrs)
+        {
+            std::string path = "/proc/self/fd/" + std::to_string(dir) + "/" + name;
+            if (::lsetxattr(path.c_str(), key.c_str(), value.data(), value.size(), 0) != 0)
+                ++failures;
+        }
+        struct timespec times[2] = {{m.atime_ns / 1000000000, m.atime_ns % 1000000000}, {m.mtime_ns / 1000000000, m.mtime_ns % 1000000000}};
+        if (::utimensat(dir, name.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0)
+            ++failures;
+    }
+
+public:
+    explicit MetaApplier(const Manifest& m) : manifest(m), fds(m.size() + 1, -1) {}
+
+    MetaApplier(const MetaApplier&)            = delete;
+    MetaApplier& operator=(const MetaApplier&) = delete;
+
+    ~MetaApplier()
+    {
+        close_all();
+        if (fds[Manifest::ROOT] >= 0)
+            ::close(fds[Manifest::ROOT]);
+    }
+
+    /**
+     * Applies the metadata of the nodes flagged in keep (all when null) to the tree restored below base.
+     * Returns the number of changes the filesystem refused (e.g. xattrs in a namespace only root may set).
+     */
+    size_t run(const MetaTable& table, const std::filesystem::path& base, const std::vector<bool>* keep = nullptr)
+    {
+        fds[Manifest::ROOT] = ::open(base.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fds[Manifest::ROOT] < 0)
+            throw file_error("Failed to open directory: ", base, errno);
+        for (size_t i = manifest.size(); i-- > 0;)
+        {
+            const FileMeta* m = table.get(i);
+            if (m && (!keep || (*keep)[i]))
+                apply(i, *m);
+            if (uint32_t s = Manifest::slot(i); fds[s] >= 0) // its children are all done
+            {
+                ::close(std::exchange(fds[s], -1));
+                --open_count;
+            }
+        }
+        return failures;
+    }
+};
@@ -0,0 +1,1227 @@
+#pragma once
+#include "archiver.hpp"
+#include "asyncIo.hpp"
+#include "blockingQueue.hpp"
+#include "bufferPool.hpp"
+#include "fastCdc.hpp"
+#include "hashCache.hpp"
+#include "manifest.hpp"
+#include "metadata.hpp"
+#include "pipelineStats.hpp"
+#include "sparseFile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <map>
+#include <memory>
+#include <optional>
+#include <random>
+#include <thread>
+
+#include <zdict.h>
+
+struct PackOptions
+{
+    unsigned threads          = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t inflight_bytes   = 1ull << 30;       // file bytes read but not yet written to the archive
+    uint64_t stream_threshold = STREAM_THRESHOLD; // larger files are streamed instead of loaded whole
+    bool deterministic        = false;            // sorted walk, records written in walk order
+    bool chunked              = false;            // dedup content-defined chunks instead of whole files
+    FastCdc::Params chunk;
+    HashAlgo hash           = HashAlgo::Xxh3; // content digest used as the dedup key
+    bool verify             = false;          // byte-compare every dedup hit against the blob's source
+    bool compress_manifest  = true;
+    bool dump_json          = false;     // print the manifest as JSON after packing
+    bool dictionary         = false;     // train a zstd dictionary for small files
+    uint32_t dict_size      = 112 << 10; // dictionary capacity
+    uint32_t dict_max_file  = 32 << 10;  // files (and chunks) up to this size are compressed with the dictionary
+    bool solid              = false;     // pack small files together into shared solid blocks
+    uint64_t solid_block    = 16 << 20;  // target uncompressed size of a solid block
+    uint64_t solid_max_file = 1 << 20;   // files up to this size go into solid blocks, unchunked
+    fs::path base;                       // pack a delta against this archive
+    fs::path hash_cache;                 // digests of unchanged files are taken from (and saved to) this table
+    Codec codec       = Codec::Zstd;     // record (and solid block) codec
+    int level         = 0;               // codec level, 0 = codec default
+    bool long_range   = false;           // zstd long-distance matching over a 128 MB window
+    bool similar      = false;           // compress large files against an earlier similar file (zstd, whole files)
+    bool streamable   = false;           // write the stream layout to a file too (it's the only one on stdout)
+    IoBackend io      = IoBackend::Sync; // how files are read for the workers (usable_backend() already applied)
+    unsigned io_depth = 32;              // files in flight (or reading threads) with an asynchronous backend
+    bool xattrs       = false;           // record extended attributes in the metadata table
+    bool progress     = false;           // show files, bytes, throughput and ETA on stderr while packing
+    bool stats_json   = false;           // print per-stage times, counters and queue depths as JSON at the end
+    unsigned verbose  = 0;               // 1: also note every file whose content was already stored
+};
+
+// --- dictionary training ---
+// A sampling walk ahead of the pipeline: reservoir-sample small files (sorted walk, fixed seed, so the same tree
+// always yields the same dictionary), read them until about 100x the dictionary size is collected, and train.
+// Returns an empty string when there is too little to train on.
+class DictionaryTrainer
+{
+    static constexpr size_t MAX_SAMPLES = 16384;
+
+    const PackOptions& opts;
+    std::vector<fs::path> reservoir;
+    uint64_t seen = 0;
+    std::mt19937_64 rng{0x5DEECE66Dull};
+
+    void walk(const fs::path& dir)
+    {
+        std::vector<fs::directory_entry> entries(fs::directory_iterator(dir), fs::directory_iterator{});
+        std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.path().filename() < b.path().filename(); });
+        for (auto& e : entries)
+        {
+            if (e.is_symlink())
+                continue;
+            if (e.is_directory())
+                walk(e.path());
+            else if (e.is_regular_file() && e.file_size() > 0 && e.file_size() <= opts.dict_max_file)
+            {
+                ++seen;
+                if (reservoir.size() < MAX_SAMPLES)
+                    reservoir.push_back(e.path());
+                else if (uint64_t k = rng() % seen; k < MAX_SAMPLES)
+                    reservoir[k] = e.path();
+            }
+        }
+    }
+
+public:
+    explicit DictionaryTrainer(const PackOptions& options) : opts(options) {}
+
+    std::string train(const fs::path& dir)
+    {
+        walk(dir);
+
+        const uint64_t budget = 100ull * opts.dict_size;
+        std::string samples, data;
+        std::vector<size_t> sizes;
+        for (auto& p : reservoir)
+        {
+            if (samples.size() >= budget)
+                break;
+            load_file(p, data);
+            samples += data;
+            sizes.push_back(data.size());
+        }
+        if (sizes.size() < 8)
+            return {};
+
+        std::string dict(opts.dict_size, '\0');
+        size_t r = ZDICT_trainFromBuffer(dict.data(), dict.size(), samples.data(), sizes.data(), static_cast<unsigned>(sizes.size()));
+        if (ZDICT_isError(r))
+            return {}; // e.g. samples too few or too uniform: pack without a dictionary
+        dict.resize(r);
+        std::cout << "dictionary: " << r << " bytes trained on " << sizes.size() << " of " << seen << " small files\n";
+        return dict;
+    }
+};
+
+// --- compressibility probe ---
+// A few small samples spread over the data, compressed at level 1: much cheaper than compressing the whole blob,
+// and a good predictor of whether that would pay off. Blobs below PROBE_MIN are simply compressed.
+inline constexpr size_t PROBE_MIN     = 32 << 10;
+inline constexpr size_t PROBE_SAMPLE  = 4 << 10;
+inline constexpr size_t PROBE_SAMPLES = 4;
+
+enum class Gain
+{
+    None,   // store raw
+    Low,    // compress at level 1
+    Normal, // compress at the configured level
+};
+
+// Samples are read through sample(offset, buffer), so the probe works on memory and on files alike.
+template <typename ReadSample>
+inline Gain probe_gain(uint64_t size, ReadSample sample)
+{
+    static thread_local ZstdCtx ctx{ZstdCtx::Mode::Compress, 1};
+    std::string in, out;
+    uint64_t total = 0, packed = 0;
+    for (size_t i = 0; i < PROBE_SAMPLES; ++i)
+    {
+        sample(i * (size - PROBE_SAMPLE) / (PROBE_SAMPLES - 1), in);
+        ctx.compress(in.data(), in.size(), out);
+        total += in.size();
+        packed += out.size();
+    }
+    if (packed * 100 >= total * 97)
+        return Gain::None;
+    return packed * 100 >= total * 85 ? Gain::Low : Gain::Normal;
+}
+
+inline Gain probe_gain(const char* data, size_t size)
+{
+    if (size < PROBE_MIN)
+        return Gain::Normal;
+    return probe_gain(size, [&](uint64_t off, std::string& buf) { buf.assign(data + off, PROBE_SAMPLE); });
+}
+
+// --- similar files ---
+// pack --similar: files whose names match once digits are dropped (build-41.bin, build-42.bin; app.log, app.log.1),
+// with the same extension and sizes within a factor of two, are usually near-duplicates. The first such file is the
+// anchor; each later one is compressed with the anchor's content as zstd prefix and long-distance matching, so what
+// they share costs next to nothing. References go one level deep at most, so unpack decodes each anchor once more per
+// referencing file and never walks a chain. Within a directory files are walked in similarity order, which keeps an
+// anchor in the page cache while the files compressed against it are read.
+inline constexpr uint64_t SIMILAR_MIN = 64 << 10;
+
+// The name without digits, runs of separators collapsed and trailing ones dropped.
+inline std::string similarity_key(const std::string& name)
+{
+    auto separator = [](char c) { return c == '.' || c == '-' || c == '_'; };
+    std::string key;
+    for (char c : name)
+    {
+        if (c >= '0' && c <= '9')
+            continue;
+        if (separator(c) && !key.empty() && separator(key.back()))
+            continue;
+        key += c;
+    }
+    while (!key.empty() && separator(key.back()))
+        key.pop_back();
+    return key;
+}
+
+// --- incremental packing ---
+// The archive a delta is packed against (pack --base). Files whose size, mtime and inode match its manifest are
+// not read at all, and blobs it already holds are referenced instead of stored again.
+struct PackBase
+{
+    fs::path path;
+    ArchiveReader reader;
+    Manifest manifest;
+    std::unordered_map<std::string, uint32_t> files; // path below the packed root -> node; empty without stats
+
+    explicit PackBase(const fs::path& archive) : path(archive), reader(archive), manifest(Manifest::parse(reader.read_header()))
+    {
+        if (manifest.size() == 0 || !manifest.stat(0))
+            return;
+        std::vector<std::string> dirs = manifest.dir_paths();
+        files.reserve(manifest.size());
+        for (size_t i = 0; i < manifest.size(); ++i)
+            if (manifest.node(i).kind != Manifest::Kind::Dir && manifest.node(i).kind != Manifest::Kind::Symlink)
+                files.emplace(dirs[manifest.node(i).parent] + std::string(manifest.name(manifest.node(i))), static_cast<uint32_t>(i));
+    }
+
+    // The base's node for the file at rel if it still looks the same, else null.
+    const Manifest::Node* unchanged(const std::vector<std::string>& rel, const Manifest::Stat& st) const
+    {
+        std::string key;
+        for (auto& c : rel)
+            key.append(key.empty() ? "" : "/").append(c);
+        auto it = files.find(key);
+        return it != files.end() && *manifest.stat(it->second) == st ? &manifest.node(it->second) : nullptr;
+    }
+};
+
+// --- pack pipeline ---
+// walk (calling thread) -> read + hash + dedup claim + compress (N workers) -> append records + fill manifest (writer thread)
+//
+// With an asynchronous I/O backend (--io threads|uring) reading moves out of the workers into a read-ahead stage:
+// walk -> read (FileLoader, many files in flight) -> hash + claim + compress (N workers) -> writer thread.
+//
+// Every unique hash is compressed once, by whichever worker claims it first. The writer appends a record the
+// first time it commits a job carrying that hash, so with --deterministic (sorted walk, commits in walk order)
+// the archive is byte-identical whatever the thread count.
+//
+// Files above the stream threshold (or the whole in-flight budget) skip the workers: the writer thread reads,
+// hashes and compresses them piecewise straight into a record, using zstd's own worker threads, and rolls the
+// record back if the content turns out to be a duplicate. Memory stays at a few fixed buffers per file.
+//
+// In chunked mode files are cut with FastCDC and every chunk is a blob of its own (claimed, compressed and
+// written exactly like a whole file); the manifest stores the file as the list of its chunk digests.
+// Streamed files are chunked by the writer thread through a sliding window of a few max-size chunks.
+//
+// Dedup trusts the 128-bit digest. With --verify every hit is re-read and compared byte for byte with the
+// file region the blob was first made from, and a mismatch aborts the pack.
+//
+// With a base archive the walker passes unchanged files straight to the writer, which copies their digests from
+// the base manifest; claimed blobs the base already holds are neither compressed nor written.
+// With a hash cache a whole file whose cached digest is already claimed (or in the base) is never read either,
+// and a cache hit on new content skips the hashing.
+//
+// Symbolic links are recorded as links (never followed), and every node gets its mode, owner and times, taken from
+// the walker's (l)stat, in the metadata table; the writer files both under the node it creates.
+//
+// A file with holes (see sparseFile.hpp) gets its extent map from the walker; from then on its "content" is its packed
+// bytes, the data extents back to back, which are hashed, deduplicated and compressed as one whole blob (never chunked),
+// so the holes cost nothing. Sparse files skip the read-ahead loader and --similar.
+//
+// A file with several hard links is read once: the walker remembers the first path of each (device, inode) and
+// passes the later ones straight to the writer, which adds them as Link nodes once every file is in.
+//
+// With --similar the worker of a file that has an anchor also reads the anchor and claims its blob, so the prefix
+// is sure to be stored; the job carries that blob to the writer, which writes it first if nothing else did.
+//
+// The writer adds a file's node before writing its blobs. In the stream layout (see archiver.hpp) that puts the
+// entries of the nodes added since the last flush just ahead of each record or solid block; a streamed file's record
+// is held back by the archive writer until its node, which needs the digest, is in.
+class PackPipeline
+{
+    // where a blob's bytes were first seen
+    struct Source
+    {
+        fs::path path;
+        uint64_t offset = 0;
+        uint64_t size   = 0;
+        std::optional<SparseMap> sparse{}; // offset and size are into the packed bytes of this map
+    };
+
+    struct Blob
+    {
+        std::mutex m;
+        std::condition_variable cv;
+        bool ready = false;
+        std::string comp; // or, for solid blocks, the raw bytes
+        uint64_t usize = 0;
+        bool solid     = false;
+        Codec codec    = Codec::Zstd; // of comp; Store when the data didn't compress
+        bool in_base   = false; // stored in the base archive, nothing to write
+        std::optional<Digest> ref; // compressed with this blob's content as prefix
+        std::exception_ptr error;
+        Source src; // set by the claimer, before the blob is shared
+
+        bool written = false; // writer thread only
+    };
+
+    // Raw members collecting into one solid block (one group per file extension)
+    struct SolidGroup
+    {
+        std::string data;
+        std::vector<SolidMember> members;
+    };
+    static constexpr size_t MAX_SOLID_GROUPS = 8; // open groups; the fullest is flushed to make room
+
+    // --similar: the first file seen with a similarity key
+    struct Anchor
+    {
+        fs::path path;
+        uint64_t size;
+    };
+
+    // An anchor's content as read by a worker, for compressing against it
+    struct Reference
+    {
+        Digest hash;
+        std::string data;
+    };
+
+    static constexpr uint64_t NO_LINK = UINT64_MAX;
+
+    struct Job
+    {
+        uint64_t seq = 0;
+        fs::path path;
+        std::vector<std::string> rel; // path components below the packed root
+        bool is_dir     = false;
+        bool streamed   = false;
+        uint64_t charge = 0; // bytes taken from the in-flight budget
+        Manifest::Stat stat{};
+        uint64_t dev                    = 0;
+        const Manifest::Node* unchanged = nullptr; // incremental mode: the file's node in the base manifest
+        bool cached                     = false;   // hash taken from the hash cache
+        const Anchor* anchor            = nullptr; // --similar: the file to compress against
+        uint64_t link_to                = NO_LINK; // a hard link: seq of the first path to the same inode
+        bool link_target                = false;   // the first of several hard links, its node is remembered
+        std::optional<SparseMap> sparse;           // a file with holes: its data extents
+        std::optional<std::string> symlink;        // a symbolic link: its target
+        FileMeta meta;
+        Digest hash;
+        std::string data; // read ahead by the loader (asynchronous I/O only)
+        std::shared_ptr<Blob> blob;
+        std::shared_ptr<Blob> ref_blob;                               // the anchor's blob
+        Digest ref_hash;
+        std::vector<std::pair<Digest, std::shared_ptr<Blob>>> chunks; // chunked mode
+        std::exception_ptr error;
+
+        // Bytes making up the content: the file's size, or a sparse file's data.
+        uint64_t bytes() const { return sparse ? sparse->data_size() : stat.size; }
+    };
+
+    const PackOptions& opts;
+    ArchiveWriter& writer;
+    Manifest& manifest;
+    const PackBase* base;
+    HashCache* cache;
+    MetaTable* meta;
+    PipelineStats* stats; // the writer's, null unless asked for
+
+    ByteBudget budget;
+    BufferPool buffers; // compressed records, files read ahead, solid block contents
+    BlockingQueue<Job> todo;
+    BlockingQueue<Job> loaded; // asynchronous I/O: read, waiting for a worker
+    BlockingQueue<Job> done;
+
+    std::mutex claims_m;
+    std::unordered_map<Digest, std::shared_ptr<Blob>> claims; // digest -> blob, first claimer compresses
+
+    std::optional<FastCdc> cdc; // chunked mode
+
+    // dictionary mode: shared read-only by all compressing threads
+    std::unique_ptr<ZSTD_CDict, size_t (*)(ZSTD_CDict*)> cdict{nullptr, ZSTD_freeCDict};
+
+    // writer thread only: streaming compression of large files and solid blocks, and streamed chunks in chunked mode
+    Compressor stream_ctx;
+    Compressor chunk_ctx;
+    std::string stream_in, stream_out;
+    std::map<std::string, SolidGroup> groups;
+
+    std::atomic<bool> failed{false};
+    std::exception_ptr first_error; // writer thread only
+    uint64_t next_seq = 0;          // walker thread only
+    uint64_t walked   = 0;          // walker thread only: bytes of the files found
+    std::unordered_map<std::string, Anchor> anchors; // walker inserts; nodes are stable and read by the workers
+    std::map<std::pair<uint64_t, uint64_t>, uint64_t> inodes; // walker thread only: (dev, inode) -> seq of the first path
+    std::unordered_map<uint64_t, uint32_t> link_nodes;        // writer thread only: link target seq -> its node
+    std::vector<Job> links;                                   // writer thread only: added after everything else
+
+    // Name storage of committed jobs, handed back to the walker: assigning a path into storage that held one of a
+    // similar length allocates nothing.
+    struct Names
+    {
+        fs::path path;
+        std::vector<std::string> rel;
+    };
+    static constexpr size_t MAX_SPARE_NAMES = 1024;
+    std::mutex names_m;
+    std::vector<Names> spare_names;
+    Manifest::Mark flushed;                                   // writer thread only: stream layout, entries written
+
+    void walk(const fs::path& dir, std::vector<std::string>& rel)
+    {
+        std::vector<fs::directory_entry> entries(fs::directory_iterator(dir), fs::directory_iterator{});
+        if (opts.similar)
+            std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) {
+                auto key = [](auto& e) { return std::pair(similarity_key(e.path().filename().string()), e.path().filename()); };
+                return key(a) < key(b);
+            });
+        else if (opts.deterministic)
+            std::sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.path().filename() < b.path().filename(); });
+
+        for (auto& e : entries)
+        {
+            if (failed)
+                return;
+
+            if (e.is_symlink())
+            {
+                Job job = new_job(rel, e.path());
+                job.symlink = fs::read_symlink(e.path()).string();
+                stat_entry(e.path(), job, ::lstat);
+                done.push(std::move(job)); // nothing to read, straight to the writer
+            }
+            else if (e.is_directory())
+            {
+                rel.push_back(e.path().filename().string());
+                Job job    = new_job(rel);
+                job.is_dir = true;
+                stat_entry(e.path(), job, ::lstat);
+                done.push(std::move(job)); // nothing to read, straight to the writer
+                walk(e.path(), rel);
+                rel.pop_back();
+            }
+            else if (e.is_regular_file())
+            {
+                Job job  = new_job(rel, e.path());
+                job.path = e.path();
+
+                struct stat st = stat_entry(e.path(), job, ::stat);
+                job.dev        = st.st_dev;
+                if (stats)
+                {
+                    stats->count(Count::FilesTotal);
+                    stats->count(Count::BytesTotal, job.stat.size);
+                }
+                if (st.st_nlink > 1)
+                {
+                    auto [it, first] = inodes.try_emplace({job.dev, job.stat.inode}, job.seq);
+                    job.link_to      = first ? NO_LINK : it->second;
+                    job.link_target  = first;
+                    if (!first)
+                    {
+                        done.push(std::move(job)); // nothing to read, linked to the first path
+                        continue;
+                    }
+                }
+                const Anchor* anchor = has_holes(st) ? nullptr : anchor_for(e.path(), job.stat.size); // unchanged files are anchors too
+                if (base && (job.unchanged = base->unchanged(job.rel, job.stat)))
+                {
+                    done.push(std::move(job)); // nothing to read, straight to the writer
+                    continue;
+                }
+                if (has_holes(st))
+                    job.sparse = sparse_map(job.path, job.stat.size);
+                if (cache && !opts.verify && (job.sparse || whole_file(job.stat.size)))
+                {
+                    if (auto hit = cache->find(job.dev, job.stat.inode, job.stat.size, job.stat.mtime_ns))
+                    {
+                        job.hash   = hit->hash;
+                        job.cached = true;
+                        if ((job.blob = known(job.hash)))
+                        {
+                            done.push(std::move(job));
+                            continue;
+                        }
+                    }
+                }
+
+                uint64_t size = job.bytes();
+                walked += size;
+                if (size > opts.stream_threshold || size > opts.inflight_bytes)
+                {
+                    job.streamed = true;
+                    done.push(std::move(job));
+                    continue;
+                }
+                job.anchor = anchor;
+                job.charge = size + (anchor ? anchor->size : 0);
+                {
+                    StageTimer wait(stats, Stage::Wait);
+                    budget.acquire(job.charge);
+                }
+                if (opts.io != IoBackend::Sync && !job.sparse)
+                    job.data = buffers.take(size);
+                (job.sparse && opts.io != IoBackend::Sync ? loaded : todo).push(std::move(job)); // the loader reads whole files
+            }
+        }
+    }
+
+    // The next job, in spare name storage when there is some. Its rel is rel, followed by the name of entry unless
+    // that is empty.
+    Job new_job(const std::vector<std::string>& rel, const fs::path& entry = {})
+    {
+        Job job;
+        job.seq = next_seq++;
+        {
+            std::lock_guard lock(names_m);
+            if (!spare_names.empty())
+            {
+                job.path = std::move(spare_names.back().path);
+                job.rel  = std::move(spare_names.back().rel);
+                spare_names.pop_back();
+            }
+        }
+        job.path.clear(); // set by the caller for files
+        const std::string& full = entry.native();
+        job.rel.resize(rel.size() + !full.empty());
+        std::copy(rel.begin(), rel.end(), job.rel.begin());
+        if (!full.empty())
+            job.rel.back().assign(full, full.rfind('/') + 1);
+        return job;
+    }
+
+    // Gives the job's name storage back for new_job(); the job is done with.
+    void recycle(Job& job)
+    {
+        std::lock_guard lock(names_m);
+        if (spare_names.size() < MAX_SPARE_NAMES)
+            spare_names.push_back({std::move(job.path), std::move(job.rel)});
+    }
+
+    // Fills the job's stat and metadata from statfn (stat or lstat) of path; returns the raw stat.
+    struct stat stat_entry(const fs::path& path, Job& job, int (*statfn)(const char*, struct stat*)) const
+    {
+        struct stat st;
+        if (statfn(path.c_str(), &st) != 0)
+            throw std::runtime_error("Failed to stat file: " + path.string());
+        job.stat = {static_cast<uint64_t>(st.st_size), static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec, st.st_ino};
+        if (meta)
+            job.meta = capture_meta(path, st, opts.xattrs);
+        return st;
+    }
+
+    // The anchor a file of this size should be compressed against; null when there's none, or when the file becomes one.
+    const Anchor* anchor_for(const fs::path& path, uint64_t size)
+    {
+        if (!opts.similar || cdc || size < SIMILAR_MIN || size > opts.stream_threshold || (opts.solid && size <= opts.solid_max_file))
+            return nullptr;
+        auto [it, inserted] = anchors.try_emplace(similarity_key(path.filename().string()), Anchor{path, size});
+        const Anchor& a     = it->second;
+        return inserted || size > 2 * a.size || a.size > 2 * size ? nullptr : &a;
+    }
+
+    void work()
+    {
+        Compressor zctx{opts.codec, opts.level, opts.long_range};
+        std::string data; // reused across files
+        Reference ref;
+        const bool read_ahead = opts.io != IoBackend::Sync;
+        while (auto job = (read_ahead ? loaded : todo).pop())
+        {
+            try
+            {
+                if (!failed && !job->error)
+                {
+                    uint64_t start   = stats ? now_ns() : 0;
+                    const bool ahead = read_ahead && !job->sparse;
+                    if (!ahead)
+                    {
+                        StageTimer timer(stats, Stage::Read, job->bytes());
+                        if (job->sparse)
+                            load_packed(job->path, *job->sparse, data);
+                        else
+                            read_whole(job->path, job->stat.size, data);
+                    }
+                    process(*job, zctx, ahead ? job->data : data, ref);
+                    if (stats)
+                        stats->file_done(now_ns() - start);
+                }
+            }
+            catch (...)
+            {
+                job->error = std::current_exception();
+            }
+            buffers.give(std::exchange(job->data, {}));
+            done.push(std::move(*job));
+        }
+    }
+
+    // data is the file's content (a sparse file's packed bytes).
+    void process(Job& job, Compressor& zctx, const std::string& data, Reference& ref)
+    {
+        if (job.sparse || whole_file(data.size()))
+        {
+            if (!job.cached)
+                job.hash = hashed(data.data(), data.size());
+            if (job.anchor)
+            {
+                // anchors are never solid block members: both are above solid_max_file
+                {
+                    StageTimer timer(stats, Stage::Read, job.anchor->size);
+                    read_whole(job.anchor->path, job.anchor->size, ref.data);
+                }
+                ref.hash     = hashed(ref.data.data(), ref.data.size());
+                job.ref_hash = ref.hash;
+                job.ref_blob = claim(ref.hash, ref.data.data(), ref.data.size(), zctx, {job.anchor->path, 0, ref.data.size()});
+            }
+            const Reference* prefix = job.anchor && ref.hash != job.hash ? &ref : nullptr;
+            job.blob = claim(job.hash, data.data(), data.size(), zctx, {job.path, 0, data.size(), job.sparse}, opts.solid && data.size() <= opts.solid_max_file,
+                             prefix);
+            return;
+        }
+
+        for (size_t pos = 0; pos < data.size();)
+        {
+            size_t len = cut(data.data() + pos, data.size() - pos);
+            Digest h   = hashed(data.data() + pos, len);
+            job.chunks.emplace_back(h, claim(h, data.data() + pos, len, zctx, {job.path, pos, len}));
+            pos += len;
+        }
+    }
+
+    // Content digest of data, timed as hashing.
+    Digest hashed(const char* data, size_t size) const
+    {
+        StageTimer timer(stats, Stage::Hash, size);
+        return hash_bytes(opts.hash, data, size);
+    }
+
+    // Length of the next chunk at data (chunked mode); finding boundaries counts as hashing.
+    size_t cut(const char* data, size_t size) const
+    {
+        StageTimer timer(stats, Stage::Hash);
+        return cdc->cut(data, size);
+    }
+
+    // Whether a file of this size is one blob (else it's cut into chunks).
+    bool whole_file(uint64_t size) const { return !cdc || (opts.solid && size <= opts.solid_max_file); }
+
+    // The blob of a digest that is already claimed, or a stand-in for the base archive's copy; null if neither.
+    std::shared_ptr<Blob> known(const Digest& hash)
+    {
+        std::lock_guard lock(claims_m);
+        if (auto it = claims.find(hash); it != claims.end())
+            return it->second;
+        if (!base || !base->reader.find(hash))
+            return nullptr;
+        auto blob   = std::make_shared<Blob>();
+        blob->ready = blob->in_base = true;
+        claims.emplace(hash, blob);
+        return blob;
+    }
+
+    // The first caller for a digest compresses the data (against prefix, if given; or, for a solid block member, keeps
+    // it raw); everyone gets the shared blob.
+    std::shared_ptr<Blob> claim(const Digest& hash, const char* data, size_t size, Compressor& zctx, Source src, bool solid = false,
+                                const Reference* prefix = nullptr)
+    {
+        std::shared_ptr<Blob> blob;
+        bool owner = false;
+        {
+            std::lock_guard lock(claims_m);
+            auto [it, inserted] = claims.try_emplace(hash);
+            if (inserted)
+            {
+                it->second      = std::make_shared<Blob>();
+                it->second->src = std::move(src);
+                owner           = true;
+            }
+            blob = it->second;
+        }
+        if (!owner)
+        {
+            if (opts.verify)
+                verify(hash, blob->src, src, data);
+            return blob;
+        }
+
+        Blob& b = *blob;
+        StageTimer timer(stats, Stage::Compress, size);
+        try
+        {
+            Gain gain = Gain::Normal;
+            b.codec   = zctx.codec();
+            b.comp    = buffers.take(size);
+            if (base && base->reader.find(hash))
+                b.in_base = true;
+            else if (b.codec == Codec::Store || (!prefix && (gain = probe_gain(data, size)) == Gain::None))
+                b.codec = Codec::Store; // incompressible data stays out of solid blocks too; the probe can't see a prefix's worth
+            else if (solid)
+                b.comp.assign(data, size);
+            else
+            {
+                if (prefix)
+                    zctx.compress_with_prefix(data, size, b.comp, gain == Gain::Low, prefix->data);
+                else
+                    zctx.compress(data, size, b.comp, gain == Gain::Low, size <= opts.dict_max_file ? cdict.get() : nullptr);
+                if (b.comp.size() >= size)
+                    b.codec = Codec::Store;
+                else if (prefix)
+                    b.ref = prefix->hash;
+            }
+            if (b.codec == Codec::Store)
+                b.comp.assign(data, size);
+            b.usize = size;
+            b.solid = solid && !b.in_base && b.codec != Codec::Store;
+        }
+        catch (...)
+        {
+            b.error = std::current_exception();
+        }
+        {
+            std::lock_guard lock(b.m);
+            b.ready = true;
+        }
+        b.cv.notify_all();
+        return blob;
+    }
+
+    void write_loop()
+    {
+        std::map<uint64_t, Job> pending; // out-of-order arrivals, deterministic mode only
+        uint64_t expected = 0;
+        while (auto job = done.pop())
+        {
+            if (!opts.deterministic)
+            {
+                commit(*job);
+                continue;
+            }
+            if (job->seq == expected) // the usual case, no node in pending
+            {
+                commit(*job);
+                ++expected;
+            }
+            else
+                pending.emplace(job->seq, std::move(*job));
+            for (auto it = pending.begin(); it != pending.end() && it->first == expected; ++expected)
+            {
+                commit(it->second);
+                it = pending.erase(it);
+            }
+        }
+
+        try
+        {
+            while (!failed && !groups.empty())
+                flush_group(groups.begin());
+            for (size_t i = 0; !failed && i < links.size(); ++i)
+                append_link(links[i]);
+            if (!failed)
+                flush_entries();
+        }
+        catch (...)
+        {
+            if (!first_error)
+                first_error = std::current_exception();
+            failed = true;
+        }
+    }
+
+    void commit(Job& job)
+    {
+        try
+        {
+            if (job.error)
+                std::rethrow_exception(job.error);
+            if (stats && !failed && !job.is_dir && !job.symlink)
+            {
+                stats->count(Count::Files);
+                stats->count(Count::Bytes, job.stat.size);
+            }
+            if (!failed && job.link_to != NO_LINK)
+                links.push_back(std::move(job));
+            else if (!failed)
+            {
+                size_t node = append(job);
+                if (job.link_target)
+                    link_nodes.emplace(job.seq, static_cast<uint32_t>(node));
+                if (meta)
+                    meta->set(node, std::move(job.meta));
+            }
+        }
+        catch (...)
+        {
+            if (!first_error)
+                first_error = std::current_exception();
+            failed = true;
+        }
+        budget.release(job.charge);
+        recycle(job);
+    }
+
+    // Adds the job's node (writing what it needs first); returns the node's index.
+    size_t append(Job& job)
+    {
+        uint32_t parent = Manifest::ROOT;
+        size_t depth    = job.is_dir ? job.rel.size() : job.rel.size() - 1;
+        for (size_t i = 0; i < depth; ++i)
+            parent = manifest.dir(parent, job.rel[i]);
+        if (job.is_dir)
+            return parent - 1; // slot to index
+        append_file(parent, job);
+        return manifest.size() - 1;
+    }
+
+    void append_file(uint32_t parent, Job& job)
+    {
+        if (job.symlink)
+        {
+            manifest.add_symlink(parent, job.rel.back(), *job.symlink, job.stat);
+            return;
+        }
+        if (job.unchanged)
+        {
+            deduplicated(job.stat.size);
+            const Manifest::Node& n = base->manifest.target(*job.unchanged);
+            if (n.kind == Manifest::Kind::File)
+            {
+                manifest.add_file(parent, job.rel.back(), base->manifest.digest(n), job.stat);
+                remember(job, base->manifest.digest(n));
+            }
+            else if (n.kind == Manifest::Kind::Sparse)
+            {
+                manifest.add_sparse(parent, job.rel.back(), base->manifest.digest(n), base->manifest.sparse(n), job.stat);
+                remember(job, base->manifest.digest(n));
+            }
+            else
+                manifest.add_chunked(parent, job.rel.back(), base->manifest.chunks(n), job.stat);
+            return;
+        }
+        if (job.streamed)
+        {
+            // the stream layout wants the node ahead of the record, but the node needs the digest: hold the record back
+            if (writer.stream_layout())
+                writer.hold();
+            if (cdc && !job.sparse)
+                manifest.add_chunked(parent, job.rel.back(), append_streamed_chunks(job), job.stat);
+            else
+            {
+                append_streamed(job);
+                add_file(parent, job);
+                remember(job, job.hash);
+            }
+            if (writer.stream_layout())
+                writer.release(manifest.entries(flushed));
+            return;
+        }
+        // nodes go first, so that in the stream layout their entries precede the records
+        if (cdc && !job.blob)
+        {
+            std::vector<Digest> list;
+            list.reserve(job.chunks.size());
+            for (auto& [h, blob] : job.chunks)
+                list.push_back(h);
+            manifest.add_chunked(parent, job.rel.back(), list, job.stat);
+            for (auto& [h, blob] : job.chunks)
+                if (!write_blob(h, *blob, job.path))
+                    deduplicated(blob->usize);
+            return;
+        }
+
+        add_file(parent, job);
+        if (job.ref_blob)
+            write_blob(job.ref_hash, *job.ref_blob, job.path);
+        if (!write_blob(job.hash, *job.blob, job.path))
+            already_added(job);
+        remember(job, job.hash);
+    }
+
+    // A file or chunk whose content needed no new record.
+    void deduplicated(uint64_t bytes)
+    {
+        if (!stats)
+            return;
+        stats->count(Count::DedupHits);
+        stats->count(Count::DedupBytes, bytes);
+    }
+
+    void already_added(const Job& job)
+    {
+        deduplicated(job.bytes());
+        if (opts.verbose > 0)
+            std::cout << "file: " << job.path << " already added.\n";
+    }
+
+    // The node of a whole-blob file, sparse or not.
+    void add_file(uint32_t parent, const Job& job)
+    {
+        if (job.sparse)
+            manifest.add_sparse(parent, job.rel.back(), job.hash, *job.sparse, job.stat);
+        else
+            manifest.add_file(parent, job.rel.back(), job.hash, job.stat);
+    }
+
+    // Stream layout: the entries of the nodes added since the last call, ahead of a record or block that may need them.
+    // While the writer holds frames back, release() writes them instead.
+    void flush_entries()
+    {
+        if (writer.stream_layout() && !writer.holding() && flushed.nodes < manifest.size())
+            writer.write_entries(manifest.entries(flushed));
+    }
+
+    // A hard link to a file appended earlier; its parent directories all exist by now.
+    void append_link(const Job& job)
+    {
+        uint32_t parent = Manifest::ROOT;
+        for (size_t i = 0; i + 1 < job.rel.size(); ++i)
+            parent = manifest.dir(parent, job.rel[i]);
+        manifest.add_link(parent, job.rel.back(), link_nodes.at(job.link_to), job.stat);
+        if (meta)
+            meta->set(manifest.size() - 1, job.meta);
+    }
+
+    void remember(const Job& job, const Digest& hash)
+    {
+        if (!cache)
+            return;
+        const IndexEntry* e = writer.find(hash);
+        cache->record({job.dev, job.stat.inode, job.stat.size, job.stat.mtime_ns, hash, e && e->block == NO_BLOCK ? e->csize : 0});
+    }
+
+    // Throws unless the hit's bytes (in memory when data is set, else read from hit) equal the blob's source.
+    static void verify(const Digest& hash, const Source& src, const Source& hit, const char* data)
+    {
+        bool same = src.size == hit.size;
+        ExtentReader a(src.path, src.sparse ? &*src.sparse : nullptr);
+        std::optional<ExtentReader> b;
+        if (!data)
+            b.emplace(hit.path, hit.sparse ? &*hit.sparse : nullptr);
+
+        char abuf[1 << 16], bbuf[1 << 16];
+        for (uint64_t pos = 0; same && pos < src.size;)
+        {
+            size_t n = std::min<uint64_t>(src.size - pos, sizeof(abuf));
+            if (a.read_at(src.offset + pos, abuf, n) != n)
+                throw std::runtime_error("Failed to read file: " + src.path.string());
+            const char* other = data;
+            if (!data)
+            {
+                if (b->read_at(hit.offset + pos, bbuf, n) != n)
+                    throw std::runtime_error("Failed to read file: " + hit.path.string());
+                other = bbuf;
+            }
+            else
+                data += n;
+            same = std::memcmp(abuf, other, n) == 0;
+            pos += n;
+        }
+        if (!same)
+            throw std::runtime_error("content mismatch for digest " + hash.hex() + " between " + src.path.string() + " and " + hit.path.string() +
+                                     " (hash collision, or a file changed while packing)");
+    }
+
+    // Appends the blob's record unless an earlier job already did or the base archive has it. Returns whether it was
+    // written now. file is the path of the job being committed: the blob's own source is whichever worker claimed it
+    // first, which depends on the thread count.
+    bool write_blob(const Digest& hash, Blob& b, const fs::path& file)
+    {
+        if (b.written)
+            return false;
+        {
+            StageTimer wait(stats, Stage::Wait);
+            std::unique_lock lock(b.m);
+            b.cv.wait(lock, [&] { return b.ready; });
+        }
+        if (b.error)
+            std::rethrow_exception(b.error);
+        if (b.solid)
+            add_to_group(hash, b, file.extension().string());
+        else if (!b.in_base)
+        {
+            flush_entries();
+            writer.write_record(hash, b.usize, b.comp, b.codec);
+        }
+        if (b.ref)
+            writer.add_reference(hash, *b.ref);
+        b.written = true;
+        buffers.give(std::exchange(b.comp, {}));
+        return !b.in_base;
+    }
+
+    // Similar files compress best together, so members are grouped by extension (key).
+    void add_to_group(const Digest& hash, const Blob& b, std::string key)
+    {
+        auto it = groups.find(key);
+        if (it == groups.end())
+        {
+            if (groups.size() == MAX_SOLID_GROUPS)
+                flush_group(std::max_element(groups.begin(), groups.end(), [](auto& a, auto& c) { return a.second.data.size() < c.second.data.size(); }));
+            it              = groups.try_emplace(std::move(key)).first;
+            it->second.data = buffers.take(opts.solid_block + opts.solid_max_file);
+        }
+
+        SolidGroup& g = it->second;
+        g.members.push_back({hash, g.data.size(), b.usize});
+        g.data += b.comp;
+        if (g.data.size() >= opts.solid_block)
+            flush_group(it);
+    }
+
+    // One frame per block, compressed with the (for zstd multi-threaded) stream context: blocks are written from the writer thread.
+    void flush_group(std::map<std::string, SolidGroup>::iterator it)
+    {
+        SolidGroup& g = it->second;
+        {
+            StageTimer timer(stats, Stage::Compress, g.data.size());
+            stream_ctx.compress(g.data.data(), g.data.size(), stream_out);
+        }
+        flush_entries();
+        writer.write_solid_block(g.data.size(), stream_out, g.members);
+        buffers.give(std::move(g.data));
+        groups.erase(it);
+    }
+
+    std::vector<Digest> append_streamed_chunks(Job& job)
+    {
+        uint64_t began = stats ? now_ns() : 0;
+        std::ifstream ifs(job.path, std::ios::binary);
+        if (!ifs)
+            throw std::runtime_error("Failed to open file: " + job.path.string());
+
+        const size_t max_chunk = cdc->params().max;
+        stream_in.resize(std::max<size_t>(4 * max_chunk, 1 << 20));
+
+        std::vector<Digest> list;
+        size_t start = 0, have = 0;
+        uint64_t stream_base = 0; // file offset of stream_in[0]
+        bool eof             = false;
+        while (true)
+        {
+            if (!eof && have - start < max_chunk)
+            {
+                std::memmove(stream_in.data(), stream_in.data() + start, have - start);
+                stream_base += start;
+                have -= start;
+                start = 0;
+                StageTimer timer(stats, Stage::Read);
+                ifs.read(stream_in.data() + have, stream_in.size() - have);
+                timer.add_bytes(ifs.gcount());
+                if (ifs.bad())
+                    throw std::runtime_error("Failed to read file: " + job.path.string());
+                eof = ifs.eof();
+                have += ifs.gcount();
+            }
+            if (start == have)
+                break;
+
+            const char* p = stream_in.data() + start;
+            size_t len    = cut(p, have - start);
+            Digest h      = hashed(p, len);
+            if (!write_blob(h, *claim(h, p, len, chunk_ctx, {job.path, stream_base + start, len}), job.path))
+                deduplicated(len);
+            list.push_back(h);
+            start += len;
+        }
+        if (stats)
+            stats->file_done(now_ns() - began);
+        return list;
+    }
+
+    // Reading, hashing and writing are timed as such; what's left of the time (probe, compression) as compressing.
+    void append_streamed(Job& job)
+    {
+        uint64_t began = stats ? now_ns() : 0;
+        StageTimer timer(stats, Stage::Compress, job.bytes());
+        ExtentReader in(job.path, job.sparse ? &*job.sparse : nullptr);
+
+        Gain gain = Gain::Normal;
+        if (job.bytes() >= PROBE_MIN)
+        {
+            gain = probe_gain(job.bytes(), [&](uint64_t off, std::string& buf) {
+                buf.resize(PROBE_SAMPLE);
+                if (in.read_at(off, buf.data(), buf.size()) != buf.size())
+                    throw std::runtime_error("Failed to read file: " + job.path.string());
+            });
+        }
+
+        const bool raw  = gain == Gain::None || stream_ctx.codec() == Codec::Store;
+        auto sink       = [&](const char* p, size_t n) { writer.append_payload(p, n); };
+        uint64_t offset = writer.begin_record(raw ? Codec::Store : stream_ctx.codec());
+        uint64_t usize  = 0;
+        ContentHasher h(opts.hash);
+        stream_in.resize(ZSTD_CStreamInSize());
+        if (!raw)
+            stream_ctx.begin(gain == Gain::Low, stream_out, sink);
+        bool last = false;
+        while (!last)
+        {
+            size_t n;
+            {
+                StageTimer read(stats, Stage::Read);
+                n = in.read_at(usize, stream_in.data(), stream_in.size());
+                read.add_bytes(n);
+            }
+            last = n < stream_in.size();
+            {
+                StageTimer hash(stats, Stage::Hash, n);
+                h.update(stream_in.data(), n);
+            }
+            usize += n;
+            if (raw)
+                writer.append_payload(stream_in.data(), n);
+            else
+                stream_ctx.update(stream_in.data(), n, stream_out, sink);
+        }
+        if (!raw)
+            stream_ctx.end(stream_out, sink);
+        job.hash = h.digest();
+
+        Source src{job.path, 0, usize, job.sparse};
+        std::shared_ptr<Blob> blob;
+        bool owner = false;
+        {
+            std::lock_guard lock(claims_m);
+            auto [it, inserted] = claims.try_emplace(job.hash);
+            if (inserted)
+            {
+                it->second        = std::make_shared<Blob>();
+                it->second->ready = it->second->written = true;
+                it->second->src                         = src;
+                owner                                   = true;
+            }
+            blob = it->second;
+        }
+        if (owner && !(base && base->reader.find(job.hash)))
+        {
+            writer.end_record(offset, job.hash, usize);
+        }
+        else if (owner)
+        {
+            writer.rollback(offset);
+            deduplicated(usize);
+        }
+        else
+        {
+            if (opts.verify)
+                verify(job.hash, blob->src, src, nullptr);
+            writer.rollback(offset);
+            already_added(job);
+        }
+        if (stats)
+            stats->file_done(now_ns() - began);
+    }
+
+public:
+    PackPipeline(const PackOptions& options, ArchiveWriter& w, Manifest& m, const PackBase* b, HashCache* c, MetaTable* t)
+        : opts(options)
+        , writer(w)
+        , manifest(m)
+        , base(b)
+        , cache(c)
+        , meta(t)
+        , stats(w.stats())
+        , budget(options.inflight_bytes)
+        , buffers(std::min<uint64_t>(options.inflight_bytes, POOL_BYTES))
+        , stream_ctx(options.codec, options.level, options.long_range, std::max(1u, options.threads))
+        , chunk_ctx(options.codec, options.level, options.long_range)
+    {
+        if (stats)
+        {
+            todo.report_depth(&stats->queue(Queue::Todo));
+            loaded.report_depth(&stats->queue(Queue::Loaded));
+            done.report_depth(&stats->queue(Queue::Done));
+        }
+        if (opts.chunked)
+            cdc.emplace(opts.chunk);
+        // small jobs keep per-worker memory at a few MB; the split (and so the output) doesn't depend on nbWorkers
+        ZSTD_CCtx_setParameter(stream_ctx.zstd_ctx().compressor(), ZSTD_c_jobSize, 4 << 20);
+    }
+
+    void run(const fs::path& dir)
+    {
+        if (base)
+            writer.write_base_link(base->path);
+        // small files go into solid blocks, which the dictionary would not help; only zstd uses one
+        if (opts.dictionary && !opts.solid && opts.codec == Codec::Zstd)
+        {
+            std::string dict = DictionaryTrainer(opts).train(dir);
+            if (!dict.empty())
+            {
+                cdict.reset(ZSTD_createCDict(dict.data(), dict.size(), stream_ctx.zstd_ctx().default_level()));
+                if (!cdict)
+                    throw std::runtime_error("Failed to create ZSTD_CDict");
+                writer.write_block("DICT", dict);
+            }
+        }
+
+        std::optional<FileLoader<Job>> loader;
+        if (opts.io != IoBackend::Sync)
+            loader.emplace(opts.io, opts.io_depth, todo, loaded);
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < std::max(1u, opts.threads); ++i)
+            workers.emplace_back([this] { work(); });
+        std::thread writer_thread([this] { write_loop(); });
+
+        std::exception_ptr walk_error;
+        try
+        {
+            StageTimer timer(stats, Stage::Walk);
+            std::vector<std::string> rel;
+            walk(dir, rel);
+            timer.add_bytes(walked);
+            if (stats)
+                stats->found_all();
+        }
+        catch (...)
+        {
+            walk_error = std::current_exception();
+            failed     = true;
+        }
+
+        todo.close();
+        if (loader)
+            loader->join();
+        loaded.close();
+        for (auto& t : workers)
+            t.join();
+        done.close();
+        writer_thread.join();
+
+        if (walk_error)
+            std::rethrow_exception(walk_error);
+        if (first_error)
+            std::rethrow_exception(first_error);
+    }
+};
+
+static void build_structure(const fs::path& dir, Manifest& manifest, ArchiveWriter& writer, const PackOptions& opts, const PackBase* base = nullptr,
+                            HashCache* cache = nullptr, MetaTable* meta = nullptr)
+{
+    PackPipeline pipeline(opts, writer, manifest, base, cache, meta);
+    pipeline.run(dir);
+}
@@ -0,0 +1,303 @@
+#pragma once
+#include "blockingQueue.hpp"
+#include "miniJson.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+// --- pipeline statistics ---
+// Time and bytes per pipeline stage, summed over the threads running it, the latency of every file, a few event
+// counters and the depth of the pipeline's queues. The pipelines take a PipelineStats pointer that stays null unless
+// numbers were asked for (--progress, --stats=json, bench); then a StageTimer does nothing, not even read the clock,
+// and every other hook is one pointer test. Stage times are exclusive: a timer running inside another (an archive
+// write issued from the compressor's output callback, a wait for another stage) is taken out of the outer stage's
+// time. Read and Write are time in I/O calls, Hash, Compress and Decompress time on the CPU.
+enum class Stage : uint8_t
+{
+    Walk,       // pack: listing directories and stat-ing files
+    Read,       // pack: reading file content
+    Hash,       // pack: content digests
+    Compress,   // pack: probing and compressing (solid blocks included)
+    Write,      // pack: appending to the archive; unpack: writing restored files
+    Index,      // unpack: opening the archive, parsing its index and manifest, planning the work
+    Decompress, // unpack: reading and decoding blobs
+    Wait,       // blocked on another stage: the in-flight budget, a blob still being compressed
+};
+
+inline constexpr size_t STAGE_COUNT = static_cast<size_t>(Stage::Wait) + 1;
+
+inline const char* stage_name(Stage s)
+{
+    static constexpr const char* names[STAGE_COUNT] = {"walk", "read", "hash", "compress", "write", "index", "decompress", "wait"};
+    return names[static_cast<size_t>(s)];
+}
+
+enum class Count : uint8_t
+{
+    Files,      // files done: committed to the archive, or restored
+    Bytes,      // their bytes (apparent size when packing, content restored when unpacking)
+    FilesTotal, // files found so far (pack: by the walk), or to restore
+    BytesTotal,
+    DedupHits,  // pack: files or chunks whose content was already stored (in this archive or its base)
+    DedupBytes,
+};
+
+inline constexpr size_t COUNT_COUNT = static_cast<size_t>(Count::DedupBytes) + 1;
+
+inline const char* count_name(Count c)
+{
+    static constexpr const char* names[COUNT_COUNT] = {"files", "bytes", "files_total", "bytes_total", "dedup_hits", "dedup_bytes"};
+    return names[static_cast<size_t>(c)];
+}
+
+// Pack pipeline queues: walked files waiting to be read (or, with synchronous I/O, read and compressed), files read
+// ahead waiting for a worker, and finished files waiting for the writer.
+enum class Queue : uint8_t
+{
+    Todo,
+    Loaded,
+    Done,
+};
+
+inline constexpr size_t QUEUE_COUNT = static_cast<size_t>(Queue::Done) + 1;
+
+inline const char* queue_name(Queue q)
+{
+    static constexpr const char* names[QUEUE_COUNT] = {"todo", "loaded", "done"};
+    return names[static_cast<size_t>(q)];
+}
+
+inline uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class PipelineStats
+{
+public:
+    struct Counter
+    {
+        std::atomic<uint64_t> ns{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> calls{0};
+    };
+
+private:
+    std::array<Counter, STAGE_COUNT> stages;
+    std::array<std::atomic<uint64_t>, COUNT_COUNT> counts{};
+    std::array<QueueGauge, QUEUE_COUNT> queues;
+    std::atomic<bool> all_found{false}; // FilesTotal and BytesTotal are final
+    std::mutex latency_m;
+    std::vector<uint64_t> latencies; // ns per file, in completion order
+
+public:
+    void add(Stage s, uint64_t ns, uint64_t bytes)
+    {
+        Counter& c = stages[static_cast<size_t>(s)];
+        c.ns.fetch_add(ns, std::memory_order_relaxed);
+        c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        c.calls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Time from a file's first byte read (pack) or decoded (unpack) to its last one handled.
+    void file_done(uint64_t ns)
+    {
+        std::lock_guard lock(latency_m);
+        latencies.push_back(ns);
+    }
+
+    void count(Count c, uint64_t n = 1) { counts[static_cast<size_t>(c)].fetch_add(n, std::memory_order_relaxed); }
+    uint64_t get(Count c) const { return counts[static_cast<size_t>(c)].load(std::memory_order_relaxed); }
+
+    void found_all() { all_found = true; }
+    bool totals_final() const { return all_found; }
+
+    QueueGauge& queue(Queue q) { return queues[static_cast<size_t>(q)]; }
+
+    const Counter& stage(Stage s) const { return stages[static_cast<size_t>(s)]; }
+
+    size_t files()
+    {
+        std::lock_guard lock(latency_m);
+        return latencies.size();
+    }
+
+    // The latency below which a fraction p (0-1) of the files completed; 0 when there were none.
+    uint64_t latency_percentile(double p)
+    {
+        std::lock_guard lock(latency_m);
+        if (latencies.empty())
+            return 0;
+        size_t k = std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+        std::nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+        return latencies[k];
+    }
+
+    /**
+     * The stages given (time, bytes, throughput per thread), the counters, the queues' peak depths, the per-file
+     * latency percentiles, and the time in I/O calls, on the CPU and waiting, summed over the stages.
+     */
+    mini_json::object to_json(std::initializer_list<Stage> shown)
+    {
+        auto mib_per_s = [](uint64_t bytes, uint64_t ns) { return static_cast<double>(bytes) / (1 << 20) / (ns / 1e9); };
+        mini_json::object per_stage, counters, peaks;
+        uint64_t io = 0, cpu = 0;
+        for (Stage s : shown)
+        {
+            const Counter& c = stage(s);
+            mini_json::object o{{"seconds", c.ns / 1e9}, {"bytes", c.bytes.load()}};
+            if (c.bytes && c.ns)
+                o["mib_per_s"] = mib_per_s(c.bytes, c.ns);
+            per_stage[stage_name(s)] = std::move(o);
+            if (s == Stage::Read || s == Stage::Write)
+                io += c.ns;
+            else if (s == Stage::Hash || s == Stage::Compress || s == Stage::Decompress)
+                cpu += c.ns;
+        }
+        for (size_t c = 0; c < COUNT_COUNT; ++c)
+            counters[count_name(static_cast<Count>(c))] = counts[c].load();
+        for (size_t q = 0; q < QUEUE_COUNT; ++q)
+            if (uint64_t peak = queues[q].peak)
+                peaks[queue_name(static_cast<Queue>(q))] = peak;
+        mini_json::object out{
+            {"stages", std::move(per_stage)},
+            {"counters", std::move(counters)},
+            {"io_seconds", io / 1e9},
+            {"cpu_seconds", cpu / 1e9},
+            {"wait_seconds", stage(Stage::Wait).ns / 1e9},
+            {"latency_ms", mini_json::object{{"p50", latency_percentile(0.5) / 1e6}, {"p99", latency_percentile(0.99) / 1e6}}},
+        };
+        if (!peaks.empty())
+            out["queue_peaks"] = std::move(peaks);
+        return out;
+    }
+};
+
+inline constexpr std::initializer_list<Stage> PACK_STAGES   = {Stage::Walk, Stage::Read, Stage::Hash, Stage::Compress, Stage::Write, Stage::Wait};
+inline constexpr std::initializer_list<Stage> UNPACK_STAGES = {Stage::Index, Stage::Decompress, Stage::Write, Stage::Wait};
+
+// Adds the time from construction to destruction, less that of the timers nested inside, to a stage.
+class StageTimer
+{
+    static inline thread_local uint64_t nested = 0; // time of the timers finished inside the innermost running one
+
+    PipelineStats* stats;
+    Stage stage;
+    uint64_t bytes;
+    uint64_t start = 0;
+    uint64_t outer = 0; // the enclosing timer's nested time so far
+
+public:
+    StageTimer(PipelineStats* s, Stage st, uint64_t n = 0) : stats(s), stage(st), bytes(n)
+    {
+        if (!stats)
+            return;
+        outer = std::exchange(nested, 0);
+        start = now_ns();
+    }
+
+    StageTimer(const StageTimer&)            = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer()
+    {
+        if (!stats)
+            return;
+        uint64_t elapsed = now_ns() - start;
+        stats->add(stage, elapsed - std::min(elapsed, nested), bytes);
+        nested = outer + elapsed;
+    }
+
+    // For stages whose byte count is only known at the end.
+    void add_bytes(uint64_t n) { bytes += n; }
+};
+
+// --- progress display ---
+// A thread redrawing one status line on stderr from the counters: files and bytes done against the totals known so
+// far ("+" while the walk is still finding files), throughput since the start, and the time left at that rate once
+// the totals are final. On a terminal the line is redrawn in place four times a second, elsewhere a line is printed
+// every five seconds.
+class ProgressMeter
+{
+    PipelineStats& stats;
+    std::string label;
+    uint64_t start = now_ns();
+    bool tty       = ::isatty(STDERR_FILENO);
+    std::mutex m;
+    std::condition_variable cv;
+    bool stopping = false;
+    std::thread thread;
+
+    static std::string bytes_text(double b)
+    {
+        static constexpr const char* units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+        size_t u = 0;
+        for (; b >= 1024 && u + 1 < std::size(units); ++u)
+            b /= 1024;
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), u ? "%.1f %s" : "%.0f %s", b, units[u]);
+        return buf;
+    }
+
+    void draw(bool last)
+    {
+        double seconds = (now_ns() - start) / 1e9;
+        uint64_t files = stats.get(Count::Files), bytes = stats.get(Count::Bytes);
+        uint64_t total = stats.get(Count::BytesTotal);
+        bool final     = stats.totals_final();
+        double rate    = seconds > 0 ? bytes / seconds : 0;
+
+        char eta[32] = "";
+        if (!last && final && rate > 0 && total >= bytes)
+        {
+            auto left = static_cast<uint64_t>((total - bytes) / rate);
+            std::snprintf(eta, sizeof(eta), ", ETA %llu:%02llu", static_cast<unsigned long long>(left / 60), static_cast<unsigned long long>(left % 60));
+        }
+        const char* more = final ? "" : "+";
+        std::fprintf(stderr, "%s%s: %llu/%llu%s files, %s/%s%s, %s/s%s%s", tty ? "\r" : "", label.c_str(), static_cast<unsigned long long>(files),
+                     static_cast<unsigned long long>(stats.get(Count::FilesTotal)), more, bytes_text(bytes).c_str(), bytes_text(total).c_str(), more,
+                     bytes_text(rate).c_str(), eta, tty ? "\x1b[K" : "\n");
+        if (last && tty)
+            std::fputc('\n', stderr);
+        std::fflush(stderr);
+    }
+
+public:
+    ProgressMeter(PipelineStats& s, std::string name) : stats(s), label(std::move(name))
+    {
+        thread = std::thread([this] {
+            const auto interval = std::chrono::milliseconds(tty ? 250 : 5000);
+            std::unique_lock lock(m);
+            while (!cv.wait_for(lock, interval, [&] { return stopping; }))
+                draw(false);
+        });
+    }
+
+    ProgressMeter(const ProgressMeter&)            = delete;
+    ProgressMeter& operator=(const ProgressMeter&) = delete;
+
+    // Stops the display, leaving the final counts on the last line.
+    ~ProgressMeter()
+    {
+        {
+            std::lock_guard lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        thread.join();
+        draw(true);
+    }
+};
@@ -0,0 +1,245 @@
+#pragma once
+#include "asyncIo.hpp"
+#include "manifest.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// --- sparse files ---
+// A file with holes is packed as its data extents back to back (its "packed bytes") plus a SparseMap, so the holes
+// are never read, hashed, compressed or written back. Holes are found with SEEK_DATA/SEEK_HOLE; on restore the file is
+// sized with ftruncate and only the data is written, which leaves the rest unallocated. Zero blocks inside the data
+// extents (preallocated or zero-filled regions) become holes on restore too.
+
+// Files with less unallocated space than this are read as usual.
+inline constexpr uint64_t SPARSE_MIN_HOLES = 1 << 20;
+
+// Whether a file has at least SPARSE_MIN_HOLES bytes not backed by blocks, judging from its stat (st_blocks is in
+// 512-byte units). Cheap, and enough to leave dense files alone.
+inline bool has_holes(const struct stat& st)
+{
+    return st.st_size > 0 && static_cast<uint64_t>(st.st_blocks) * 512 + SPARSE_MIN_HOLES <= static_cast<uint64_t>(st.st_size);
+}
+
+/**
+ * The data extents of the first size bytes of path. nullopt when the file turns out dense after all, or the
+ * filesystem can't tell (no SEEK_DATA support).
+ */
+inline std::optional<SparseMap> sparse_map(const std::filesystem::path& path, uint64_t size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw file_error("Failed to open file: ", path, errno);
+    SparseMap map{size, {}};
+    for (off_t pos = 0; static_cast<uint64_t>(pos) < size;)
+    {
+        off_t data = ::lseek(fd, pos, SEEK_DATA);
+        if (data < 0 && errno != ENXIO) // ENXIO: only a hole up to the end
+        {
+            ::close(fd);
+            return std::nullopt;
+        }
+        if (data < 0 || static_cast<uint64_t>(data) >= size)
+            break;
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        uint64_t end = hole < 0 ? size : std::min<uint64_t>(hole, size);
+        map.extents.push_back({static_cast<uint64_t>(data), end - data});
+        pos = static_cast<off_t>(end);
+    }
+    ::close(fd);
+    if (map.data_size() == size)
+        return std::nullopt;
+    return map;
+}
+
+// Positioned reads of a file's packed bytes (the whole file when there is no map).
+class ExtentReader
+{
+    std::filesystem::path path;
+    int fd      = -1;
+    bool sparse = false;
+    std::vector<Extent> extents;
+    std::vector<uint64_t> starts; // packed offset of each extent
+
+    size_t pread_full(uint64_t pos, char* dst, size_t n) const
+    {
+        size_t done = 0;
+        while (done < n)
+        {
+            ssize_t r = ::pread(fd, dst + done, n - done, static_cast<off_t>(pos + done));
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0)
+                throw file_error("Failed to read file: ", path, errno);
+            if (r == 0)
+                break;
+            done += r;
+        }
+        return done;
+    }
+
+public:
+    explicit ExtentReader(const std::filesystem::path& file, const SparseMap* map = nullptr) : path(file), sparse(map)
+    {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw file_error("Failed to open file: ", path, errno);
+        if (!map)
+            return;
+        extents         = map->extents;
+        uint64_t packed = 0;
+        for (auto& e : extents)
+            starts.push_back(std::exchange(packed, packed + e.length));
+    }
+
+    ExtentReader(const ExtentReader&)            = delete;
+    ExtentReader& operator=(const ExtentReader&) = delete;
+
+    ~ExtentReader() { ::close(fd); }
+
+    // Up to n packed bytes from packed offset pos; fewer only at the end of the data (or of a file that shrank).
+    size_t read_at(uint64_t pos, char* dst, size_t n) const
+    {
+        if (!sparse)
+            return pread_full(pos, dst, n);
+        size_t done = 0;
+        for (size_t i = std::upper_bound(starts.begin(), starts.end(), pos) - starts.begin(); i > 0 && i <= extents.size() && done < n; ++i)
+        {
+            const Extent& e = extents[i - 1];
+            uint64_t skip   = pos + done - starts[i - 1];
+            if (skip >= e.length) // pos is past the data
+                break;
+            size_t want     = std::min<uint64_t>(n - done, e.length - skip);
+            size_t got      = pread_full(e.offset + skip, dst + done, want);
+            done += got;
+            if (got < want)
+                break;
+        }
+        return done;
+    }
+};
+
+// Reads a sparse file's packed bytes into buf, which is resized and can be reused.
+inline void load_packed(const std::filesystem::path& path, const SparseMap& map, std::string& buf)
+{
+    resize_for_overwrite(buf, map.data_size());
+    if (ExtentReader(path, &map).read_at(0, buf.data(), buf.size()) != buf.size())
+        throw std::runtime_error("Failed to read file: " + path.string() + " (it shrank while packing)");
+}
+
+// A restored file, written front to back. With a SparseMap the bytes written are the packed bytes: each goes to its
+// place in an extent, and the file is sized on close(), so whatever wasn't written stays a hole.
+class FileSink
+{
+    static constexpr size_t ZERO_BLOCK = 4096; // all-zero blocks this size and aligned are skipped in sparse files
+
+    const std::filesystem::path& path; // for error messages
+    int fd               = -1;
+    const SparseMap* map = nullptr;
+    size_t extent        = 0; // sparse: current extent, and bytes of it written
+    uint64_t done        = 0;
+
+    void put(uint64_t pos, const char* p, size_t n)
+    {
+        for (size_t k = 0; k < n;)
+        {
+            ssize_t r = ::pwrite(fd, p + k, n - k, static_cast<off_t>(pos + k));
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                throw file_error("Failed to write file: ", path, r < 0 ? errno : EIO);
+            k += r;
+        }
+    }
+
+    // Writes [pos, pos + n) but for its aligned zero blocks.
+    void put_sparse(uint64_t pos, const char* p, size_t n)
+    {
+        static const char zeros[ZERO_BLOCK] = {};
+        size_t run = 0; // start of the pending nonzero run
+        for (size_t k = 0; k < n;)
+        {
+            size_t len = std::min<uint64_t>(n - k, ZERO_BLOCK - (pos + k) % ZERO_BLOCK);
+            if (len == ZERO_BLOCK && std::memcmp(p + k, zeros, len) == 0)
+            {
+                put(pos + run, p + run, k - run);
+                run = k + len;
+            }
+            k += len;
+        }
+        put(pos + run, p + run, n - run);
+    }
+
+public:
+    explicit FileSink(const std::filesystem::path& file, const SparseMap* sparse = nullptr) : path(file), map(sparse)
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0)
+            throw file_error("Failed to write file: ", path, errno);
+    }
+
+    // A restored file, created below dest (see OutputDir).
+    FileSink(const OutputDir& dest, const std::filesystem::path& file, const SparseMap* sparse = nullptr) : path(file), map(sparse)
+    {
+        fd = dest.create(path);
+        if (fd < 0)
+            throw file_error("Failed to write file: ", path, errno);
+    }
+
+    FileSink(const FileSink&)            = delete;
+    FileSink& operator=(const FileSink&) = delete;
+
+    ~FileSink()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    void write(const char* p, size_t n)
+    {
+        if (!map)
+        {
+            put(done, p, n);
+            done += n;
+            return;
+        }
+        while (n > 0)
+        {
+            if (extent == map->extents.size())
+                throw std::runtime_error("Failed to write file: " + path.string() + " (more data than its extents hold)");
+            const Extent& e = map->extents[extent];
+            size_t len      = std::min<uint64_t>(n, e.length - done);
+            put_sparse(e.offset + done, p, len);
+            p += len;
+            n -= len;
+            if ((done += len) == e.length)
+            {
+                ++extent;
+                done = 0;
+            }
+        }
+    }
+
+    // Sizes a sparse file (creating the trailing hole) and closes; throws on failure.
+    void close()
+    {
+        bool ok = !map || ::ftruncate(fd, static_cast<off_t>(map->size)) == 0;
+        int err = errno;
+        if (::close(std::exchange(fd, -1)) != 0 && ok)
+            ok = false, err = errno;
+        if (!ok)
+            throw file_error("Failed to write file: ", path, err);
+    }
+};
@@ -0,0 +1,666 @@
+#pragma once
+#include "archiver.hpp"
+#include "blockingQueue.hpp"
+#include "bufferPool.hpp"
+#include "manifest.hpp"
+#include "metadata.hpp"
+#include "pipelineStats.hpp"
+#include "unpackPipeline.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+#include <zstd.h>
+
+// --- stream input ---
+// An archive read front to back from a descriptor that can't seek (unpack -). A thread reads ahead in pieces, up to
+// READ_AHEAD bytes, so that waiting on the pipe and decoding overlap; read() hands out the bytes in order.
+class StreamInput
+{
+    static constexpr size_t PIECE        = 1 << 20;
+    static constexpr uint64_t READ_AHEAD = 64ull << 20;
+
+    int fd;
+    PipelineStats* stats;
+    BlockingQueue<std::string> pieces;
+    ByteBudget budget{READ_AHEAD};
+    BufferPool pool{READ_AHEAD};
+    std::exception_ptr error; // the reader's, set before it closes the queue
+    std::atomic<bool> stop{false};
+    std::thread reader;
+
+    std::string piece; // being consumed
+    size_t at         = 0;
+    uint64_t consumed = 0; // bytes handed out
+
+    void read_ahead()
+    {
+        try
+        {
+            bool eof = false;
+            while (!eof && !stop)
+            {
+                budget.acquire(PIECE);
+                std::string buf = pool.take(PIECE);
+                resize_for_overwrite(buf, PIECE);
+                size_t got = 0;
+                while (got < PIECE)
+                {
+                    ssize_t r = ::read(fd, buf.data() + got, PIECE - got);
+                    if (r < 0 && errno == EINTR)
+                        continue;
+                    if (r < 0)
+                        throw file_error("Failed to read archive: ", "stdin", errno);
+                    if (r == 0)
+                    {
+                        eof = true;
+                        break;
+                    }
+                    got += r;
+                }
+                buf.resize(got);
+                if (got == 0)
+                    budget.release(PIECE);
+                else
+                    pieces.push(std::move(buf));
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        pieces.close();
+    }
+
+    // Moves on to the next piece; false at the end of the input.
+    bool next_piece()
+    {
+        if (!piece.empty())
+        {
+            budget.release(PIECE);
+            pool.give(std::exchange(piece, {}));
+        }
+        at = 0;
+        std::optional<std::string> p;
+        {
+            StageTimer wait(stats, Stage::Wait);
+            p = pieces.pop();
+        }
+        if (!p)
+        {
+            if (error)
+                std::rethrow_exception(error);
+            return false;
+        }
+        piece = std::move(*p);
+        return true;
+    }
+
+public:
+    explicit StreamInput(int input, PipelineStats* counters = nullptr) : fd(input), stats(counters), reader([this] { read_ahead(); }) {}
+
+    StreamInput(const StreamInput&)            = delete;
+    StreamInput& operator=(const StreamInput&) = delete;
+
+    // Stops the reader after the read in progress, if any.
+    ~StreamInput()
+    {
+        stop = true;
+        if (!piece.empty())
+            budget.release(PIECE);
+        while (pieces.pop())
+            budget.release(PIECE);
+        reader.join();
+    }
+
+    // Archive offset of the next byte, for messages.
+    uint64_t offset() const { return consumed; }
+
+    // Exactly n bytes; throws when the input ends first.
+    void read(char* dst, size_t n)
+    {
+        while (n > 0)
+        {
+            if (at == piece.size() && !next_piece())
+                throw std::runtime_error("truncated archive: the input ends at offset " + std::to_string(consumed));
+            size_t k = std::min(n, piece.size() - at);
+            std::memcpy(dst, piece.data() + at, k);
+            at += k;
+            consumed += k;
+            dst += k;
+            n -= k;
+        }
+    }
+
+    void read(std::string& buf, size_t n)
+    {
+        resize_for_overwrite(buf, n);
+        read(buf.data(), n);
+    }
+
+    bool at_end() { return at == piece.size() && !next_piece(); }
+};
+
+// --- stream unpack ---
+// unpack - : restores an archive in the stream layout (see archiver.hpp) in one forward pass over stdin. The manifest
+// arrives in entries ahead of the data; each file node is restored as soon as its content is at hand:
+//   - content restored earlier is cloned or linked (--dedup) from the first file that has it, or copied out of it
+//     where that file has holes or holds it as a chunk,
+//   - content in the base archive (a delta packed with --base) is read from there,
+//   - otherwise the node waits for its record or solid block; a chunked file is written chunk by chunk and waits
+//     at the first chunk that hasn't arrived.
+// Records up to STREAM_THRESHOLD are decoded in memory, larger ones streamed into their first file. Files are created
+// through an OutputDir, as by UnpackPipeline; hard and symbolic links are made and the metadata applied once the
+// archive has been read to its trailer. Everything runs on one thread but the read-ahead; -j, --io and --no-mmap don't
+// apply.
+class StreamUnpacker
+{
+    static constexpr size_t PIECE   = 1 << 20; // streamed payloads are read this much at a time
+    static constexpr size_t NO_NODE = SIZE_MAX;
+
+    // A restored copy of a blob to take it from.
+    struct Location
+    {
+        fs::path path;
+        uint64_t offset = 0;       // in the file's packed bytes
+        uint64_t size   = 0;
+        size_t sparse   = NO_NODE; // the Sparse node whose map the file has
+        bool whole      = false;   // the file is exactly the blob, holes or chunks aside: a duplicate can be a clone
+    };
+
+    // A file node waiting for the content of a digest; for a chunked file, for its next chunk.
+    struct Waiter
+    {
+        size_t node;
+        bool chunk;
+    };
+
+    // A chunked file being written.
+    struct Pending
+    {
+        fs::path path;
+        std::vector<Digest> chunks;
+        size_t next      = 0; // chunks written
+        uint64_t written = 0;
+        FileSink sink; // refers to path
+
+        Pending(const OutputDir& dest, fs::path p, std::vector<Digest> list) : path(std::move(p)), chunks(std::move(list)), sink(dest, path) {}
+    };
+
+    const UnpackOptions& opts;
+    PipelineStats* stats;
+    StreamInput in;
+    fs::path root;
+    std::optional<OutputDir> dest;
+
+    Manifest manifest;
+    std::vector<fs::path> dirs; // by slot
+    std::optional<MetaTable> meta;
+    std::unique_ptr<ArchiveReader> base;
+    std::unique_ptr<ZSTD_DDict, size_t (*)(ZSTD_DDict*)> ddict{nullptr, ZSTD_freeDDict};
+    unsigned ddict_id = 0;
+
+    std::unordered_map<Digest, Location> restored;
+    std::unordered_map<Digest, std::vector<Waiter>> wanted;
+    std::unordered_map<size_t, Pending> pending;             // by node
+    std::vector<std::pair<fs::path, fs::path>> links;        // recorded hard links: (target, link)
+    std::vector<std::pair<std::string, fs::path>> symlinks;  // (target, link), made last
+    std::vector<SolidMember> members;                        // of the solid block that follows
+    bool ended = false;                                      // the manifest has been read
+
+    ZstdCtx zctx{ZstdCtx::Mode::Decompress};
+    std::string comp, data; // reused across records
+
+    fs::path path_of(size_t i) const { return dirs[manifest.node(i).parent] / manifest.name(manifest.node(i)); }
+
+    const SparseMap* map_of(size_t i) const
+    {
+        const Manifest::Node& n = manifest.node(i);
+        return n.kind == Manifest::Kind::Sparse ? &manifest.sparse(n) : nullptr;
+    }
+
+    void done(size_t i)
+    {
+        if (!stats)
+            return;
+        stats->count(Count::Files);
+        stats->count(Count::Bytes, manifest.stat(i)->size);
+    }
+
+    void write(FileSink& sink, const char* p, size_t n)
+    {
+        StageTimer timer(stats, Stage::Write, n);
+        sink.write(p, n);
+    }
+
+    // Appends the blob restored at from to sink.
+    void copy(const Location& from, FileSink& sink)
+    {
+        ExtentReader src(from.path, from.sparse == NO_NODE ? nullptr : map_of(from.sparse));
+        data.resize(PIECE);
+        for (uint64_t pos = 0; pos < from.size;)
+        {
+            size_t n = std::min<uint64_t>(from.size - pos, data.size());
+            if (src.read_at(from.offset + pos, data.data(), n) != n)
+                throw std::runtime_error("Failed to read file: " + from.path.string());
+            write(sink, data.data(), n);
+            pos += n;
+        }
+    }
+
+    // --- restoring nodes ---
+
+    void add_entries(const std::string& payload)
+    {
+        size_t first = manifest.add_entries(payload);
+        dirs.resize(manifest.size() + 1);
+        for (size_t i = first; i < manifest.size(); ++i)
+        {
+            const Manifest::Node& n = manifest.node(i);
+            fs::path path           = path_of(i);
+            if (n.kind == Manifest::Kind::Dir)
+            {
+                dest->make_dir(path);
+                dirs[Manifest::slot(i)] = std::move(path);
+                continue;
+            }
+            if (n.kind == Manifest::Kind::Symlink)
+            {
+                symlinks.emplace_back(manifest.link_target(n), std::move(path));
+                continue;
+            }
+            if (n.kind == Manifest::Kind::Link)
+            {
+                links.emplace_back(path_of(n.first), std::move(path));
+                continue;
+            }
+            if (stats)
+            {
+                stats->count(Count::FilesTotal);
+                stats->count(Count::BytesTotal, manifest.stat(i)->size);
+            }
+            if (n.kind == Manifest::Kind::Chunked)
+            {
+                pending.try_emplace(i, *dest, std::move(path), manifest.chunks(n));
+                advance(i);
+            }
+            else
+                restore_file(i);
+        }
+    }
+
+    // A whole-blob file: restored now if its content is, else left waiting for it.
+    void restore_file(size_t i)
+    {
+        const Digest& hash = manifest.digest(manifest.node(i));
+        fs::path path      = path_of(i);
+        if (auto it = restored.find(hash); it != restored.end())
+        {
+            const Location& from = it->second;
+            if (from.whole && manifest.node(i).kind == Manifest::Kind::File)
+            {
+                StageTimer timer(stats, Stage::Write);
+                restore_duplicate(*dest, from.path, path, opts.dedup);
+            }
+            else
+            {
+                FileSink sink(*dest, path, map_of(i));
+                copy(from, sink);
+                sink.close();
+            }
+        }
+        else if (base && base->find(hash))
+            base->extract_file(hash, *dest, path, zctx, comp, data, map_of(i));
+        else
+        {
+            wanted[hash].push_back({i, false});
+            return;
+        }
+        done(i);
+    }
+
+    // Writes the chunks of chunked file i that are at hand, in order; closes it after the last.
+    void advance(size_t i)
+    {
+        Pending& p = pending.at(i);
+        for (; p.next < p.chunks.size(); ++p.next)
+        {
+            const Digest& hash = p.chunks[p.next];
+            uint64_t size;
+            if (auto it = restored.find(hash); it != restored.end())
+            {
+                size = it->second.size;
+                copy(it->second, p.sink);
+            }
+            else if (base && base->find(hash))
+            {
+                base->read_blob(hash, zctx, comp, data);
+                size = data.size();
+                write(p.sink, data.data(), size);
+            }
+            else
+            {
+                wanted[hash].push_back({i, true});
+                return;
+            }
+            restored.try_emplace(hash, Location{p.path, p.written, size});
+            p.written += size;
+        }
+        p.sink.close();
+        pending.erase(i);
+        done(i);
+    }
+
+    /**
+     * The content of hash has arrived: fill(FileSink*) writes it to the sink given, or only consumes it when that is
+     * null (nothing waits for it). The first waiter, a plain file if there is one, gets it that way; the others copy it
+     * from there.
+     */
+    template <typename Fill>
+    void deliver(const Digest& hash, uint64_t size, Fill&& fill)
+    {
+        auto it = wanted.find(hash);
+        if (it == wanted.end())
+            return fill(nullptr);
+        std::vector<Waiter> waiters = std::move(it->second);
+        wanted.erase(it);
+        auto plain = std::find_if(waiters.begin(), waiters.end(), [&](const Waiter& w) { return !w.chunk && manifest.node(w.node).kind == Manifest::Kind::File; });
+        if (plain != waiters.end())
+            std::iter_swap(waiters.begin(), plain);
+
+        const Waiter& w = waiters.front();
+        if (w.chunk)
+        {
+            Pending& p = pending.at(w.node);
+            fill(&p.sink);
+            restored.insert_or_assign(hash, Location{p.path, p.written, size});
+            p.written += size;
+            ++p.next;
+            advance(w.node);
+        }
+        else
+        {
+            fs::path path = path_of(w.node);
+            FileSink sink(*dest, path, map_of(w.node));
+            fill(&sink);
+            sink.close();
+            bool sparse = manifest.node(w.node).kind == Manifest::Kind::Sparse;
+            restored.insert_or_assign(hash, Location{std::move(path), 0, size, sparse ? w.node : NO_NODE, !sparse});
+            done(w.node);
+        }
+        for (size_t k = 1; k < waiters.size(); ++k)
+        {
+            if (waiters[k].chunk)
+                advance(waiters[k].node);
+            else
+                restore_file(waiters[k].node);
+        }
+    }
+
+    // --- decoding ---
+
+    const ZSTD_DDict* dictionary_for(const char* frame, size_t size) const
+    {
+        return ddict && ZSTD_getDictID_fromFrame(frame, size) == ddict_id ? ddict.get() : nullptr;
+    }
+
+    void decode(Codec codec, const char* src, uint64_t csize, uint64_t usize, std::string& out)
+    {
+        StageTimer timer(stats, Stage::Decompress, usize);
+        if (codec == Codec::Store)
+        {
+            out.assign(src, csize);
+            return;
+        }
+        resize_for_overwrite(out, usize);
+        if (codec == Codec::Lz4)
+            return lz4_decompress(src, csize, out.data(), usize);
+        const ZSTD_DDict* dict = dictionary_for(src, csize);
+        size_t r = dict ? ZSTD_decompress_usingDDict(zctx.decompressor(), out.data(), usize, src, csize, dict)
+                        : ZSTD_decompressDCtx(zctx.decompressor(), out.data(), usize, src, csize);
+        if (ZSTD_isError(r) || r != usize)
+            throw std::runtime_error(ZSTD_isError(r) ? ZSTD_getErrorName(r) : "corrupt record");
+    }
+
+    // A record too large to hold: read and decoded a piece at a time, into sink when there is one.
+    void stream_payload(Codec codec, uint64_t csize, uint64_t usize, uint32_t crc, uint64_t offset, FileSink* sink)
+    {
+        ZSTD_DCtx* dctx = zctx.decompressor();
+        ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+        std::string out(codec == Codec::Zstd ? ZSTD_DStreamOutSize() : 0, '\0');
+        uint64_t got = 0;
+        auto put     = [&](const char* p, size_t n) {
+            got += n;
+            write(*sink, p, n);
+        };
+        size_t ret     = codec == Codec::Store ? 0 : 1;
+        uint32_t check = 0;
+        for (uint64_t left = csize; left > 0;)
+        {
+            size_t n = std::min<uint64_t>(left, PIECE);
+            in.read(comp, n);
+            check = crc32c(comp.data(), n, check);
+            if (sink)
+            {
+                StageTimer timer(stats, Stage::Decompress);
+                if (codec == Codec::Store)
+                    put(comp.data(), n);
+                else if (codec == Codec::Lz4)
+                {
+                    if (lz4_decompress_part(comp.data(), n, left == csize, data, put))
+                        ret = 0;
+                }
+                else
+                {
+                    if (left == csize)
+                        ZSTD_DCtx_refDDict(dctx, dictionary_for(comp.data(), n));
+                    ZSTD_inBuffer src{comp.data(), n, 0};
+                    while (src.pos < src.size)
+                    {
+                        ZSTD_outBuffer dst{out.data(), out.size(), 0};
+                        ret = ZSTD_decompressStream(dctx, &dst, &src);
+                        if (ZSTD_isError(ret))
+                            throw std::runtime_error(ZSTD_getErrorName(ret));
+                        put(out.data(), dst.pos);
+                    }
+                }
+            }
+            left -= n;
+        }
+        if (check != crc)
+            damaged_frame(offset);
+        if (sink && (ret != 0 || got != usize))
+            throw std::runtime_error("corrupt record at archive offset " + std::to_string(offset));
+    }
+
+    void read_record(const char* head, uint64_t offset)
+    {
+        Codec codec    = codec_of_tag(head);
+        Digest hash    = {loadLE<uint64_t>(head + 4), loadLE<uint64_t>(head + 12)};
+        uint64_t usize = loadLE<uint64_t>(head + 20);
+        uint64_t csize = frame_size(head, RECORD_HEADER_SIZE);
+        uint32_t crc   = frame_crc(head, RECORD_HEADER_SIZE);
+        if (codec == Codec::Store && csize != usize)
+            throw std::runtime_error("corrupt raw record");
+        if (usize > STREAM_THRESHOLD || csize > STREAM_THRESHOLD)
+            return deliver(hash, usize, [&](FileSink* sink) { stream_payload(codec, csize, usize, crc, offset, sink); });
+
+        in.read(comp, csize);
+        if (crc32c(comp.data(), csize) != crc)
+            damaged_frame(offset);
+        std::string& blob = codec == Codec::Store ? comp : data;
+        deliver(hash, usize, [&](FileSink* sink) {
+            if (!sink)
+                return;
+            if (codec != Codec::Store)
+                decode(codec, comp.data(), csize, usize, data);
+            write(*sink, blob.data(), blob.size());
+        });
+    }
+
+    void read_solid_block(const char* head, uint64_t offset)
+    {
+        uint64_t usize = loadLE<uint64_t>(head + 4);
+        uint64_t csize = frame_size(head, SOLID_HEADER_SIZE);
+        in.read(comp, csize);
+        if (crc32c(comp.data(), csize) != frame_crc(head, SOLID_HEADER_SIZE))
+            damaged_frame(offset);
+        std::string block;
+        {
+            StageTimer timer(stats, Stage::Decompress, usize);
+            resize_for_overwrite(block, usize);
+            if (codec_of_frame(comp.data(), csize) == Codec::Lz4)
+                lz4_decompress(comp.data(), csize, block.data(), usize);
+            else
+            {
+                size_t r = ZSTD_decompressDCtx(zctx.decompressor(), block.data(), usize, comp.data(), csize);
+                if (ZSTD_isError(r) || r != usize)
+                    throw std::runtime_error(ZSTD_isError(r) ? ZSTD_getErrorName(r) : "corrupt solid block");
+            }
+        }
+        for (const SolidMember& m : std::exchange(members, {}))
+        {
+            if (m.offset > usize || m.size > usize - m.offset)
+                throw std::runtime_error("corrupt solid block member list");
+            deliver(m.hash, m.size, [&](FileSink* sink) {
+                if (sink)
+                    write(*sink, block.data() + m.offset, m.size);
+            });
+        }
+    }
+
+    void read_block(const std::string& tag, const std::string& payload)
+    {
+        if (tag == "ENTS")
+            add_entries(payload);
+        else if (tag == "SMEM")
+        {
+            if (payload.size() % 32 != 0)
+                throw std::runtime_error("corrupt solid block member list");
+            members.clear();
+            for (const char* p = payload.data(); p != payload.data() + payload.size(); p += 32)
+                members.push_back({{loadLE<uint64_t>(p), loadLE<uint64_t>(p + 8)}, loadLE<uint64_t>(p + 16), loadLE<uint64_t>(p + 24)});
+        }
+        else if (tag == "DICT")
+        {
+            ddict.reset(ZSTD_createDDict(payload.data(), payload.size()));
+            if (!ddict)
+                throw std::runtime_error("corrupt dictionary");
+            ddict_id = ZSTD_getDictID_fromDDict(ddict.get());
+        }
+        else if (tag == "BASE")
+            open_base(payload);
+        else if (tag == "META")
+            meta = MetaTable::parse(payload);
+        else if (tag == "HDR0")
+        {
+            if (Manifest::parse(payload).size() != manifest.size())
+                throw std::runtime_error("the manifest entries don't add up to the manifest");
+            ended = true;
+            if (stats)
+                stats->found_all();
+        }
+        // the index and its sections are for seekable readers
+    }
+
+    // The base path of a stream is taken as relative to the current directory: the archive has no directory of its own.
+    void open_base(const std::string& link)
+    {
+        if (link.size() < 8)
+            throw std::runtime_error("corrupt base link");
+        fs::path path = link.substr(8);
+        if (!fs::exists(path))
+            throw std::runtime_error("base archive not found: " + path.string() + " (a streamed delta looks for it relative to the current directory)");
+        if (fs::file_size(path) != loadLE<uint64_t>(link.data()))
+            throw std::runtime_error("base archive has changed since the delta was packed: " + path.string());
+        base = std::make_unique<ArchiveReader>(path);
+    }
+
+    void read_trailer()
+    {
+        char trailer[TRAILER_SIZE];
+        in.read(trailer, sizeof(trailer));
+        if (std::memcmp(trailer + TRAILER_SIZE - 4, TRAILER_MAGIC, 4) != 0 ||
+            loadLE<uint32_t>(trailer + TRAILER_SIZE - 8) != crc32c(trailer, TRAILER_SIZE - 8))
+            damaged_frame(in.offset() - TRAILER_SIZE);
+        if (!in.at_end())
+            throw std::runtime_error("unexpected data after the archive trailer");
+    }
+
+public:
+    StreamUnpacker(const UnpackOptions& options, PipelineStats* counters, int input = STDIN_FILENO)
+        : opts(options), stats(counters), in(input, counters)
+    {
+    }
+
+    // Restores the archive read from the input below outdir; returns its manifest.
+    const Manifest& run(const fs::path& outdir)
+    {
+        root = outdir;
+        dest.emplace(root);
+        dirs.assign(1, root);
+        char head[RECORD_HEADER_SIZE];
+        std::string payload;
+        for (bool first = true;; first = false)
+        {
+            uint64_t offset = in.offset();
+            in.read(head, 4);
+            size_t hsize = frame_header_size(head);
+            in.read(head + 4, hsize - 4);
+            if (!frame_head_intact(head, hsize))
+                damaged_frame(offset);
+            std::string tag(head, 4);
+            if (first && tag != "STRM")
+                throw std::runtime_error("not an archive in the stream layout: pack to stdout, or with --streamable, to unpack from a pipe");
+
+            if (hsize == RECORD_HEADER_SIZE)
+                read_record(head, offset);
+            else if (tag == "SBLK")
+            {
+                if (members.empty())
+                    throw std::runtime_error("solid block without a member list at archive offset " + std::to_string(offset));
+                read_solid_block(head, offset);
+            }
+            else
+            {
+                in.read(payload, frame_size(head, hsize));
+                if (crc32c(payload.data(), payload.size()) != frame_crc(head, hsize))
+                    damaged_frame(offset);
+                if (tag == "IDX2")
+                    break;
+                read_block(tag, payload);
+            }
+        }
+        read_trailer();
+        if (!ended)
+            throw std::runtime_error("the archive has no manifest");
+        if (!wanted.empty())
+        {
+            const Waiter& w = wanted.begin()->second.front();
+            throw std::runtime_error("the archive ends without the content of " + (w.chunk ? pending.at(w.node).path : path_of(w.node)).string());
+        }
+
+        for (auto& [target, link] : links)
+            if (!link_file(*dest, target, link))
+                clone_file(*dest, target, link);
+        for (auto& [target, link] : symlinks)
+            dest->make_symlink(target, link);
+        if (meta)
+        {
+            if (size_t refused = MetaApplier(manifest).run(*meta, root))
+                std::cout << "warning: " << refused << " metadata changes refused by the filesystem\n";
+        }
+        return manifest;
+    }
+};
@@ -0,0 +1,114 @@
+// Regression test: --deterministic packs are byte-identical whatever the thread count.
+// Files with the same content under different extensions share one blob; its solid group used to be taken from the
+// extension of whichever worker claimed the blob first.
+#include "archiver.hpp"
+#include "manifest.hpp"
+#include "metadata.hpp"
+#include "packPipeline.hpp"
+
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Many small files, each content stored once as .txt, once as .md and once as .json. The metadata table records
+// access times: each file's and directory's is set an hour ahead, past its modification and change times, so that
+// relatime leaves it alone when packing reads the file or lists the directory.
+static void make_tree(const fs::path& dir)
+{
+    const char* exts[] = {".txt", ".md", ".json"};
+    for (int d = 0; d < 8; ++d)
+    {
+        fs::path sub = dir / ("d" + std::to_string(d));
+        fs::create_directories(sub);
+        for (int i = 0; i < 64; ++i)
+        {
+            std::string content;
+            for (int k = 0; k < 50 + i; ++k)
+                content += "line " + std::to_string(d * 1000 + i * 7 + k) + " of some text\n";
+            std::string name = std::string("f").append(std::to_string(i)); // its three copies are next to each other in the walk
+            for (int e = 0; e < 3; ++e)
+                std::ofstream(sub / (name + exts[e])) << content;
+        }
+    }
+
+    struct timespec times[2] = {{std::time(nullptr) + 3600, 0}, {1000000000, 0}};
+    ::utimensat(AT_FDCWD, dir.c_str(), times, 0);
+    for (const fs::directory_entry& e : fs::recursive_directory_iterator(dir))
+        ::utimensat(AT_FDCWD, e.path().c_str(), times, 0);
+}
+
+static std::string pack(const fs::path& tree, const fs::path& archive, PackOptions opts)
+{
+    {
+        ArchiveWriter writer(archive, opts.hash);
+        Manifest manifest;
+        MetaTable meta;
+        build_structure(tree, manifest, writer, opts, nullptr, nullptr, &meta);
+        writer.write_block("META", meta.serialize());
+        writer.write_header(manifest.serialize(opts.compress_manifest));
+        writer.write_index();
+    }
+    std::ifstream in(archive, std::ios::binary);
+    return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+int main()
+{
+    fs::path dir = fs::temp_directory_path() / ("archiveTool-deterministicTest-" + std::to_string(::getpid()));
+    fs::remove_all(dir);
+    make_tree(dir / "tree");
+
+    for (IoBackend io : {IoBackend::Sync, IoBackend::Threads})
+#ifdef ARCHIVETOOL_HAVE_LZ4
+        for (Codec codec : {Codec::Zstd, Codec::Lz4})
+#else
+        for (Codec codec : {Codec::Zstd})
+#endif
+        {
+            PackOptions opts;
+            opts.deterministic = true;
+            opts.solid         = true;
+            opts.solid_block   = 64 << 10; // several blocks per group
+            opts.io            = io;
+            opts.codec         = codec;
+            std::string what   = std::string(io_backend_name(io)) + " io, " + codec_name(codec);
+
+            std::string first;
+            for (unsigned threads : {1u, 8u, 16u, 8u, 16u})
+            {
+                opts.threads      = threads;
+                std::string bytes = pack(dir / "tree", dir / "a.arc", opts);
+                if (threads == 1)
+                    first = bytes;
+                else
+                    check(bytes == first, what + ": -j " + std::to_string(threads) + " differs from -j 1");
+            }
+        }
+
+    fs::remove_all(dir);
+    if (failures)
+        return EXIT_FAILURE;
+    std::cout << "deterministicTest: ok\n";
+    return EXIT_SUCCESS;
+}
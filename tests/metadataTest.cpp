@@ -0,0 +1,99 @@
+// Regression test: unpack must not take a node's file type from the archive's metadata table.
+// A crafted archive pairs a symbolic link to a file outside the output directory with a regular-file META row;
+// applying that row used to chmod the link's target.
+#include "archiver.hpp"
+#include "manifest.hpp"
+#include "metadata.hpp"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function" // the header's static helpers this test doesn't call
+#include "unpackPipeline.hpp"
+#pragma GCC diagnostic pop
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what)
+{
+    if (!ok)
+    {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+static uint32_t mode_of(const fs::path& path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? st.st_mode & 07777 : 0;
+}
+
+// An archive holding one symbolic link "lnk" -> target, with the META row given.
+static void write_archive(const fs::path& archive, const fs::path& target, const FileMeta& row)
+{
+    Manifest manifest;
+    manifest.add_symlink(Manifest::ROOT, "lnk", target.string());
+    MetaTable meta;
+    meta.set(0, row);
+    ArchiveWriter writer(archive);
+    writer.write_block("META", meta.serialize());
+    writer.write_header(manifest.serialize());
+    writer.write_index();
+}
+
+// Unpacks archive below out; true when it went through.
+static bool unpack(const fs::path& archive, const fs::path& out)
+{
+    fs::create_directories(out);
+    ArchiveReader reader(archive);
+    Manifest manifest = Manifest::parse(reader.read_header());
+    std::optional<std::string> block = reader.read_section("META");
+    MetaTable meta = MetaTable::parse(*block);
+    try
+    {
+        restore_structure(manifest, out, reader, UnpackOptions{}, &meta);
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "unpack refused: " << e.what() << "\n";
+        return false;
+    }
+}
+
+int main()
+{
+    fs::path dir = fs::temp_directory_path() / ("archiveTool-metadataTest-" + std::to_string(::getpid()));
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    fs::path victim = dir / "victim";
+    std::ofstream(victim) << "not to be touched\n";
+    fs::permissions(victim, fs::perms::owner_read | fs::perms::owner_write);
+
+    // a link with a regular file's mode: rejected, and the file outside the output directory keeps its mode
+    write_archive(dir / "crafted.arc", victim, {S_IFREG | 0777, 0, 0, 0, 0, {}});
+    check(!unpack(dir / "crafted.arc", dir / "out1"), "a symlink node with a regular-file META row is rejected");
+    check(mode_of(victim) == 0600, "the link's target keeps its mode");
+
+    // the same link with a link's mode: restored, and its target untouched
+    write_archive(dir / "plain.arc", victim, {S_IFLNK | 0777, 0, 0, 0, 0, {}});
+    check(unpack(dir / "plain.arc", dir / "out2"), "a symlink node with a link's META row unpacks");
+    check(fs::is_symlink(dir / "out2" / "lnk"), "the link is restored");
+    check(mode_of(victim) == 0600, "the link's target keeps its mode");
+
+    fs::remove_all(dir);
+    if (failures)
+        return EXIT_FAILURE;
+    std::cout << "metadataTest: ok\n";
+    return EXIT_SUCCESS;
+}
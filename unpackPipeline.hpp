@@ -0,0 +1,589 @@
+#pragma once
+#include "archiver.hpp"
+#include "asyncIo.hpp"
+#include "bufferPool.hpp"
+#include "manifest.hpp"
+#include "metadata.hpp"
+#include "pipelineStats.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fnmatch.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+// --- duplicate restore ---
+// How the further destinations of a duplicated file are made from the first one:
+// Reflink shares the first file's extents (FICLONE) where the filesystem supports it, else lets the kernel copy
+// (copy_file_range), else copies; Hardlink links them to the first file (one inode: editing one edits all,
+// falls back to Reflink across filesystems); Copy always copies.
+enum class Dedup : uint8_t
+{
+    Reflink,
+    Hardlink,
+    Copy,
+};
+
+inline const char* dedup_name(Dedup d)
+{
+    switch (d)
+    {
+        case Dedup::Reflink: return "reflink";
+        case Dedup::Hardlink: return "hardlink";
+        case Dedup::Copy: return "copy";
+    }
+    return "unknown";
+}
+
+inline std::optional<Dedup> dedup_from_name(std::string_view name)
+{
+    for (Dedup d : {Dedup::Reflink, Dedup::Hardlink, Dedup::Copy})
+        if (name == dedup_name(d))
+            return d;
+    return std::nullopt;
+}
+
+// Copies in to out from the start with reads and writes; false on an error.
+inline bool copy_data(int in, int out)
+{
+    std::string buf(1 << 20, '\0');
+    for (off_t pos = 0;;)
+    {
+        ssize_t r = ::pread(in, buf.data(), buf.size(), pos);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return r == 0;
+        for (ssize_t k = 0; k < r;)
+        {
+            ssize_t w = ::pwrite(out, buf.data() + k, r - k, pos + k);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0)
+                return false;
+            k += w;
+        }
+        pos += r;
+    }
+}
+
+// Replaces dst with a hard link to src, both below dest; false when the filesystem refuses (other device, link limit...).
+inline bool link_file(const OutputDir& dest, const fs::path& src, const fs::path& dst) { return dest.make_link(src, dst); }
+
+// Replaces dst with a clone of src (both below dest), or an in-kernel copy where cloning isn't supported; with
+// share false, with a plain copy.
+inline void clone_file(const OutputDir& dest, const fs::path& src, const fs::path& dst, bool share = true)
+{
+    int in = dest.open(src, O_RDONLY);
+    if (in < 0)
+        throw file_error("Failed to open file: ", src, errno);
+    int out = dest.create(dst);
+    if (out < 0)
+    {
+        int err = errno;
+        ::close(in);
+        throw file_error("Failed to write file: ", dst, err);
+    }
+    bool done = false;
+#ifdef FICLONE
+    done = share && ::ioctl(out, FICLONE, in) == 0;
+#endif
+    struct stat st;
+    if (share && !done && ::fstat(in, &st) == 0)
+    {
+        off_t left = st.st_size;
+        ssize_t r  = 0;
+        while (left > 0 && ((r = ::copy_file_range(in, nullptr, out, nullptr, left, 0)) > 0 || (r < 0 && errno == EINTR)))
+            left -= std::max<ssize_t>(r, 0);
+        done = left == 0 || r == 0; // r == 0: src got shorter, copied what there was
+    }
+    if (!done) // no copy_file_range here (e.g. across filesystems on older kernels)
+        done = copy_data(in, out);
+    int err = errno;
+    ::close(in);
+    if (::close(out) != 0 && done)
+        done = false, err = errno;
+    if (!done)
+        throw file_error("Failed to write file: ", dst, err);
+}
+
+inline void restore_duplicate(const OutputDir& dest, const fs::path& src, const fs::path& dst, Dedup mode)
+{
+    if (mode == Dedup::Hardlink && link_file(dest, src, dst))
+        return;
+    clone_file(dest, src, dst, mode != Dedup::Copy);
+}
+
+struct UnpackOptions
+{
+    unsigned threads  = std::max(1u, std::thread::hardware_concurrency());
+    bool use_mmap     = true;            // read the archive through a mapping instead of pread
+    bool dump_json    = false;           // print the manifest as JSON before unpacking
+    IoBackend io      = IoBackend::Sync; // how restored files are written (usable_backend() already applied)
+    unsigned io_depth = 32;              // files in flight (or writing threads) with an asynchronous backend
+    Dedup dedup       = Dedup::Reflink;  // how duplicate files are restored
+    bool salvage      = false;           // damaged archive: skip files that fail to decode instead of stopping
+    bool progress     = false;           // show files, bytes, throughput and ETA on stderr while restoring
+    bool stats_json   = false;           // print per-stage times and counters as JSON at the end
+};
+
+// Decompressed bytes queued for writing at most, with an asynchronous I/O backend.
+inline constexpr uint64_t WRITE_BEHIND_BYTES = 256ull << 20;
+
+// --- unpack pipeline ---
+// The manifest is flattened into one work item per unique hash (sorted by archive offset, so the threads
+// sweep the archive front to back). Each thread decompresses its blob with its own context and positioned
+// reads, writes the first destination and then fills the duplicate destinations from it.
+// Chunked files are one work item each, reassembled from their chunk blobs.
+// All targets in one solid block form a single work item: the block is decompressed once and sliced.
+// For a delta archive blobs come from anywhere along the base chain; each archive is swept in turn.
+// With an asynchronous I/O backend (--io threads|uring) whole files that fit in memory are handed to a FileWriter
+// instead, many files at a time. With --dedup copy every destination is written from the decompressed buffer;
+// otherwise only the first is, and the duplicates are cloned or linked from it once the writer has finished.
+// A sparse file is a work item of its own (its holes are its own even where its data is shared), written through a
+// FileSink that puts the data back in its extents and leaves the rest as holes; it always takes the synchronous path.
+// Hard links recorded by pack (Link nodes) are recreated once the data is written, as hard links whatever --dedup
+// says; one whose target isn't being extracted gets the target's content instead.
+// Everything is created below the output directory through an OutputDir, and symbolic links only after all the rest,
+// so no file is ever written through a link. Then the metadata table, if the archive has one, is applied in one pass
+// (see MetaApplier).
+// With UnpackOptions::salvage a work item that fails is dropped (with whatever it wrote) rather than stopping the
+// others, and the paths it would have restored are reported as lost.
+class UnpackPipeline
+{
+    struct Target
+    {
+        Digest hash{};
+        uint64_t offset = 0;
+        std::vector<fs::path> paths{}; // first one is extracted, the rest are copies
+        std::vector<Digest> chunks{};  // chunked files only
+        bool chunked = false;
+        IndexEntry entry{}; // whole files: where the blob is; chunked files: the archive of the first chunk
+        bool deferred = false; // duplicates left for after the asynchronous writes
+        std::optional<SparseMap> sparse{}; // the blob is the packed bytes of a file with holes
+        uint64_t size = 0;                 // bytes per destination, holes included; only set for statistics
+    };
+
+    const UnpackOptions& opts;
+    const ArchiveReader& reader;
+    const MetaTable* meta;
+    PipelineStats* stats; // the reader's, null unless asked for
+
+    std::vector<Target> targets;
+    std::unordered_map<Digest, size_t> by_hash;   // digest -> targets index
+    std::vector<std::pair<size_t, size_t>> items; // work items: [begin, end) ranges of targets
+    BufferPool buffers{WRITE_BEHIND_BYTES};      // decoded files handed to the write-behind
+    std::optional<OutputDir> dest;                // the output directory, everything is created through it
+    std::optional<FileWriter> out;                // asynchronous I/O only
+    std::vector<std::pair<fs::path, fs::path>> links; // recorded hard links: (target, link)
+    std::vector<std::pair<std::string, fs::path>> symlinks; // (target, link), made last
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::mutex error_m;
+    std::exception_ptr first_error;
+    std::vector<size_t> failed_items; // salvage only
+    std::vector<fs::path> lost_paths;
+
+    void collect(const Manifest& manifest, const fs::path& base, const std::vector<bool>* keep)
+    {
+        std::vector<fs::path> dirs(manifest.size() + 1); // by slot
+        dirs[Manifest::ROOT] = base;
+        for (size_t i = 0; i < manifest.size(); ++i)
+        {
+            const Manifest::Node& n = manifest.node(i);
+            if (keep && !(*keep)[i])
+                continue;
+            fs::path path = dirs[n.parent] / manifest.name(n);
+            if (n.kind == Manifest::Kind::Dir)
+            {
+                dest->make_dir(path);
+                dirs[Manifest::slot(i)] = std::move(path);
+                continue;
+            }
+            if (n.kind == Manifest::Kind::Symlink)
+            {
+                symlinks.emplace_back(manifest.link_target(n), std::move(path));
+                continue;
+            }
+            const Manifest::Node& c = manifest.target(n); // the node with the content
+            if (n.kind == Manifest::Kind::Link && (!keep || (*keep)[n.first]))
+            {
+                links.emplace_back(dirs[c.parent] / manifest.name(c), std::move(path));
+                continue;
+            }
+            if (c.kind == Manifest::Kind::Chunked)
+            {
+                Target t{.offset = 0, .paths = {std::move(path)}, .chunks = manifest.chunks(c), .chunked = true};
+                if (!t.chunks.empty())
+                {
+                    t.offset        = reader.record_offset(lookup(t.chunks.front()));
+                    t.entry.archive = lookup(t.chunks.front()).archive;
+                }
+                targets.push_back(std::move(t));
+                continue;
+            }
+
+            const Digest& hash = manifest.digest(c);
+            if (c.kind == Manifest::Kind::Sparse)
+            {
+                const IndexEntry& e = lookup(hash);
+                targets.push_back({.hash = hash, .offset = reader.record_offset(e), .paths = {std::move(path)}});
+                targets.back().entry  = e;
+                targets.back().sparse = manifest.sparse(c);
+                continue;
+            }
+            auto [it, inserted] = by_hash.try_emplace(hash, targets.size());
+            if (inserted)
+            {
+                const IndexEntry& e = lookup(hash);
+                targets.push_back({.hash = hash, .offset = reader.record_offset(e)});
+                targets.back().entry = e;
+            }
+            targets[it->second].paths.push_back(std::move(path));
+        }
+    }
+
+    const IndexEntry& lookup(const Digest& hash) const
+    {
+        const IndexEntry* e = reader.find(hash);
+        if (!e)
+            throw std::runtime_error("hash " + hash.hex() + " not found in archive");
+        return *e;
+    }
+
+    void write_file(const Target& t, const char* data, size_t size) const
+    {
+        StageTimer timer(stats, Stage::Write, size);
+        FileSink sink(*dest, t.paths.front(), t.sparse ? &*t.sparse : nullptr);
+        sink.write(data, size);
+        sink.close();
+    }
+
+    void copy_duplicates(const Target& t) const
+    {
+        StageTimer timer(stats, Stage::Write);
+        for (size_t k = 1; k < t.paths.size(); ++k)
+            restore_duplicate(*dest, t.paths.front(), t.paths[k], opts.dedup);
+    }
+
+    // Queues the destinations of t for writing from [offset, offset + size) of buf: all of them with --dedup copy,
+    // else the first, the others being deferred.
+    void write_behind(Target& t, const std::shared_ptr<const std::string>& buf, size_t offset, size_t size)
+    {
+        t.deferred = opts.dedup != Dedup::Copy && t.paths.size() > 1;
+        for (size_t k = 0; k < (t.deferred ? 1 : t.paths.size()); ++k)
+            out->write(t.paths[k], buf, offset, size);
+    }
+
+    // Decodes work item i and writes (or queues) its files.
+    void restore(size_t i, ZstdCtx& zctx, std::string& comp, std::string& data)
+    {
+        auto [begin, end] = items[i];
+        if (end - begin > 1 && out)
+        {
+            std::string buf = buffers.take(targets[end - 1].entry.offset + targets[end - 1].entry.usize);
+            reader.read_block(targets[begin].entry, zctx, comp, buf);
+            auto block = buffers.share(std::move(buf));
+            for (size_t k = begin; k < end; ++k)
+            {
+                if (targets[k].sparse)
+                    write_file(targets[k], block->data() + targets[k].entry.offset, targets[k].entry.usize);
+                else
+                    write_behind(targets[k], block, targets[k].entry.offset, targets[k].entry.usize);
+            }
+            return;
+        }
+        if (end - begin > 1) // several members of one solid block
+        {
+            reader.read_block(targets[begin].entry, zctx, comp, data);
+            for (size_t k = begin; k < end; ++k)
+            {
+                write_file(targets[k], data.data() + targets[k].entry.offset, targets[k].entry.usize);
+                copy_duplicates(targets[k]);
+            }
+            return;
+        }
+
+        Target& t = targets[begin];
+        if (out && !t.chunked && !t.sparse && t.entry.usize <= STREAM_THRESHOLD)
+        {
+            std::string buf = buffers.take(t.entry.usize);
+            reader.read_blob(t.hash, zctx, comp, buf);
+            auto blob = buffers.share(std::move(buf));
+            write_behind(t, blob, 0, blob->size());
+            return;
+        }
+        if (t.chunked)
+            reader.extract_chunks(t.chunks, *dest, t.paths.front(), zctx, comp, data);
+        else
+            reader.extract_file(t.hash, *dest, t.paths.front(), zctx, comp, data, t.sparse ? &*t.sparse : nullptr);
+        copy_duplicates(t);
+    }
+
+    void work()
+    {
+        ZstdCtx zctx{ZstdCtx::Mode::Decompress};
+        std::string comp, data; // reused across blobs
+        size_t i;
+        while (!failed && (i = next.fetch_add(1)) < items.size())
+        {
+            uint64_t start = stats ? now_ns() : 0;
+            try
+            {
+                restore(i, zctx, comp, data);
+            }
+            catch (...)
+            {
+                std::lock_guard lock(error_m);
+                if (opts.salvage)
+                {
+                    failed_items.push_back(i);
+                    continue;
+                }
+                if (!first_error)
+                    first_error = std::current_exception();
+                failed = true;
+            }
+            if (stats) // the files of an item (duplicates, solid block members) complete together: each gets a share
+            {
+                auto [begin, end] = items[i];
+                size_t files      = 0;
+                uint64_t bytes    = 0;
+                for (size_t k = begin; k < end; ++k)
+                {
+                    files += targets[k].paths.size();
+                    bytes += targets[k].size * targets[k].paths.size();
+                }
+                uint64_t share = (now_ns() - start) / std::max<size_t>(1, files);
+                for (size_t k = 0; k < files; ++k)
+                    stats->file_done(share);
+                stats->count(Count::Files, files);
+                stats->count(Count::Bytes, bytes);
+            }
+        }
+    }
+
+    // Creates the directories and lays out the work items.
+    void plan(const Manifest& manifest, const fs::path& base, const std::vector<bool>* keep)
+    {
+        StageTimer timer(stats, Stage::Index);
+        collect(manifest, base, keep);
+        std::sort(targets.begin(), targets.end(), [](auto& a, auto& b) {
+            return std::tie(a.entry.archive, a.offset, a.entry.offset) < std::tie(b.entry.archive, b.offset, b.entry.offset);
+        });
+        auto same_block = [](const Target& a, const Target& b) { return a.entry.block != NO_BLOCK && std::tie(a.entry.archive, a.entry.block) == std::tie(b.entry.archive, b.entry.block); };
+        for (size_t begin = 0, end; begin < targets.size(); begin = end)
+        {
+            end = begin + 1;
+            while (end < targets.size() && same_block(targets[begin], targets[end]))
+                ++end;
+            items.emplace_back(begin, end);
+        }
+        if (stats)
+            count_totals();
+    }
+
+    // The files and bytes to restore, for progress: hard links are left out, they are made last and take no time.
+    void count_totals()
+    {
+        for (Target& t : targets)
+        {
+            if (t.sparse)
+                t.size = t.sparse->size;
+            else if (t.chunked)
+                for (const Digest& d : t.chunks)
+                    t.size += lookup(d).usize;
+            else
+                t.size = t.entry.usize;
+            stats->count(Count::FilesTotal, t.paths.size());
+            stats->count(Count::BytesTotal, t.size * t.paths.size());
+        }
+        stats->found_all();
+    }
+
+public:
+    UnpackPipeline(const UnpackOptions& options, const ArchiveReader& r, const MetaTable* m = nullptr) : opts(options), reader(r), meta(m), stats(r.stats()) {}
+
+    // Restores the nodes flagged in keep (all of them when null); a kept node's parent directories must be kept too.
+    void run(const Manifest& manifest, const fs::path& base, const std::vector<bool>* keep = nullptr)
+    {
+        dest.emplace(base);
+        plan(manifest, base, keep);
+        if (opts.io != IoBackend::Sync)
+            out.emplace(opts.io, opts.io_depth, WRITE_BEHIND_BYTES, *dest);
+        unsigned n = std::min<size_t>(std::max(1u, opts.threads), std::max<size_t>(1, items.size()));
+        std::vector<std::thread> workers;
+        for (unsigned k = 0; k < n; ++k)
+            workers.emplace_back([this] { work(); });
+        for (auto& t : workers)
+            t.join();
+        if (out)
+        {
+            StageTimer wait(stats, Stage::Wait); // the asynchronous writes still queued
+            out->finish();
+        }
+
+        if (first_error)
+            std::rethrow_exception(first_error);
+        for (size_t i : failed_items)
+            for (size_t k = items[i].first; k < items[i].second; ++k)
+                for (auto& path : targets[k].paths)
+                {
+                    dest->remove(path);
+                    lost_paths.push_back(path);
+                }
+        for (const Target& t : targets)
+            if (t.deferred)
+                copy_duplicates(t);
+        for (auto& [target, link] : links)
+        {
+            if (opts.salvage && !dest->exists(target))
+                lost_paths.push_back(link);
+            else if (!link_file(*dest, target, link))
+                clone_file(*dest, target, link);
+        }
+        for (auto& [target, link] : symlinks)
+            dest->make_symlink(target, link);
+        if (meta)
+        {
+            if (size_t refused = MetaApplier(manifest).run(*meta, base, keep))
+                std::cout << "warning: " << refused << " metadata changes refused by the filesystem\n";
+        }
+    }
+
+    // Salvage: the destinations left out because their content failed to decode.
+    const std::vector<fs::path>& lost() const { return lost_paths; }
+};
+
+static void restore_structure(const Manifest& manifest, const fs::path& base, const ArchiveReader& reader, const UnpackOptions& opts,
+                              const MetaTable* meta = nullptr)
+{
+    reader.advise(ArchiveReader::Access::Sequential);
+    UnpackPipeline pipeline(opts, reader, meta);
+    pipeline.run(manifest, base);
+}
+
+/**
+ * Flags the nodes whose path matches pattern (fnmatch, '*' also crosses '/'), everything below a matching
+ * directory, and the directories leading to a match. Returns the number of matching entries.
+ */
+static size_t select_paths(const Manifest& manifest, std::string pattern, std::vector<bool>& keep)
+{
+    while (pattern.starts_with("./"))
+        pattern.erase(0, 2);
+    while (pattern.size() > 1 && pattern.back() == '/')
+        pattern.pop_back();
+
+    std::vector<std::string> dirs = manifest.dir_paths();
+    std::vector<bool> hit(manifest.size(), false); // matched, or below a matched directory
+    keep.assign(manifest.size(), false);
+    size_t matched = 0;
+    for (size_t i = 0; i < manifest.size(); ++i)
+    {
+        const Manifest::Node& n = manifest.node(i);
+        std::string path        = dirs[n.parent] + std::string(manifest.name(n));
+        hit[i]                  = (n.parent != Manifest::ROOT && hit[n.parent - 1]) || ::fnmatch(pattern.c_str(), path.c_str(), 0) == 0;
+        if (!hit[i])
+            continue;
+        ++matched;
+        keep[i] = true;
+        for (uint32_t s = n.parent; s != Manifest::ROOT && !keep[s - 1]; s = manifest.node(s - 1).parent)
+            keep[s - 1] = true;
+    }
+    return matched;
+}
+
+// Restores the entries matching pattern (see select_paths) below base, reading only their records.
+static size_t extract_matching(const Manifest& manifest, const std::string& pattern, const fs::path& base, const ArchiveReader& reader,
+                               const UnpackOptions& opts, const MetaTable* meta = nullptr)
+{
+    std::vector<bool> keep;
+    size_t matched = select_paths(manifest, pattern, keep);
+    if (matched == 0)
+        return 0;
+    reader.advise(ArchiveReader::Access::Random);
+    UnpackPipeline pipeline(opts, reader, meta);
+    pipeline.run(manifest, base, &keep);
+    return matched;
+}
+
+/**
+ * Restores what a damaged archive (a reader opened for salvage) still holds: all directories and symbolic links, and
+ * every file whose content is intact. Lost files are listed on stdout; returns how many there were.
+ */
+static size_t salvage_structure(const Manifest& manifest, const fs::path& base, const ArchiveReader& reader, UnpackOptions opts,
+                                const MetaTable* meta = nullptr)
+{
+    std::vector<bool> keep(manifest.size(), true);
+    size_t lost = 0;
+    for (size_t i = 0; i < manifest.size(); ++i)
+    {
+        const Manifest::Node& n = manifest.node(i);
+        if (n.kind == Manifest::Kind::Dir || n.kind == Manifest::Kind::Symlink)
+            continue;
+        const Manifest::Node& c = manifest.target(n);
+        bool intact             = c.kind == Manifest::Kind::Chunked
+                                      ? std::ranges::all_of(manifest.chunks(c), [&](const Digest& h) { return reader.readable(h); })
+                                      : reader.readable(manifest.digest(c));
+        if (!intact)
+        {
+            keep[i] = false;
+            ++lost;
+            std::cout << "lost: " << manifest.path(i) << "\n";
+        }
+    }
+
+    opts.salvage = true;
+    reader.advise(ArchiveReader::Access::Sequential);
+    UnpackPipeline pipeline(opts, reader);
+    pipeline.run(manifest, base, &keep);
+    for (auto& path : pipeline.lost())
+        std::cout << "lost: " << path.lexically_relative(base).string() << "\n";
+    lost += pipeline.lost().size();
+
+    if (meta)
+    {
+        OutputDir dest(base);
+        for (size_t i = 0; i < manifest.size(); ++i) // only what actually got restored
+            keep[i] = keep[i] && dest.exists(base / manifest.path(i));
+        if (size_t refused = MetaApplier(manifest).run(*meta, base, &keep))
+            std::cout << "warning: " << refused << " metadata changes refused by the filesystem\n";
+    }
+    return lost;
+}
+
+// Salvage without a manifest: every intact blob of the archive is written below base, named by its digest.
+static size_t salvage_blobs(const ArchiveReader& reader, const fs::path& base)
+{
+    OutputDir dest(base);
+    ZstdCtx zctx{ZstdCtx::Mode::Decompress};
+    std::string comp, data;
+    size_t written = 0;
+    for (const Digest& hash : reader.blobs())
+    {
+        if (!reader.readable(hash))
+            continue;
+        try
+        {
+            reader.extract_file(hash, dest, base / hash.hex(), zctx, comp, data);
+            ++written;
+        }
+        catch (...)
+        {
+            dest.remove(base / hash.hex());
+        }
+    }
+    return written;
+}
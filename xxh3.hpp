@@ -0,0 +1,452 @@
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+/**
+ * XXH3-128 (xxHash 0.8, seed 0, default secret), one-shot and streaming.
+ * Output matches the reference XXH3_128bits(). Inputs above 240 bytes go through the
+ * 8-lane stripe accumulator, which uses SSE2/AVX2 when the target has them and plain
+ * 64-bit arithmetic otherwise.
+ */
+namespace xxh3 {
+
+struct Hash128
+{
+    uint64_t low64;
+    uint64_t high64;
+};
+
+inline constexpr uint32_t PRIME32_1 = 0x9E3779B1U;
+inline constexpr uint32_t PRIME32_2 = 0x85EBCA77U;
+inline constexpr uint32_t PRIME32_3 = 0xC2B2AE3DU;
+inline constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+inline constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+inline constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+inline constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+inline constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+inline constexpr uint64_t PRIME_MX1 = 0x165667919E3779F9ULL;
+inline constexpr uint64_t PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+
+inline constexpr size_t SECRET_SIZE         = 192;
+inline constexpr size_t STRIPE_LEN          = 64;
+inline constexpr size_t SECRET_CONSUME_RATE = 8;
+inline constexpr size_t ACC_NB              = 8;
+inline constexpr size_t MIDSIZE_MAX         = 240;
+inline constexpr size_t SECRET_SIZE_MIN     = 136;
+inline constexpr size_t SECRET_LASTACC      = 7;
+inline constexpr size_t SECRET_MERGEACCS    = 11;
+inline constexpr size_t STRIPES_PER_BLOCK   = (SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE;
+inline constexpr size_t BUFFER_SIZE         = 256;
+
+alignas(64) inline constexpr uint8_t SECRET[SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+// --- primitives ---
+inline uint64_t read64(const uint8_t* p)
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    if constexpr (std::endian::native == std::endian::big)
+        v = __builtin_bswap64(v);
+    return v;
+}
+
+inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    if constexpr (std::endian::native == std::endian::big)
+        v = __builtin_bswap32(v);
+    return v;
+}
+
+inline Hash128 mult64to128(uint64_t lhs, uint64_t rhs)
+{
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 uint128; // not ISO C++: keeps -Wpedantic quiet
+    uint128 p = static_cast<uint128>(lhs) * rhs;
+    return {static_cast<uint64_t>(p), static_cast<uint64_t>(p >> 64)};
+#else
+    uint64_t lo_lo = (lhs & 0xFFFFFFFF) * (rhs & 0xFFFFFFFF);
+    uint64_t hi_lo = (lhs >> 32) * (rhs & 0xFFFFFFFF);
+    uint64_t lo_hi = (lhs & 0xFFFFFFFF) * (rhs >> 32);
+    uint64_t hi_hi = (lhs >> 32) * (rhs >> 32);
+    uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+    uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+    return {lower, upper};
+#endif
+}
+
+inline uint64_t mul128_fold64(uint64_t lhs, uint64_t rhs)
+{
+    Hash128 p = mult64to128(lhs, rhs);
+    return p.low64 ^ p.high64;
+}
+
+inline uint64_t xorshift64(uint64_t v, int shift) { return v ^ (v >> shift); }
+
+inline uint64_t xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t avalanche(uint64_t h)
+{
+    h = xorshift64(h, 37);
+    h *= PRIME_MX1;
+    return xorshift64(h, 32);
+}
+
+inline uint64_t mix16B(const uint8_t* input, const uint8_t* secret)
+{
+    return mul128_fold64(read64(input) ^ read64(secret), read64(input + 8) ^ read64(secret + 8));
+}
+
+inline Hash128 mix32B(Hash128 acc, const uint8_t* in1, const uint8_t* in2, const uint8_t* secret)
+{
+    acc.low64 += mix16B(in1, secret);
+    acc.low64 ^= read64(in2) + read64(in2 + 8);
+    acc.high64 += mix16B(in2, secret + 16);
+    acc.high64 ^= read64(in1) + read64(in1 + 8);
+    return acc;
+}
+
+// --- short inputs ---
+inline Hash128 len_1to3(const uint8_t* input, size_t len)
+{
+    uint8_t c1         = input[0];
+    uint8_t c2         = input[len >> 1];
+    uint8_t c3         = input[len - 1];
+    uint32_t combinedl = (uint32_t(c1) << 16) | (uint32_t(c2) << 24) | uint32_t(c3) | (uint32_t(len) << 8);
+    uint32_t combinedh = std::rotl(__builtin_bswap32(combinedl), 13);
+    uint64_t bitflipl  = read32(SECRET) ^ read32(SECRET + 4);
+    uint64_t bitfliph  = read32(SECRET + 8) ^ read32(SECRET + 12);
+    return {xxh64_avalanche(uint64_t(combinedl) ^ bitflipl), xxh64_avalanche(uint64_t(combinedh) ^ bitfliph)};
+}
+
+inline Hash128 len_4to8(const uint8_t* input, size_t len)
+{
+    uint64_t input_64 = read32(input) + (uint64_t(read32(input + len - 4)) << 32);
+    uint64_t keyed    = input_64 ^ (read64(SECRET + 16) ^ read64(SECRET + 24));
+
+    Hash128 m = mult64to128(keyed, PRIME64_1 + (len << 2));
+    m.high64 += m.low64 << 1;
+    m.low64 ^= m.high64 >> 3;
+    m.low64 = xorshift64(m.low64, 35);
+    m.low64 *= PRIME_MX2;
+    m.low64  = xorshift64(m.low64, 28);
+    m.high64 = avalanche(m.high64);
+    return m;
+}
+
+inline Hash128 len_9to16(const uint8_t* input, size_t len)
+{
+    uint64_t bitflipl = read64(SECRET + 32) ^ read64(SECRET + 40);
+    uint64_t bitfliph = read64(SECRET + 48) ^ read64(SECRET + 56);
+    uint64_t input_lo = read64(input);
+    uint64_t input_hi = read64(input + len - 8);
+
+    Hash128 m = mult64to128(input_lo ^ input_hi ^ bitflipl, PRIME64_1);
+    m.low64 += uint64_t(len - 1) << 54;
+    input_hi ^= bitfliph;
+    m.high64 += input_hi + uint64_t(uint32_t(input_hi)) * (PRIME32_2 - 1);
+    m.low64 ^= __builtin_bswap64(m.high64);
+
+    Hash128 h = mult64to128(m.low64, PRIME64_2);
+    h.high64 += m.high64 * PRIME64_2;
+    return {avalanche(h.low64), avalanche(h.high64)};
+}
+
+inline Hash128 finish_mid(Hash128 acc, size_t len)
+{
+    Hash128 h;
+    h.low64  = avalanche(acc.low64 + acc.high64);
+    h.high64 = 0 - avalanche(acc.low64 * PRIME64_1 + acc.high64 * PRIME64_4 + uint64_t(len) * PRIME64_2);
+    return h;
+}
+
+inline Hash128 len_17to128(const uint8_t* input, size_t len)
+{
+    Hash128 acc{len * PRIME64_1, 0};
+    if (len > 32)
+    {
+        if (len > 64)
+        {
+            if (len > 96)
+                acc = mix32B(acc, input + 48, input + len - 64, SECRET + 96);
+            acc = mix32B(acc, input + 32, input + len - 48, SECRET + 64);
+        }
+        acc = mix32B(acc, input + 16, input + len - 32, SECRET + 32);
+    }
+    acc = mix32B(acc, input, input + len - 16, SECRET);
+    return finish_mid(acc, len);
+}
+
+inline Hash128 len_129to240(const uint8_t* input, size_t len)
+{
+    Hash128 acc{len * PRIME64_1, 0};
+    for (size_t i = 32; i < 160; i += 32)
+        acc = mix32B(acc, input + i - 32, input + i - 16, SECRET + i - 32);
+    acc.low64  = avalanche(acc.low64);
+    acc.high64 = avalanche(acc.high64);
+    for (size_t i = 160; i <= len; i += 32)
+        acc = mix32B(acc, input + i - 32, input + i - 16, SECRET + 3 + i - 160);
+    acc = mix32B(acc, input + len - 16, input + len - 32, SECRET + SECRET_SIZE_MIN - 17 - 16);
+    return finish_mid(acc, len);
+}
+
+inline Hash128 hash_short(const uint8_t* input, size_t len)
+{
+    if (len > 128)
+        return len_129to240(input, len);
+    if (len > 16)
+        return len_17to128(input, len);
+    if (len > 8)
+        return len_9to16(input, len);
+    if (len >= 4)
+        return len_4to8(input, len);
+    if (len)
+        return len_1to3(input, len);
+    return {xxh64_avalanche(read64(SECRET + 64) ^ read64(SECRET + 72)), xxh64_avalanche(read64(SECRET + 80) ^ read64(SECRET + 88))};
+}
+
+// --- long inputs: 8 x 64-bit accumulators over 64-byte stripes ---
+inline void accumulate_512(uint64_t* acc, const uint8_t* input, const uint8_t* secret)
+{
+#if defined(__AVX2__)
+    for (size_t i = 0; i < 2; ++i)
+    {
+        __m256i a        = _mm256_load_si256(reinterpret_cast<__m256i*>(acc) + i);
+        __m256i data     = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input) + i);
+        __m256i key      = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i);
+        __m256i data_key = _mm256_xor_si256(data, key);
+        __m256i key_lo   = _mm256_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m256i product  = _mm256_mul_epu32(data_key, key_lo);
+        __m256i swap     = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        _mm256_store_si256(reinterpret_cast<__m256i*>(acc) + i, _mm256_add_epi64(product, _mm256_add_epi64(a, swap)));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (size_t i = 0; i < 4; ++i)
+    {
+        __m128i a        = _mm_load_si128(reinterpret_cast<__m128i*>(acc) + i);
+        __m128i data     = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input) + i);
+        __m128i key      = _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret) + i);
+        __m128i data_key = _mm_xor_si128(data, key);
+        __m128i key_lo   = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i product  = _mm_mul_epu32(data_key, key_lo);
+        __m128i swap     = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc) + i, _mm_add_epi64(product, _mm_add_epi64(a, swap)));
+    }
+#else
+    for (size_t i = 0; i < ACC_NB; ++i)
+    {
+        uint64_t data     = read64(input + 8 * i);
+        uint64_t data_key = data ^ read64(secret + 8 * i);
+        acc[i ^ 1] += data; // swap adjacent lanes
+        acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+    }
+#endif
+}
+
+inline void scramble(uint64_t* acc, const uint8_t* secret)
+{
+#if defined(__AVX2__)
+    const __m256i prime = _mm256_set1_epi32(static_cast<int>(PRIME32_1));
+    for (size_t i = 0; i < 2; ++i)
+    {
+        __m256i a        = _mm256_load_si256(reinterpret_cast<__m256i*>(acc) + i);
+        __m256i data     = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+        __m256i data_key = _mm256_xor_si256(data, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i));
+        __m256i key_hi   = _mm256_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m256i prod_lo  = _mm256_mul_epu32(data_key, prime);
+        __m256i prod_hi  = _mm256_mul_epu32(key_hi, prime);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(acc) + i, _mm256_add_epi64(prod_lo, _mm256_slli_epi64(prod_hi, 32)));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i prime = _mm_set1_epi32(static_cast<int>(PRIME32_1));
+    for (size_t i = 0; i < 4; ++i)
+    {
+        __m128i a        = _mm_load_si128(reinterpret_cast<__m128i*>(acc) + i);
+        __m128i data     = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        __m128i data_key = _mm_xor_si128(data, _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret) + i));
+        __m128i key_hi   = _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1));
+        __m128i prod_lo  = _mm_mul_epu32(data_key, prime);
+        __m128i prod_hi  = _mm_mul_epu32(key_hi, prime);
+        _mm_store_si128(reinterpret_cast<__m128i*>(acc) + i, _mm_add_epi64(prod_lo, _mm_slli_epi64(prod_hi, 32)));
+    }
+#else
+    for (size_t i = 0; i < ACC_NB; ++i)
+    {
+        uint64_t a = xorshift64(acc[i], 47) ^ read64(secret + 8 * i);
+        acc[i]     = a * PRIME32_1;
+    }
+#endif
+}
+
+inline void accumulate(uint64_t* acc, const uint8_t* input, const uint8_t* secret, size_t stripes)
+{
+    for (size_t n = 0; n < stripes; ++n)
+        accumulate_512(acc, input + n * STRIPE_LEN, secret + n * SECRET_CONSUME_RATE);
+}
+
+inline uint64_t merge_accs(const uint64_t* acc, const uint8_t* secret, uint64_t start)
+{
+    uint64_t result = start;
+    for (size_t i = 0; i < 4; ++i)
+        result += mul128_fold64(acc[2 * i] ^ read64(secret + 16 * i), acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+    return avalanche(result);
+}
+
+inline Hash128 finish_long(const uint64_t* acc, uint64_t len)
+{
+    return {merge_accs(acc, SECRET + SECRET_MERGEACCS, len * PRIME64_1), merge_accs(acc, SECRET + SECRET_SIZE - 64 - SECRET_MERGEACCS, ~(len * PRIME64_2))};
+}
+
+struct alignas(64) Accumulators
+{
+    uint64_t v[ACC_NB] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+};
+
+inline Hash128 hash_long(const uint8_t* input, size_t len)
+{
+    Accumulators acc;
+    const size_t block_len = STRIPE_LEN * STRIPES_PER_BLOCK;
+    const size_t nb_blocks = (len - 1) / block_len;
+    for (size_t n = 0; n < nb_blocks; ++n)
+    {
+        accumulate(acc.v, input + n * block_len, SECRET, STRIPES_PER_BLOCK);
+        scramble(acc.v, SECRET + SECRET_SIZE - STRIPE_LEN);
+    }
+    size_t stripes = ((len - 1) - block_len * nb_blocks) / STRIPE_LEN;
+    accumulate(acc.v, input + nb_blocks * block_len, SECRET, stripes);
+    accumulate_512(acc.v, input + len - STRIPE_LEN, SECRET + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC);
+    return finish_long(acc.v, len);
+}
+
+inline Hash128 hash128(const void* data, size_t len)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    return len <= MIDSIZE_MAX ? hash_short(p, len) : hash_long(p, len);
+}
+
+/**
+ * Streaming XXH3-128: same result as hash128() over the concatenated input.
+ */
+class State
+{
+    Accumulators acc;
+    alignas(64) uint8_t buffer[BUFFER_SIZE];
+    size_t buffered        = 0;
+    uint64_t total         = 0;
+    size_t stripes_so_far  = 0; // within the current block
+
+    const uint8_t* consume(uint64_t* a, size_t* so_far, const uint8_t* input, size_t stripes) const
+    {
+        if (stripes >= STRIPES_PER_BLOCK - *so_far)
+        {
+            size_t this_iter = STRIPES_PER_BLOCK - *so_far;
+            const uint8_t* secret = SECRET + *so_far * SECRET_CONSUME_RATE;
+            do
+            {
+                accumulate(a, input, secret, this_iter);
+                scramble(a, SECRET + SECRET_SIZE - STRIPE_LEN);
+                input += this_iter * STRIPE_LEN;
+                stripes -= this_iter;
+                this_iter = STRIPES_PER_BLOCK;
+                secret    = SECRET;
+                *so_far   = 0;
+            } while (stripes >= STRIPES_PER_BLOCK);
+        }
+        if (stripes > 0)
+        {
+            accumulate(a, input, SECRET + *so_far * SECRET_CONSUME_RATE, stripes);
+            input += stripes * STRIPE_LEN;
+            *so_far += stripes;
+        }
+        return input;
+    }
+
+public:
+    void reset() { *this = State(); }
+
+    void update(const void* data, size_t len)
+    {
+        const uint8_t* input = static_cast<const uint8_t*>(data);
+        const uint8_t* end   = input + len;
+        total += len;
+
+        if (len <= BUFFER_SIZE - buffered)
+        {
+            if (len)
+                std::memcpy(buffer + buffered, input, len);
+            buffered += len;
+            return;
+        }
+
+        if (buffered)
+        {
+            size_t load = BUFFER_SIZE - buffered;
+            std::memcpy(buffer + buffered, input, load);
+            input += load;
+            consume(acc.v, &stripes_so_far, buffer, BUFFER_SIZE / STRIPE_LEN);
+            buffered = 0;
+        }
+        if (static_cast<size_t>(end - input) > BUFFER_SIZE)
+        {
+            size_t stripes = static_cast<size_t>(end - 1 - input) / STRIPE_LEN;
+            input          = consume(acc.v, &stripes_so_far, input, stripes);
+            std::memcpy(buffer + BUFFER_SIZE - STRIPE_LEN, input - STRIPE_LEN, STRIPE_LEN); // last stripe, for digest()
+        }
+        std::memcpy(buffer, input, static_cast<size_t>(end - input));
+        buffered = static_cast<size_t>(end - input);
+    }
+
+    Hash128 digest() const
+    {
+        if (total <= MIDSIZE_MAX)
+            return hash_short(buffer, static_cast<size_t>(total));
+
+        Accumulators a = acc;
+        uint8_t last[STRIPE_LEN];
+        const uint8_t* last_ptr;
+        if (buffered >= STRIPE_LEN)
+        {
+            size_t so_far = stripes_so_far;
+            consume(a.v, &so_far, buffer, (buffered - 1) / STRIPE_LEN);
+            last_ptr = buffer + buffered - STRIPE_LEN;
+        }
+        else
+        {
+            size_t catchup = STRIPE_LEN - buffered;
+            std::memcpy(last, buffer + BUFFER_SIZE - catchup, catchup);
+            std::memcpy(last + catchup, buffer, buffered);
+            last_ptr = last;
+        }
+        accumulate_512(a.v, last_ptr, SECRET + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC);
+        return finish_long(a.v, total);
+    }
+};
+
+} // namespace xxh3
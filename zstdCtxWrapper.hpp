@@ -1,4 +1,8 @@
 #pragma once
+#include "bufferPool.hpp"
+
+#include <algorithm>
+#include <bit>
 #include <stdexcept>
 #include <string>
 #include <zstd.h>
@@ -14,6 +18,9 @@ public:
 
 private:
     Mode mode;
+    int level       = 0;     // compression level the context was created with
+    int window_log  = 23;    // window the context was set up with
+    bool long_range = false; // long-distance matching enabled
     union
     {
         ZSTD_CCtx* cctx;
@@ -21,7 +28,7 @@ private:
     };
 
 public:
-    explicit ZstdCtx(Mode m, int compressionLevel = 6, int nbWorkers = 2) : mode(m)
+    explicit ZstdCtx(Mode m, int compressionLevel = 6, int nbWorkers = 0) : mode(m), level(compressionLevel)
     {
         if (mode == Mode::Compress)
         {
@@ -31,11 +38,11 @@ public:
 
             // 🔧 Compression tuning
             ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compressionLevel); // level 6 = good balance
-            ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, nbWorkers);               // 2 threads = best perf/watt
-            ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, 23);                      // 8 MB window — fine for mixed files
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, nbWorkers);               // 0 = single-threaded, deterministic frames
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, window_log);              // 8 MB window — fine for mixed files
             ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);                    // integrity check per frame
             ZSTD_CCtx_setParameter(cctx, ZSTD_c_contentSizeFlag, 1);                 // store uncompressed size
-            ZSTD_CCtx_setParameter(cctx, ZSTD_c_dictIDFlag, 0);                      // no dict id
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_dictIDFlag, 1);                      // frames name their dictionary, if any
         }
         else
         {
@@ -56,6 +63,9 @@ public:
         }
     }
 
+    ZstdCtx(const ZstdCtx&)            = delete;
+    ZstdCtx& operator=(const ZstdCtx&) = delete;
+
     ~ZstdCtx()
     {
         if (mode == Mode::Compress)
@@ -77,4 +87,85 @@ public:
             throw std::logic_error("Not a decompression context");
         return dctx;
     }
+
+    /**
+     * Level for the frames compressed from now on; set_level(default_level()) goes back to the original one.
+     */
+    void set_level(int l) const { ZSTD_CCtx_setParameter(compressor(), ZSTD_c_compressionLevel, l); }
+    int default_level() const { return level; }
+
+    /**
+     * Long-distance matching over a 128 MB window (the most a default decoder accepts), for large inputs with distant repeats.
+     */
+    void enable_long_range()
+    {
+        long_range = true;
+        window_log = 27;
+        ZSTD_CCtx_setParameter(compressor(), ZSTD_c_enableLongDistanceMatching, 1);
+        ZSTD_CCtx_setParameter(compressor(), ZSTD_c_windowLog, window_log);
+    }
+
+    /**
+     * Compress src as one frame into dst. dst is resized to the frame size and can be reused.
+     */
+    void compress(const char* src, size_t size, std::string& dst) const
+    {
+        resize_for_overwrite(dst, ZSTD_compressBound(size));
+        size_t csize = ZSTD_compress2(compressor(), dst.data(), dst.size(), // destination buffer + size
+                                      src, size                             // source buffer + size
+        );
+        if (ZSTD_isError(csize))
+            throw std::runtime_error(std::string("ZSTD compression error: ") + ZSTD_getErrorName(csize));
+        dst.resize(csize);
+    }
+
+    void compress(const std::string& src, std::string& dst) const { compress(src.data(), src.size(), dst); }
+
+    /**
+     * Same as compress(), against a prepared dictionary (null = none). The CDict may be shared between threads.
+     */
+    void compress(const char* src, size_t size, std::string& dst, const ZSTD_CDict* dict) const
+    {
+        if (!dict)
+            return compress(src, size, dst);
+        ZSTD_CCtx_refCDict(compressor(), dict);
+        try
+        {
+            compress(src, size, dst);
+        }
+        catch (...)
+        {
+            ZSTD_CCtx_refCDict(compressor(), nullptr);
+            throw;
+        }
+        ZSTD_CCtx_refCDict(compressor(), nullptr);
+    }
+
+    /**
+     * Same as compress(), with prefix as reference content (as zstd --patch-from does): long-distance matching and a
+     * window spanning prefix and data, so repeats anywhere in the prefix are found. The frame decodes only with the
+     * same prefix (ZSTD_DCtx_refPrefix), and needs a decoder window of up to prefix + size.
+     */
+    void compress_with_prefix(const char* src, size_t size, std::string& dst, const char* prefix, size_t prefix_size) const
+    {
+        int wlog = std::max(window_log, static_cast<int>(std::bit_width(prefix_size + size)));
+        ZSTD_CCtx_setParameter(compressor(), ZSTD_c_windowLog, std::min(wlog, ZSTD_cParam_getBounds(ZSTD_c_windowLog).upperBound));
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+        auto restore = [&] {
+            ZSTD_CCtx_refPrefix(cctx, nullptr, 0);
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, window_log);
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, long_range ? 1 : 0);
+        };
+        ZSTD_CCtx_refPrefix(cctx, prefix, prefix_size); // used by the next frame only
+        try
+        {
+            compress(src, size, dst);
+        }
+        catch (...)
+        {
+            restore();
+            throw;
+        }
+        restore();
+    }
 };